@@ -13,6 +13,7 @@
 
 #include <memory>
 #include <boost/asio/io_service.hpp>
+#include <maidsafe/crux/detail/constants.hpp>
 #include <maidsafe/crux/detail/service.hpp>
 #include <maidsafe/crux/endpoint.hpp>
 #include <maidsafe/crux/socket.hpp>
@@ -29,8 +30,11 @@ public:
     using endpoint_type = crux::endpoint;
     using socket_type = crux::socket;
 
+    // The backlog bounds the handshakes that are remembered while no accept
+    // request is ready for them, like that of listen().
     acceptor(boost::asio::io_service& io,
-             endpoint_type local_endpoint);
+             endpoint_type local_endpoint,
+             std::size_t backlog = detail::constant::accept_backlog);
 
     template <typename CompletionToken>
     typename boost::asio::async_result<
@@ -67,6 +71,8 @@ private:
 #include <cassert>
 #include <utility>
 #include <functional>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <maidsafe/crux/detail/move_capture.hpp>
 
 namespace maidsafe
 {
@@ -74,10 +80,12 @@ namespace crux
 {
 
 inline acceptor::acceptor(boost::asio::io_service& io,
-                          endpoint_type local_endpoint)
+                          endpoint_type local_endpoint,
+                          std::size_t backlog)
     : boost::asio::basic_io_object<detail::service>(io),
       multiplexer(get_service().add(local_endpoint))
 {
+    multiplexer->listen(backlog);
 }
 
 inline acceptor::~acceptor()
@@ -117,11 +125,13 @@ acceptor::async_accept(socket_type& socket,
             socket.set_multiplexer(multiplexer);
             multiplexer->async_accept
                 (*this, socket,
-                 [this, &socket, handler]
-                 (const boost::system::error_code& error) mutable
-                 {
-                     this->process_accept(error, socket, std::move(handler));
-                 });
+                 detail::move_capture(std::move(handler),
+                                      [this, &socket]
+                                      (handler_type& handler,
+                                       const boost::system::error_code& error)
+                                      {
+                                          this->process_accept(error, socket, std::move(handler));
+                                      }));
             break;
 
         case socket_type::connectivity::established:
@@ -173,10 +183,9 @@ void acceptor::invoke_handler(Handler&& handler,
     assert(error);
 
     get_io_service().post
-        ([handler, error]() mutable
-         {
-             handler(boost::asio::error::make_error_code(error));
-         });
+        (boost::asio::detail::bind_handler(std::forward<Handler>(handler),
+                                           boost::system::error_code
+                                               (boost::asio::error::make_error_code(error))));
 }
 
 } // namespace crux
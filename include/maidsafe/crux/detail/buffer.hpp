@@ -12,7 +12,10 @@
 #define MAIDSAFE_CRUX_DETAIL_BUFFER_HPP
 
 #include <algorithm>
+#include <chrono>
+#include <memory>
 #include <vector>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
 
 namespace maidsafe
 {
@@ -23,6 +26,20 @@ namespace detail
 
 using buffer = std::vector<char>;
 
+// Received payload whose memory is recycled by the multiplexer arena. It is
+// handed to the application as is by the batch receive, and may be released
+// on any thread.
+struct payload_buffer : std::vector<char, handler_allocator<char>>
+{
+    using vector_type = std::vector<char, handler_allocator<char>>;
+    using vector_type::vector_type;
+
+    // When the datagram arrived at the UDP socket, as stamped by the kernel
+    // where it does so.
+    std::chrono::steady_clock::time_point arrival;
+};
+using payload_handle = std::shared_ptr<const payload_buffer>;
+
 } // namespace detail
 } // namespace crux
 } // namespace maidsafe
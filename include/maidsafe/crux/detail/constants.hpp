@@ -12,6 +12,7 @@
 #define MAIDSAFE_CRUX_DETAIL_CONSTANTS_HPP
 
 #include <chrono>
+#include <cstddef>
 
 namespace maidsafe
 {
@@ -32,6 +33,78 @@ const std::chrono::seconds initial_roundtrip_time(3);
 
 const std::chrono::seconds keepalive_timeout(5*initial_roundtrip_time);
 
+// An established connection that has received nothing for the idle time is
+// probed, and closed once this many probes in a row go unanswered. Probes
+// are sent one retransmission timeout apart, but not more often than the
+// minimum interval.
+const std::chrono::seconds keepalive_idle(initial_roundtrip_time);
+const std::size_t keepalive_probes = 3;
+const std::chrono::milliseconds keepalive_min_interval(200);
+
+// Handshakes are retransmitted sooner than other packets, because connection
+// setup is part of the latency seen by the application. The timeout doubles
+// from the initial one up to the initial roundtrip time.
+const std::chrono::milliseconds connect_initial_timeout(200);
+const std::size_t connect_max_attempts = 8;
+const std::chrono::seconds connect_deadline(keepalive_timeout);
+
+// How long async_shutdown waits for unacknowledged data and the shutdown
+// frame to be acknowledged before the socket is closed regardless
+const std::chrono::seconds shutdown_linger(2*initial_roundtrip_time);
+
+// Delay between handshakes to different endpoints of the same remote host,
+// as recommended by RFC 8305, section 5
+const std::chrono::milliseconds connect_attempt_delay(250);
+
+// How long a handshake cookie stays valid. Covers a retransmission of the
+// handshake that echoes it.
+const std::chrono::seconds cookie_lifetime(2*initial_roundtrip_time);
+
+// How long a resumption ticket lets a client skip the handshake exchange
+const std::chrono::seconds ticket_lifetime(10 * 60);
+
+// Tickets that a client keeps for remote endpoints. The oldest is evicted
+// when another remote endpoint issues one.
+const std::size_t max_stored_tickets = 1024;
+
+// Tickets that an acceptor remembers as used until they expire. While that
+// many are in use, clients fall back to the full handshake.
+const std::size_t max_redeemed_tickets = 4096;
+
+// Handshakes that an acceptor remembers while no accept request is ready for
+// them, unless it is given another backlog (like that of listen().)
+const std::size_t accept_backlog = 128;
+
+// Largest UDP payload. Datagrams coalesced by the kernel never exceed it.
+const std::size_t max_datagram_size = 65535 - 8;
+
+// Bytes a socket may hold for the application before it stops accepting
+// data. A message is always accepted if nothing is held.
+const std::size_t default_receive_budget = 128 * 1024;
+
+// Largest kernel buffer that a multiplexer asks for, however many sockets
+// share it
+const std::size_t max_udp_buffer_size = 16 * 1024 * 1024;
+
+// The kernel charges every datagram for its bookkeeping as well as for its
+// payload. Linux doubles the buffer sizes asked for to make up for that,
+// which is not enough for datagrams of a kilobyte or less, so the buffers
+// are asked to be this many times the receive windows that they hold. That
+// also covers a window of such frames when the kernel does not coalesce
+// them, as without segmentation offload.
+const std::size_t udp_buffer_headroom = 4;
+
+// Most frames that a parity frame covers. The receiver holds back up to as
+// many frames that arrive ahead of a missing one, so that the missing frame
+// can be reconstructed when the parity frame arrives.
+const std::size_t max_parity_group = 16;
+
+// Data frames with up to this much payload are sent with a compact header
+// to remote endpoints that receive them. Next to larger payloads the header
+// matters little, and those keep the full header so that they land directly
+// in the buffers posted by the application.
+const std::size_t max_compact_payload = 1024;
+
 } // namespace constant
 } // namespace detail
 } // namespace crux
@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_COOKIE_HPP
+#define MAIDSAFE_CRUX_DETAIL_COOKIE_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <boost/asio/ip/udp.hpp>
+#include <maidsafe/crux/detail/constants.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+// SipHash-2-4 of the data under a 128-bit key
+std::uint64_t siphash(std::uint64_t key0,
+                      std::uint64_t key1,
+                      const std::uint8_t *data,
+                      std::size_t size);
+
+// Stateless handshake cookies.
+//
+// An acceptor answers a handshake from an unknown endpoint with a cookie
+// rather than committing any state to it. The cookie is a keyed MAC of the
+// remote endpoint, the initial sequence number of the handshake and a
+// coarse timestamp, so it can be verified without having been remembered.
+// The handshake is only processed once the client echoes a valid cookie.
+//
+// Resumption tickets are generated the same way, with another key and a
+// longer lifetime. They are bound to the address but not the port of the
+// client, and to an initial sequence number of zero.
+
+class cookie_generator
+{
+public:
+    using endpoint_type = boost::asio::ip::udp::endpoint;
+
+    // Timestamp (4 bytes) followed by the MAC (8 bytes)
+    static const std::size_t size = 12;
+    using value_type = std::array<std::uint8_t, size>;
+
+    // Generate with a random key
+    explicit cookie_generator(std::chrono::seconds lifetime = constant::cookie_lifetime);
+
+    cookie_generator(std::uint64_t key0,
+                     std::uint64_t key1,
+                     std::chrono::seconds lifetime = constant::cookie_lifetime);
+
+    value_type generate(const endpoint_type& remote_endpoint,
+                        std::uint32_t initial_sequence_number,
+                        std::uint32_t now = clock()) const;
+
+    bool verify(const value_type& cookie,
+                const endpoint_type& remote_endpoint,
+                std::uint32_t initial_sequence_number,
+                std::uint32_t now = clock()) const;
+
+    // Seconds of a monotonic clock
+    static std::uint32_t clock();
+
+private:
+    std::uint64_t mac(const endpoint_type& remote_endpoint,
+                      std::uint32_t initial_sequence_number,
+                      std::uint32_t timestamp) const;
+
+private:
+    std::uint64_t key0;
+    std::uint64_t key1;
+    std::uint32_t lifetime;
+};
+
+// Cookie or ticket presented by a handshake
+struct handshake_token
+{
+    // header::constant::handshake_token_cookie or _ticket
+    std::uint16_t kind;
+    cookie_generator::value_type value;
+};
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <algorithm>
+#include <random>
+#include <maidsafe/crux/detail/decoder.hpp>
+#include <maidsafe/crux/detail/encoder.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+namespace siphash_detail
+{
+
+inline std::uint64_t rotate(std::uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline void round(std::uint64_t (&v)[4])
+{
+    v[0] += v[1]; v[1] = rotate(v[1], 13); v[1] ^= v[0]; v[0] = rotate(v[0], 32);
+    v[2] += v[3]; v[3] = rotate(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = rotate(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = rotate(v[1], 17); v[1] ^= v[2]; v[2] = rotate(v[2], 32);
+}
+
+} // namespace siphash_detail
+
+inline std::uint64_t siphash(std::uint64_t key0,
+                             std::uint64_t key1,
+                             const std::uint8_t *data,
+                             std::size_t size)
+{
+    std::uint64_t v[4] = { key0 ^ 0x736f6d6570736575ULL,
+                           key1 ^ 0x646f72616e646f6dULL,
+                           key0 ^ 0x6c7967656e657261ULL,
+                           key1 ^ 0x7465646279746573ULL };
+
+    const std::size_t blocks = size / 8;
+    for (std::size_t block = 0; block < blocks; ++block)
+    {
+        std::uint64_t word = 0;
+        for (std::size_t i = 0; i < 8; ++i)
+        {
+            word |= std::uint64_t(data[block * 8 + i]) << (8 * i);
+        }
+        v[3] ^= word;
+        siphash_detail::round(v);
+        siphash_detail::round(v);
+        v[0] ^= word;
+    }
+
+    std::uint64_t last = std::uint64_t(size & 0xFF) << 56;
+    for (std::size_t i = blocks * 8; i < size; ++i)
+    {
+        last |= std::uint64_t(data[i]) << (8 * (i - blocks * 8));
+    }
+    v[3] ^= last;
+    siphash_detail::round(v);
+    siphash_detail::round(v);
+    v[0] ^= last;
+
+    v[2] ^= 0xFF;
+    for (int i = 0; i < 4; ++i)
+    {
+        siphash_detail::round(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+inline cookie_generator::cookie_generator(std::chrono::seconds lifetime)
+    : lifetime(static_cast<std::uint32_t>(lifetime.count()))
+{
+    std::random_device device;
+    std::uniform_int_distribution<std::uint64_t> distribution;
+    key0 = distribution(device);
+    key1 = distribution(device);
+}
+
+inline cookie_generator::cookie_generator(std::uint64_t key0,
+                                          std::uint64_t key1,
+                                          std::chrono::seconds lifetime)
+    : key0(key0),
+      key1(key1),
+      lifetime(static_cast<std::uint32_t>(lifetime.count()))
+{
+}
+
+inline std::uint32_t cookie_generator::clock()
+{
+    using namespace std::chrono;
+    return static_cast<std::uint32_t>
+        (duration_cast<seconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+inline std::uint64_t cookie_generator::mac(const endpoint_type& remote_endpoint,
+                                           std::uint32_t initial_sequence_number,
+                                           std::uint32_t timestamp) const
+{
+    // Address (IPv4 addresses are mapped to IPv6), port, initial sequence
+    // number and timestamp
+    std::array<std::uint8_t, 16 + 2 + 4 + 4> input;
+    const auto address = remote_endpoint.address().is_v4()
+        ? boost::asio::ip::address_v6::v4_mapped(remote_endpoint.address().to_v4()).to_bytes()
+        : remote_endpoint.address().to_v6().to_bytes();
+    std::copy(address.begin(), address.end(), input.begin());
+
+    detail::encoder encoder(input.data() + address.size(), input.size() - address.size());
+    encoder.put<std::uint16_t>(remote_endpoint.port());
+    encoder.put<std::uint32_t>(initial_sequence_number);
+    encoder.put<std::uint32_t>(timestamp);
+
+    return siphash(key0, key1, input.data(), input.size());
+}
+
+inline cookie_generator::value_type
+cookie_generator::generate(const endpoint_type& remote_endpoint,
+                           std::uint32_t initial_sequence_number,
+                           std::uint32_t now) const
+{
+    const auto value = mac(remote_endpoint, initial_sequence_number, now);
+
+    value_type result;
+    detail::encoder encoder(result.data(), result.size());
+    encoder.put<std::uint32_t>(now);
+    encoder.put<std::uint32_t>(static_cast<std::uint32_t>(value >> 32));
+    encoder.put<std::uint32_t>(static_cast<std::uint32_t>(value));
+    return result;
+}
+
+inline bool cookie_generator::verify(const value_type& cookie,
+                                     const endpoint_type& remote_endpoint,
+                                     std::uint32_t initial_sequence_number,
+                                     std::uint32_t now) const
+{
+    detail::decoder decoder(cookie.data(), cookie.data() + cookie.size());
+    const auto timestamp = decoder.get<std::uint32_t>();
+    std::uint64_t value = decoder.get<std::uint32_t>();
+    value = (value << 32) | decoder.get<std::uint32_t>();
+
+    // Unsigned arithmetic also rejects timestamps from the future
+    if (std::uint32_t(now - timestamp) > lifetime)
+        return false;
+
+    return value == mac(remote_endpoint, initial_sequence_number, timestamp);
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_COOKIE_HPP
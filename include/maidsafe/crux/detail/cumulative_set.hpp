@@ -11,8 +11,10 @@
 #ifndef MAIDSAFE_CRUX_DETAIL_CUMULATIVE_SET_HPP
 #define MAIDSAFE_CRUX_DETAIL_CUMULATIVE_SET_HPP
 
-#include <set>
-#include <utility>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <type_traits>
 #include <boost/optional.hpp>
 
@@ -23,38 +25,70 @@ namespace crux
 namespace detail
 {
 
+// History of received sequence numbers.
+//
+// The history is anchored at the cumulative point, i.e. the last sequence
+// number before the first gap. Sequence numbers received beyond it are
+// kept in a ring of bits where bit d stands for anchor + d, so inserting is
+// a bit operation and the anchor advances by whole runs of set bits.
+//
+// Sequence numbers more than WindowSize - 1 ahead of the anchor cannot be
+// recorded and are rejected by insert.
+
 template <typename SequenceType,
-          typename FieldType>
+          typename FieldType,
+          std::size_t WindowSize = 1024>
 class cumulative_set
 {
     static_assert(std::is_integral<FieldType>::value && std::is_unsigned<FieldType>::value,
                   "Field type must be an unsigned integral");
 
-    using container_type = std::set<SequenceType>;
+    using word_type = std::uint64_t;
+
+    static const std::size_t word_size = std::numeric_limits<word_type>::digits;
+    static const std::size_t window_size = WindowSize;
+
+    static_assert(window_size % word_size == 0 && (window_size & (window_size - 1)) == 0,
+                  "Window size must be a power of two multiple of 64");
+    static_assert(window_size > std::numeric_limits<FieldType>::digits + 1,
+                  "Window size must cover the selective acknowledgement field");
 
 public:
-    using value_type = typename container_type::value_type;
+    using value_type = SequenceType;
     using field_type = FieldType;
     using composite_type = value_type;
 
+    cumulative_set();
+
     bool empty() const;
 
     boost::optional<composite_type> front();
 
-    void insert(const value_type&);
+    // Returns false if the sequence number is too far ahead of the anchor.
+    bool insert(const value_type&);
+
+    // Selective acknowledgement of the sequence numbers after the first
+    // gap: bit i is set if front() + 2 + i has been received.
+    field_type field() const;
 
 private:
-    void prune();
+    bool test(std::size_t distance) const;
+    void advance();
+
+    static std::size_t count_trailing_ones(word_type);
 
 private:
-    container_type container;
+    boost::optional<value_type> anchor;
+    // Ring position of the anchor
+    std::size_t offset;
+    std::array<word_type, window_size / word_size> bits;
 };
 
 } // namespace detail
 } // namespace crux
 } // namespace maidsafe
 
-#include <algorithm>
+#include <cassert>
 
 namespace maidsafe
 {
@@ -63,52 +97,121 @@ namespace crux
 namespace detail
 {
 
-template <typename SequenceType, typename FieldType>
-bool cumulative_set<SequenceType, FieldType>::empty() const
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+cumulative_set<SequenceType, FieldType, WindowSize>::cumulative_set()
+    : offset(0)
 {
-    return container.empty();
+    bits.fill(0);
 }
 
-template <typename SequenceType, typename FieldType>
-boost::optional<typename cumulative_set<SequenceType, FieldType>::composite_type>
-cumulative_set<SequenceType, FieldType>::front()
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+bool cumulative_set<SequenceType, FieldType, WindowSize>::empty() const
 {
-    if (container.empty())
-        return boost::none;
+    return !anchor;
+}
 
-    auto cumulative = container.begin();
-    return *cumulative;
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+boost::optional<typename cumulative_set<SequenceType, FieldType, WindowSize>::composite_type>
+cumulative_set<SequenceType, FieldType, WindowSize>::front()
+{
+    return anchor;
 }
 
-template <typename SequenceType, typename FieldType>
-void cumulative_set<SequenceType, FieldType>::insert(const value_type& item)
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+bool cumulative_set<SequenceType, FieldType, WindowSize>::insert(const value_type& item)
 {
-    container.insert(item);
-    prune();
-    assert(!container.empty());
+    if (!anchor)
+    {
+        anchor = item;
+        return true;
+    }
+
+    const auto distance = anchor->distance(item);
+    if (distance <= 0)
+    {
+        // Already covered by the cumulative point
+        return true;
+    }
+    if (static_cast<std::size_t>(distance) >= window_size)
+        return false;
+
+    const auto position = (offset + distance) % window_size;
+    bits[position / word_size] |= word_type(1) << (position % word_size);
+
+    if (distance == 1)
+    {
+        advance();
+    }
+    return true;
 }
 
-template <typename SequenceType, typename FieldType>
-void cumulative_set<SequenceType, FieldType>::prune()
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+typename cumulative_set<SequenceType, FieldType, WindowSize>::field_type
+cumulative_set<SequenceType, FieldType, WindowSize>::field() const
 {
-    // Skip contiguous sequence numbers to find most recent cumulative entry.
-
-    // This algorithm works almost like std::adjacent_find but we always want
-    // the last tie instead of the first.
-    auto current = container.begin();
-    if (current != container.end()) {
-        auto next = current;
-        ++next;
-        for (; next != container.end(); ++next, ++current)
+    field_type result = 0;
+    for (std::size_t i = 0; i < std::size_t(std::numeric_limits<field_type>::digits); ++i)
+    {
+        if (test(i + 2))
         {
-            if (next == container.end())
-                break;
-            if (current->distance(*next) > 1)
-                return;
+            result |= field_type(field_type(1) << i);
         }
-        // Prune all entries before the cumulative value
-        container.erase(container.begin(), current);
     }
+    return result;
+}
+
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+bool cumulative_set<SequenceType, FieldType, WindowSize>::test(std::size_t distance) const
+{
+    const auto position = (offset + distance) % window_size;
+    return (bits[position / word_size] >> (position % word_size)) & 1;
+}
+
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+void cumulative_set<SequenceType, FieldType, WindowSize>::advance()
+{
+    // Consume the run of set bits that follows the anchor, one word at a
+    // time, clearing the bits as they become part of the cumulative point.
+    std::size_t count = 0;
+    auto position = (offset + 1) % window_size;
+    for (;;)
+    {
+        auto& word = bits[position / word_size];
+        const auto shift = position % word_size;
+        const auto run = count_trailing_ones(word >> shift);
+        const auto mask = (run == word_size) ? ~word_type(0) : ((word_type(1) << run) - 1);
+        word &= ~(mask << shift);
+        count += run;
+        position = (position + run) % window_size;
+        if (shift + run < word_size)
+            break;
+    }
+
+    offset = (offset + count) % window_size;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        ++*anchor;
+    }
+}
+
+template <typename SequenceType, typename FieldType, std::size_t WindowSize>
+std::size_t
+cumulative_set<SequenceType, FieldType, WindowSize>::count_trailing_ones(word_type word)
+{
+    word = ~word;
+    if (word == 0)
+        return word_size;
+#if defined(__GNUC__)
+    return static_cast<std::size_t>(__builtin_ctzll(word));
+#else
+    std::size_t result = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        ++result;
+    }
+    return result;
+#endif
 }
 
 } // namespace detail
@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_ECN_HPP
+#define MAIDSAFE_CRUX_DETAIL_ECN_HPP
+
+// Explicit congestion notification (RFC 3168). Datagrams are sent as ECN
+// capable, and routers with a filling queue mark them congestion experienced
+// instead of dropping them. The receiver learns about the mark from the TOS
+// byte (IP_RECVTOS) or traffic class (IPV6_RECVTCLASS) of the datagram, which
+// is only received by the transports that receive with recvmsg.
+
+#include <cstdint>
+
+#if defined(__linux__)
+# include <netinet/in.h>
+# include <sys/socket.h>
+# if defined(IP_RECVTOS) && defined(IPV6_RECVTCLASS) && defined(IPV6_TCLASS)
+#  define MAIDSAFE_CRUX_HAS_ECN 1
+# endif
+#endif
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+struct congestion_statistics
+{
+    congestion_statistics()
+        : marks_received(0)
+        , marks_echoed(0)
+    {}
+
+    // Frames from the remote endpoint that arrived marked congestion
+    // experienced
+    std::uint64_t marks_received;
+
+    // Frames to the remote endpoint that arrived marked, as echoed back in
+    // its acknowledgements
+    std::uint64_t marks_echoed;
+};
+
+namespace ecn
+{
+
+// The two lowest bits of the TOS byte or traffic class
+const std::uint8_t mask = 0x03;
+const std::uint8_t not_capable = 0x00;
+const std::uint8_t capable_1 = 0x01;
+const std::uint8_t capable_0 = 0x02;
+const std::uint8_t congestion_experienced = 0x03;
+
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+
+using native_handle_type = int;
+
+// Mark outbound datagrams ECT(0) and receive the codepoint of inbound ones.
+// Options of the other address family fail and are ignored. Returns false if
+// the codepoint is not received.
+bool enable(native_handle_type);
+
+// Look for the codepoint among the control messages of a received datagram,
+// and leave it alone if there is none.
+void find(const msghdr&, std::uint8_t& codepoint);
+
+// Room for the codepoint among the control messages. A dual-stack socket may
+// be handed both the TOS byte and the traffic class of an IPv4 datagram.
+const std::size_t space = 2 * CMSG_SPACE(sizeof(int));
+
+#endif // defined(MAIDSAFE_CRUX_HAS_ECN)
+
+} // namespace ecn
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+
+#include <cstring>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace ecn
+{
+
+inline bool enable(native_handle_type handle)
+{
+    int capable = capable_0;
+    ::setsockopt(handle, IPPROTO_IP, IP_TOS, &capable, sizeof(capable));
+    ::setsockopt(handle, IPPROTO_IPV6, IPV6_TCLASS, &capable, sizeof(capable));
+
+    int enable = 1;
+    const bool tos
+        = ::setsockopt(handle, IPPROTO_IP, IP_RECVTOS, &enable, sizeof(enable)) == 0;
+    const bool traffic_class
+        = ::setsockopt(handle, IPPROTO_IPV6, IPV6_RECVTCLASS, &enable, sizeof(enable)) == 0;
+    return tos || traffic_class;
+}
+
+inline void find(const msghdr& message, std::uint8_t& codepoint)
+{
+    auto& header_message = const_cast<msghdr&>(message);
+    for (auto header = CMSG_FIRSTHDR(&header_message);
+         header;
+         header = CMSG_NXTHDR(&header_message, header))
+    {
+        if (header->cmsg_level == IPPROTO_IP && header->cmsg_type == IP_TOS)
+        {
+            // A single byte
+            std::uint8_t tos;
+            std::memcpy(&tos, CMSG_DATA(header), sizeof(tos));
+            codepoint = tos & mask;
+        }
+        else if (header->cmsg_level == IPPROTO_IPV6 && header->cmsg_type == IPV6_TCLASS)
+        {
+            int traffic_class;
+            std::memcpy(&traffic_class, CMSG_DATA(header), sizeof(traffic_class));
+            codepoint = static_cast<std::uint8_t>(traffic_class) & mask;
+        }
+    }
+}
+
+} // namespace ecn
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // defined(MAIDSAFE_CRUX_HAS_ECN)
+
+#endif // MAIDSAFE_CRUX_DETAIL_ECN_HPP
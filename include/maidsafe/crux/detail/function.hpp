@@ -0,0 +1,326 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_FUNCTION_HPP
+#define MAIDSAFE_CRUX_DETAIL_FUNCTION_HPP
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+// Move-only type-erased callable.
+//
+// Unlike std::function the target only has to be movable, so handlers that
+// own a unique_ptr or a coroutine context can be stored. Small targets are
+// kept inside the function object itself; larger ones are placed in a
+// handler_memory arena if one is given, or on the heap otherwise.
+
+template <typename Signature>
+class function;
+
+template <typename Result, typename... Arguments>
+class function<Result (Arguments...)>
+{
+    struct concept
+    {
+        virtual Result invoke(Arguments&&...) = 0;
+        // Move the target into storage and destroy this one. Only called
+        // for targets kept in the local buffer.
+        virtual concept* relocate(void* storage) = 0;
+        virtual void destroy() = 0;
+
+    protected:
+        ~concept() {}
+    };
+
+    template <typename Function>
+    struct local_model;
+
+    template <typename Function>
+    struct remote_model;
+
+    static const std::size_t local_size = 6 * sizeof(void*);
+
+    using storage_type
+        = typename std::aligned_storage<local_size, alignof(std::max_align_t)>::type;
+
+    template <typename Function>
+    using is_local = std::integral_constant<
+        bool,
+        sizeof(local_model<Function>) <= local_size
+        && alignof(local_model<Function>) <= alignof(storage_type)
+        && std::is_nothrow_move_constructible<Function>::value>;
+
+public:
+    function() noexcept;
+    function(std::nullptr_t) noexcept;
+
+    template <typename Function,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<Function>::type, function>::value>::type>
+    function(Function&&);
+
+    template <typename Function>
+    function(std::allocator_arg_t, const handler_allocator<char>&, Function&&);
+
+    function(const function&) = delete;
+    function(function&&) noexcept;
+    ~function();
+
+    function& operator=(const function&) = delete;
+    function& operator=(function&&) noexcept;
+    function& operator=(std::nullptr_t) noexcept;
+
+    explicit operator bool() const noexcept;
+
+    Result operator()(Arguments...) const;
+
+private:
+    bool has_local_target() const;
+    void reset();
+
+    template <typename Function>
+    void create(const std::shared_ptr<handler_memory>&, Function&&, std::true_type);
+    template <typename Function>
+    void create(const std::shared_ptr<handler_memory>&, Function&&, std::false_type);
+
+private:
+    storage_type storage;
+    concept* target;
+};
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <cassert>
+#include <new>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+template <typename Result, typename... Arguments>
+template <typename Function>
+struct function<Result (Arguments...)>::local_model : concept
+{
+    template <typename F>
+    explicit local_model(F&& f)
+        : f(std::forward<F>(f))
+    {}
+
+    Result invoke(Arguments&&... arguments) override
+    {
+        return f(std::forward<Arguments>(arguments)...);
+    }
+
+    concept* relocate(void* storage) override
+    {
+        auto result = new (storage) local_model(std::move(f));
+        this->~local_model();
+        return result;
+    }
+
+    void destroy() override
+    {
+        this->~local_model();
+    }
+
+    Function f;
+};
+
+template <typename Result, typename... Arguments>
+template <typename Function>
+struct function<Result (Arguments...)>::remote_model : concept
+{
+    template <typename F>
+    remote_model(std::shared_ptr<handler_memory> memory, F&& f)
+        : memory(std::move(memory))
+        , f(std::forward<F>(f))
+    {}
+
+    Result invoke(Arguments&&... arguments) override
+    {
+        return f(std::forward<Arguments>(arguments)...);
+    }
+
+    concept* relocate(void*) override
+    {
+        assert(false);
+        return this;
+    }
+
+    void destroy() override
+    {
+        auto arena = std::move(memory);
+        this->~remote_model();
+        if (arena)
+            arena->deallocate(this, sizeof(remote_model));
+        else
+            ::operator delete(this);
+    }
+
+    std::shared_ptr<handler_memory> memory;
+    Function f;
+};
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>::function() noexcept
+    : target(nullptr)
+{
+}
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>::function(std::nullptr_t) noexcept
+    : target(nullptr)
+{
+}
+
+template <typename Result, typename... Arguments>
+template <typename Function, typename>
+function<Result (Arguments...)>::function(Function&& f)
+    : target(nullptr)
+{
+    using function_type = typename std::decay<Function>::type;
+    create(nullptr, std::forward<Function>(f), is_local<function_type>());
+}
+
+template <typename Result, typename... Arguments>
+template <typename Function>
+function<Result (Arguments...)>::function(std::allocator_arg_t,
+                                          const handler_allocator<char>& allocator,
+                                          Function&& f)
+    : target(nullptr)
+{
+    using function_type = typename std::decay<Function>::type;
+    create(allocator.memory(), std::forward<Function>(f), is_local<function_type>());
+}
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>::function(function&& other) noexcept
+    : target(nullptr)
+{
+    *this = std::move(other);
+}
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>::~function()
+{
+    reset();
+}
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>&
+function<Result (Arguments...)>::operator=(function&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    reset();
+    if (other.has_local_target())
+    {
+        target = other.target->relocate(&storage);
+    }
+    else
+    {
+        target = other.target;
+    }
+    other.target = nullptr;
+    return *this;
+}
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>&
+function<Result (Arguments...)>::operator=(std::nullptr_t) noexcept
+{
+    reset();
+    return *this;
+}
+
+template <typename Result, typename... Arguments>
+function<Result (Arguments...)>::operator bool() const noexcept
+{
+    return target != nullptr;
+}
+
+template <typename Result, typename... Arguments>
+Result function<Result (Arguments...)>::operator()(Arguments... arguments) const
+{
+    assert(target);
+    return target->invoke(std::forward<Arguments>(arguments)...);
+}
+
+template <typename Result, typename... Arguments>
+bool function<Result (Arguments...)>::has_local_target() const
+{
+    return static_cast<const void*>(target) == static_cast<const void*>(&storage);
+}
+
+template <typename Result, typename... Arguments>
+void function<Result (Arguments...)>::reset()
+{
+    if (target)
+        target->destroy();
+    target = nullptr;
+}
+
+template <typename Result, typename... Arguments>
+template <typename Function>
+void function<Result (Arguments...)>::create(const std::shared_ptr<handler_memory>&,
+                                             Function&& f,
+                                             std::true_type)
+{
+    using model_type = local_model<typename std::decay<Function>::type>;
+
+    target = new (&storage) model_type(std::forward<Function>(f));
+}
+
+template <typename Result, typename... Arguments>
+template <typename Function>
+void function<Result (Arguments...)>::create(const std::shared_ptr<handler_memory>& memory,
+                                             Function&& f,
+                                             std::false_type)
+{
+    using model_type = remote_model<typename std::decay<Function>::type>;
+
+    void* block = memory
+        ? memory->allocate(sizeof(model_type))
+        : ::operator new(sizeof(model_type));
+    try
+    {
+        target = new (block) model_type(memory, std::forward<Function>(f));
+    }
+    catch (...)
+    {
+        if (memory)
+            memory->deallocate(block, sizeof(model_type));
+        else
+            ::operator delete(block);
+        throw;
+    }
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_FUNCTION_HPP
@@ -0,0 +1,299 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_HANDLER_ALLOCATOR_HPP
+#define MAIDSAFE_CRUX_DETAIL_HANDLER_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+// Recycling arena for the internal operation objects of a socket or a
+// multiplexer.
+//
+// Blocks are grouped in power-of-two size classes and released blocks are
+// kept for reuse, so once a connection has reached its steady state the
+// operations of one message use the memory freed by the previous one.
+//
+// Blocks are allocated on the thread that runs the io_service, but may be
+// released on any thread, because the application may hand received
+// payloads to other threads. Released blocks are returned to a lock-free
+// list, which the allocating thread takes over when it runs out of blocks.
+
+class handler_memory
+{
+public:
+    handler_memory();
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+    ~handler_memory();
+
+    void* allocate(std::size_t size);
+    void deallocate(void* pointer, std::size_t size);
+
+private:
+    static const std::size_t smallest_size = 32;
+    static const std::size_t class_count = 8; // Up to 4 KiB
+    static const std::size_t cache_limit = 16;
+
+    static std::size_t size_class(std::size_t size);
+
+    // Sort the returned blocks into the free lists
+    void reclaim();
+
+    struct block
+    {
+        block* next;
+        std::size_t size_class;
+    };
+
+    block* free_list[class_count];
+    std::size_t cached[class_count];
+    std::atomic<block*> returned;
+};
+
+// Standard allocator for containers and shared pointers owned by a socket.
+// The allocator keeps the arena alive, so it may outlive its owner.
+
+template <typename T>
+class handler_allocator
+{
+    template <typename> friend class handler_allocator;
+
+public:
+    using value_type = T;
+
+    explicit handler_allocator(std::shared_ptr<handler_memory>);
+
+    template <typename U>
+    handler_allocator(const handler_allocator<U>&);
+
+    T* allocate(std::size_t count);
+    void deallocate(T* pointer, std::size_t count);
+
+    const std::shared_ptr<handler_memory>& memory() const { return arena; }
+
+    template <typename U>
+    bool operator==(const handler_allocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const handler_allocator<U>& other) const { return arena != other.arena; }
+
+private:
+    std::shared_ptr<handler_memory> arena;
+};
+
+// Wraps an internal completion handler so that asio allocates the memory
+// of the operation from the arena. Invocation and continuation hooks are
+// forwarded to the wrapped handler.
+
+template <typename Handler>
+class allocation_handler
+{
+public:
+    allocation_handler(std::shared_ptr<handler_memory> memory, Handler handler)
+        : memory(std::move(memory))
+        , handler(std::move(handler))
+    {}
+
+    template <typename... Arguments>
+    void operator()(Arguments&&... arguments)
+    {
+        handler(std::forward<Arguments>(arguments)...);
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, allocation_handler* self)
+    {
+        return self->memory->allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, allocation_handler* self)
+    {
+        self->memory->deallocate(pointer, size);
+    }
+
+    friend bool asio_handler_is_continuation(allocation_handler* self)
+    {
+        return boost_asio_handler_cont_helpers::is_continuation(self->handler);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(Function& function, allocation_handler* self)
+    {
+        boost_asio_handler_invoke_helpers::invoke(function, self->handler);
+    }
+
+    template <typename Function>
+    friend void asio_handler_invoke(const Function& function, allocation_handler* self)
+    {
+        boost_asio_handler_invoke_helpers::invoke(function, self->handler);
+    }
+
+private:
+    std::shared_ptr<handler_memory> memory;
+    Handler handler;
+};
+
+template <typename Handler>
+allocation_handler<typename std::decay<Handler>::type>
+make_allocation_handler(std::shared_ptr<handler_memory> memory, Handler&& handler)
+{
+    return allocation_handler<typename std::decay<Handler>::type>
+        (std::move(memory), std::forward<Handler>(handler));
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <new>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+inline handler_memory::handler_memory()
+    : returned(nullptr)
+{
+    for (std::size_t i = 0; i < class_count; ++i)
+    {
+        free_list[i] = nullptr;
+        cached[i] = 0;
+    }
+}
+
+inline handler_memory::~handler_memory()
+{
+    reclaim();
+    for (std::size_t i = 0; i < class_count; ++i)
+    {
+        while (free_list[i])
+        {
+            auto current = free_list[i];
+            free_list[i] = current->next;
+            ::operator delete(current);
+        }
+    }
+}
+
+inline std::size_t handler_memory::size_class(std::size_t size)
+{
+    std::size_t result = 0;
+    for (std::size_t limit = smallest_size; limit < size; limit *= 2)
+    {
+        ++result;
+    }
+    return result;
+}
+
+inline void* handler_memory::allocate(std::size_t size)
+{
+    const auto index = size_class(size);
+    if (index >= class_count)
+        return ::operator new(size);
+
+    if (!free_list[index])
+    {
+        reclaim();
+    }
+    if (free_list[index])
+    {
+        auto result = free_list[index];
+        free_list[index] = result->next;
+        --cached[index];
+        return result;
+    }
+    return ::operator new(smallest_size << index);
+}
+
+inline void handler_memory::deallocate(void* pointer, std::size_t size)
+{
+    const auto index = size_class(size);
+    if (index >= class_count)
+    {
+        ::operator delete(pointer);
+        return;
+    }
+
+    auto released = static_cast<block*>(pointer);
+    released->size_class = index;
+    released->next = returned.load(std::memory_order_relaxed);
+    while (!returned.compare_exchange_weak(released->next,
+                                           released,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+    {
+    }
+}
+
+inline void handler_memory::reclaim()
+{
+    auto current = returned.exchange(nullptr, std::memory_order_acquire);
+    while (current)
+    {
+        auto next = current->next;
+        const auto index = current->size_class;
+        if (cached[index] >= cache_limit)
+        {
+            ::operator delete(current);
+        }
+        else
+        {
+            current->next = free_list[index];
+            free_list[index] = current;
+            ++cached[index];
+        }
+        current = next;
+    }
+}
+
+template <typename T>
+handler_allocator<T>::handler_allocator(std::shared_ptr<handler_memory> memory)
+    : arena(std::move(memory))
+{
+}
+
+template <typename T>
+template <typename U>
+handler_allocator<T>::handler_allocator(const handler_allocator<U>& other)
+    : arena(other.arena)
+{
+}
+
+template <typename T>
+T* handler_allocator<T>::allocate(std::size_t count)
+{
+    return static_cast<T*>(arena->allocate(count * sizeof(T)));
+}
+
+template <typename T>
+void handler_allocator<T>::deallocate(T* pointer, std::size_t count)
+{
+    arena->deallocate(pointer, count * sizeof(T));
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_HANDLER_ALLOCATOR_HPP
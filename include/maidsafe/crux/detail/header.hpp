@@ -11,6 +11,9 @@
 #ifndef MAIDSAFE_CRUX_DETAIL_HEADER_HPP
 #define MAIDSAFE_CRUX_DETAIL_HEADER_HPP
 
+#include <algorithm>
+#include <cassert>
+#include <boost/optional.hpp>
 #include <maidsafe/crux/detail/decoder.hpp>
 #include <maidsafe/crux/detail/encoder.hpp>
 #include <maidsafe/crux/detail/header_constants.hpp>
@@ -27,31 +30,137 @@ namespace header
 
 using sequence_type = sequence_number<std::uint32_t>;
 
+// The receive window is only advertised together with an acknowledgement
+inline std::uint16_t ack_type(const boost::optional<sequence_type>& ack,
+                              const boost::optional<std::uint16_t>& window)
+{
+    if (!ack)
+        return header::constant::ack_type_none;
+    return window ? header::constant::ack_type_window : header::constant::ack_type_cumulative;
+}
+
+inline bool is_compact(std::uint16_t type)
+{
+    return (type & header::constant::mask_compact) != header::constant::mask_compact;
+}
+
+inline std::uint16_t type(const std::uint8_t *data)
+{
+    detail::decoder decoder(data, data + sizeof(std::uint16_t));
+    return decoder.get<std::uint16_t>();
+}
+
+// Size of the header that starts the frame, as told by its type word, or
+// zero for an unknown compact frame.
+inline std::size_t size(const std::uint8_t *data)
+{
+    const auto type = header::type(data);
+    if (!is_compact(type))
+        return header::constant::size;
+
+    const bool window = (type & header::constant::mask_ack) == header::constant::ack_type_window;
+    switch (type & header::constant::mask_type)
+    {
+    case header::constant::type_compact_data:
+        if (type & header::constant::mask_ack)
+            return header::constant::compact_size
+                + (window ? 2 : 1) * sizeof(std::uint16_t);
+        return header::constant::compact_size;
+
+    case header::constant::type_compact_ack:
+        return header::constant::compact_size + (window ? sizeof(std::uint16_t) : 0);
+
+    default:
+        return 0;
+    }
+}
+
+// The connection id of any frame, which is found at the same place in all
+// frames of the same format.
+inline std::uint32_t connection_id(const std::uint8_t *data)
+{
+    const std::size_t offset = is_compact(header::type(data))
+        ? header::constant::compact_size - sizeof(std::uint32_t)
+        : header::constant::size - sizeof(std::uint32_t);
+    detail::decoder decoder(data + offset, data + offset + sizeof(std::uint32_t));
+    return decoder.get<std::uint32_t>();
+}
+
+// Compact frames carry the lower half of their sequence numbers
+inline std::uint16_t truncate(sequence_type value)
+{
+    return static_cast<std::uint16_t>(value.value());
+}
+
+// The sequence number closest to the one that the receiver expects
+inline sequence_type expand(std::uint16_t truncated, sequence_type expected)
+{
+    const auto offset = static_cast<std::int16_t>(truncated - truncate(expected));
+    return sequence_type(expected.value() + static_cast<std::uint32_t>(std::int32_t(offset)));
+}
+
+// An acknowledgement is for one of the frames sent last, so the ack sequence
+// number is the closest at or before the last one sent.
+// FIXME: Ambiguous once 65536 frames are unacknowledged
+inline sequence_type expand_ack(std::uint16_t truncated, sequence_type last_sent)
+{
+    const std::uint16_t behind = truncate(last_sent) - truncated;
+    return sequence_type(last_sent.value() - behind);
+}
+
+// The congestion echo goes along with the receive window
+inline std::uint16_t congestion_echo_bits(const boost::optional<std::uint16_t>& window,
+                                          std::uint16_t congestion_echo)
+{
+    if (!window)
+        return 0;
+    return (congestion_echo << header::constant::shift_congestion_echo)
+        & header::constant::mask_congestion_echo;
+}
+
+inline std::uint16_t congestion_echo(std::uint16_t type)
+{
+    return (type & header::constant::mask_congestion_echo)
+        >> header::constant::shift_congestion_echo;
+}
+
 struct handshake {
     std::size_t                    retransmission_count;
     std::uint16_t                  version;
+    std::uint16_t                  token;
     sequence_type                  initial_sequence_number;
     boost::optional<sequence_type> ack;
+    // Of the sender
+    std::uint32_t                  connection_id;
 
     handshake( std::size_t                    retransmission_count
              , sequence_type                  initial_sequence_number
-             , boost::optional<sequence_type> ack)
+             , boost::optional<sequence_type> ack
+             , std::uint16_t                  token = header::constant::handshake_token_none
+             , std::uint32_t                  connection_id = header::constant::connection_id_none)
         : retransmission_count(retransmission_count)
         , version(header::constant::version)
+        , token(token)
         , initial_sequence_number(initial_sequence_number)
         , ack(ack)
+        , connection_id(connection_id)
     {}
 
     handshake(std::uint16_t type, detail::decoder& decoder)
         : retransmission_count(type & 3)
-        , version(decoder.get<std::uint16_t>())
-        , initial_sequence_number(decoder.get<std::uint32_t>())
     {
         assert((type & header::constant::mask_type) == header::constant::type_handshake);
 
+        auto field = decoder.get<std::uint16_t>();
+        version = field >> 8;
+        token = field & 0xFF;
+        initial_sequence_number = sequence_type(decoder.get<std::uint32_t>());
+
+        auto ack_field = decoder.get<std::uint32_t>();
         if (type & header::constant::mask_ack) {
-            ack = sequence_type(decoder.get<std::uint32_t>());
+            ack = sequence_type(ack_field);
         }
+        connection_id = decoder.get<std::uint32_t>();
     }
 
     void encode(detail::encoder& encoder) const {
@@ -59,86 +168,381 @@ struct handshake {
             header::constant::type_handshake
             | static_cast<std::uint16_t>(std::min<std::size_t>(3, retransmission_count))
             | (ack ? header::constant::ack_type_cumulative : header::constant::ack_type_none));
-        encoder.put<std::uint16_t>(version);
+        encoder.put<std::uint16_t>(static_cast<std::uint16_t>((version << 8) | token));
         encoder.put<std::uint32_t>(initial_sequence_number.value());
         encoder.put<std::uint32_t>(ack ? ack->value() : 0);
+        encoder.put<std::uint32_t>(connection_id);
     }
 };
 
 struct keepalive {
     std::size_t                    retransmission_count;
-    std::uint16_t                  dummy;
+    boost::optional<std::uint16_t> window;
     sequence_type                  sequence_number;
     boost::optional<sequence_type> ack;
+    // Of the receiver
+    std::uint32_t                  connection_id;
+    std::uint16_t                  probe;
+    // Only with the window
+    std::uint16_t                  congestion_echo;
 
     keepalive( std::size_t                    retransmission_count
              , sequence_type                  sequence_number
-             , boost::optional<sequence_type> ack)
+             , boost::optional<sequence_type> ack
+             , boost::optional<std::uint16_t> window = boost::none
+             , std::uint32_t                  connection_id = header::constant::connection_id_none
+             , std::uint16_t                  probe = header::constant::probe_none
+             , std::uint16_t                  congestion_echo = 0)
         : retransmission_count(retransmission_count)
-        , dummy(0)
+        , window(window)
         , sequence_number(sequence_number)
         , ack(ack)
+        , connection_id(connection_id)
+        , probe(probe)
+        , congestion_echo(congestion_echo)
     {}
 
     keepalive(std::uint16_t type, detail::decoder& decoder)
         : retransmission_count(3 & type)
-        , dummy(decoder.get<std::uint16_t>())
-        , sequence_number(decoder.get<std::uint32_t>())
+        , probe(type & header::constant::mask_probe)
+        , congestion_echo(header::congestion_echo(type))
     {
         assert((type & header::constant::mask_type) == header::constant::type_keepalive);
 
+        auto field = decoder.get<std::uint16_t>();
+        sequence_number = sequence_type(decoder.get<std::uint32_t>());
+
+        auto ack_field = decoder.get<std::uint32_t>();
         if (type & header::constant::mask_ack) {
-            ack = sequence_type(decoder.get<std::uint32_t>());
+            ack = sequence_type(ack_field);
+        }
+        if ((type & header::constant::mask_ack) == header::constant::ack_type_window) {
+            window = field;
         }
+        connection_id = decoder.get<std::uint32_t>();
     }
 
     void encode(detail::encoder& encoder) const {
         encoder.put<std::uint16_t>(
             header::constant::type_keepalive
             | static_cast<std::uint16_t>(std::min<std::size_t>(3, retransmission_count))
-            | (ack ? header::constant::ack_type_cumulative : header::constant::ack_type_none));
-        encoder.put<std::uint16_t>(0);
+            | ack_type(ack, window)
+            | probe
+            | congestion_echo_bits(window, congestion_echo));
+        encoder.put<std::uint16_t>(window ? *window : 0);
         encoder.put<std::uint32_t>(sequence_number.value());
         encoder.put<std::uint32_t>(ack ? ack->value() : 0);
+        encoder.put<std::uint32_t>(connection_id);
     }
 };
 
 struct data {
     std::uint16_t                  retransmission_count;
-    std::uint16_t                  dummy;
+    boost::optional<std::uint16_t> window;
     sequence_type                  sequence_number;
     boost::optional<sequence_type> ack;
+    // Of the receiver
+    std::uint32_t                  connection_id;
+    // Only with the window
+    std::uint16_t                  congestion_echo;
 
     data( std::uint16_t                  retransmission_count
         , sequence_type                  sequence_number
-        , boost::optional<sequence_type> ack)
+        , boost::optional<sequence_type> ack
+        , boost::optional<std::uint16_t> window = boost::none
+        , std::uint32_t                  connection_id = header::constant::connection_id_none
+        , std::uint16_t                  congestion_echo = 0)
             : retransmission_count(retransmission_count)
-            , dummy(0)
+            , window(window)
             , sequence_number(sequence_number)
             , ack(ack)
+            , connection_id(connection_id)
+            , congestion_echo(congestion_echo)
     { }
 
     data(std::uint16_t type, detail::decoder& decoder)
         : retransmission_count(type & 3)
-        , dummy(decoder.get<std::uint16_t>())
-        , sequence_number(decoder.get<std::uint32_t>())
+        , congestion_echo(header::congestion_echo(type))
     {
         assert((type & header::constant::mask_type) == header::constant::type_data);
 
+        auto field = decoder.get<std::uint16_t>();
+        sequence_number = sequence_type(decoder.get<std::uint32_t>());
+
+        auto ack_field = decoder.get<std::uint32_t>();
         if (type & header::constant::mask_ack)
         {
-            ack = sequence_type(decoder.get<std::uint32_t>());
+            ack = sequence_type(ack_field);
+        }
+        if ((type & header::constant::mask_ack) == header::constant::ack_type_window)
+        {
+            window = field;
         }
+        connection_id = decoder.get<std::uint32_t>();
     }
 
     void encode(detail::encoder& encoder) const {
         encoder.put<std::uint16_t>(
             header::constant::type_data
             | static_cast<std::uint16_t>(std::min<std::size_t>(3, retransmission_count))
+            | ack_type(ack, window)
+            | congestion_echo_bits(window, congestion_echo));
+        encoder.put<std::uint16_t>(window ? *window : 0);
+        encoder.put<std::uint32_t>(sequence_number.value());
+        encoder.put<std::uint32_t>(ack ? ack->value() : 0);
+        encoder.put<std::uint32_t>(connection_id);
+    }
+};
+
+// Data frame in the compact format, sent to remote endpoints that have
+// handshaked with version_compact or later. The ack-field and the ack
+// sequence number are only present when needed.
+struct compact_data {
+    std::uint16_t                  retransmission_count;
+    boost::optional<std::uint16_t> window;
+    std::uint16_t                  sequence_number;
+    boost::optional<std::uint16_t> ack;
+    // Of the receiver
+    std::uint32_t                  connection_id;
+    // Only with the window
+    std::uint16_t                  congestion_echo;
+
+    compact_data( std::uint16_t                  retransmission_count
+                , sequence_type                  sequence_number
+                , boost::optional<sequence_type> ack
+                , boost::optional<std::uint16_t> window = boost::none
+                , std::uint32_t                  connection_id = header::constant::connection_id_none
+                , std::uint16_t                  congestion_echo = 0)
+        : retransmission_count(retransmission_count)
+        , window(ack ? window : boost::none)
+        , sequence_number(truncate(sequence_number))
+        , connection_id(connection_id)
+        , congestion_echo(congestion_echo)
+    {
+        if (ack) {
+            this->ack = truncate(*ack);
+        }
+    }
+
+    compact_data(std::uint16_t type, detail::decoder& decoder)
+        : retransmission_count(type & 3)
+        , congestion_echo(header::congestion_echo(type))
+    {
+        assert((type & header::constant::mask_type) == header::constant::type_compact_data);
+
+        sequence_number = decoder.get<std::uint16_t>();
+        connection_id = decoder.get<std::uint32_t>();
+        if (type & header::constant::mask_ack) {
+            ack = decoder.get<std::uint16_t>();
+        }
+        if ((type & header::constant::mask_ack) == header::constant::ack_type_window) {
+            window = decoder.get<std::uint16_t>();
+        }
+    }
+
+    void encode(detail::encoder& encoder) const {
+        encoder.put<std::uint16_t>(
+            header::constant::type_compact_data
+            | static_cast<std::uint16_t>(std::min<std::size_t>(3, retransmission_count))
+            | (ack ? (window ? header::constant::ack_type_window
+                             : header::constant::ack_type_cumulative)
+                   : header::constant::ack_type_none)
+            | congestion_echo_bits(window, congestion_echo));
+        encoder.put<std::uint16_t>(sequence_number);
+        encoder.put<std::uint32_t>(connection_id);
+        if (ack) {
+            encoder.put<std::uint16_t>(*ack);
+        }
+        if (window) {
+            encoder.put<std::uint16_t>(*window);
+        }
+    }
+};
+
+// Acknowledgement on its own in the compact format. Unlike a keepalive it
+// takes up no sequence number, so it is neither acknowledged itself nor
+// missed by the remote endpoint when it gets lost.
+struct compact_ack {
+    boost::optional<std::uint16_t> window;
+    boost::optional<std::uint16_t> ack;
+    // Of the receiver
+    std::uint32_t                  connection_id;
+    // Only with the window
+    std::uint16_t                  congestion_echo;
+
+    compact_ack( sequence_type                  ack
+               , boost::optional<std::uint16_t> window = boost::none
+               , std::uint32_t                  connection_id = header::constant::connection_id_none
+               , std::uint16_t                  congestion_echo = 0)
+        : window(window)
+        , ack(truncate(ack))
+        , connection_id(connection_id)
+        , congestion_echo(congestion_echo)
+    {}
+
+    compact_ack(std::uint16_t type, detail::decoder& decoder)
+        : congestion_echo(header::congestion_echo(type))
+    {
+        assert((type & header::constant::mask_type) == header::constant::type_compact_ack);
+
+        const auto ack_field = decoder.get<std::uint16_t>();
+        if (type & header::constant::mask_ack) {
+            ack = ack_field;
+        }
+        connection_id = decoder.get<std::uint32_t>();
+        if ((type & header::constant::mask_ack) == header::constant::ack_type_window) {
+            window = decoder.get<std::uint16_t>();
+        }
+    }
+
+    void encode(detail::encoder& encoder) const {
+        encoder.put<std::uint16_t>(
+            header::constant::type_compact_ack
+            | (window ? header::constant::ack_type_window : header::constant::ack_type_cumulative)
+            | congestion_echo_bits(window, congestion_echo));
+        encoder.put<std::uint16_t>(ack ? *ack : 0);
+        encoder.put<std::uint32_t>(connection_id);
+        if (window) {
+            encoder.put<std::uint16_t>(*window);
+        }
+    }
+};
+
+// Sent once all data has been acknowledged, after which the sender sends
+// nothing else. Acknowledged like data.
+struct shutdown {
+    std::size_t                    retransmission_count;
+    sequence_type                  sequence_number;
+    boost::optional<sequence_type> ack;
+    // Of the receiver
+    std::uint32_t                  connection_id;
+
+    shutdown( std::size_t                    retransmission_count
+            , sequence_type                  sequence_number
+            , boost::optional<sequence_type> ack
+            , std::uint32_t                  connection_id = header::constant::connection_id_none)
+        : retransmission_count(retransmission_count)
+        , sequence_number(sequence_number)
+        , ack(ack)
+        , connection_id(connection_id)
+    {}
+
+    shutdown(std::uint16_t type, detail::decoder& decoder)
+        : retransmission_count(3 & type)
+    {
+        assert((type & header::constant::mask_type) == header::constant::type_shutdown);
+
+        decoder.get<std::uint16_t>();
+        sequence_number = sequence_type(decoder.get<std::uint32_t>());
+
+        auto ack_field = decoder.get<std::uint32_t>();
+        if (type & header::constant::mask_ack) {
+            ack = sequence_type(ack_field);
+        }
+        connection_id = decoder.get<std::uint32_t>();
+    }
+
+    void encode(detail::encoder& encoder) const {
+        encoder.put<std::uint16_t>(
+            header::constant::type_shutdown
+            | static_cast<std::uint16_t>(std::min<std::size_t>(3, retransmission_count))
             | (ack ? header::constant::ack_type_cumulative : header::constant::ack_type_none));
         encoder.put<std::uint16_t>(0);
         encoder.put<std::uint32_t>(sequence_number.value());
         encoder.put<std::uint32_t>(ack ? ack->value() : 0);
+        encoder.put<std::uint32_t>(connection_id);
+    }
+};
+
+// Parity of a group of consecutive data frames, which follows as payload.
+// The ack-field holds the number of frames and the ack sequence number the
+// XOR of their payload sizes. Takes up no sequence number of its own, and is
+// neither acknowledged nor retransmitted.
+struct parity {
+    sequence_type first;
+    std::uint16_t count;
+    std::uint32_t size_xor;
+    // Of the receiver
+    std::uint32_t connection_id;
+
+    parity( sequence_type first
+          , std::uint16_t count
+          , std::uint32_t size_xor
+          , std::uint32_t connection_id = header::constant::connection_id_none)
+        : first(first)
+        , count(count)
+        , size_xor(size_xor)
+        , connection_id(connection_id)
+    {}
+
+    parity(std::uint16_t type, detail::decoder& decoder)
+    {
+        assert((type & header::constant::mask_type) == header::constant::type_parity);
+        static_cast<void>(type);
+
+        count = decoder.get<std::uint16_t>();
+        first = sequence_type(decoder.get<std::uint32_t>());
+        size_xor = decoder.get<std::uint32_t>();
+        connection_id = decoder.get<std::uint32_t>();
+    }
+
+    void encode(detail::encoder& encoder) const {
+        encoder.put<std::uint16_t>(header::constant::type_parity);
+        encoder.put<std::uint16_t>(count);
+        encoder.put<std::uint32_t>(first.value());
+        encoder.put<std::uint32_t>(size_xor);
+        encoder.put<std::uint32_t>(connection_id);
+    }
+};
+
+// Sent by an acceptor in reply to a handshake without a valid cookie. The
+// cookie itself follows as payload.
+struct cookie {
+    sequence_type initial_sequence_number;
+
+    explicit cookie(sequence_type initial_sequence_number)
+        : initial_sequence_number(initial_sequence_number)
+    {}
+
+    cookie(std::uint16_t type, detail::decoder& decoder)
+    {
+        assert((type & header::constant::mask_type) == header::constant::type_cookie);
+        static_cast<void>(type);
+
+        decoder.get<std::uint16_t>();
+        initial_sequence_number = sequence_type(decoder.get<std::uint32_t>());
+    }
+
+    void encode(detail::encoder& encoder) const {
+        encoder.put<std::uint16_t>(header::constant::type_cookie);
+        encoder.put<std::uint16_t>(0);
+        encoder.put<std::uint32_t>(initial_sequence_number.value());
+        encoder.put<std::uint32_t>(0);
+        encoder.put<std::uint32_t>(header::constant::connection_id_none);
+    }
+};
+
+// Sent by an acceptor on an established connection. The resumption ticket
+// itself follows as payload.
+struct ticket {
+    ticket() {}
+
+    ticket(std::uint16_t type, detail::decoder& decoder)
+    {
+        assert((type & header::constant::mask_type) == header::constant::type_ticket);
+        static_cast<void>(type);
+
+        decoder.get<std::uint16_t>();
+        decoder.get<std::uint32_t>();
+        decoder.get<std::uint32_t>();
+    }
+
+    void encode(detail::encoder& encoder) const {
+        encoder.put<std::uint16_t>(header::constant::type_ticket);
+        encoder.put<std::uint16_t>(0);
+        encoder.put<std::uint32_t>(0);
+        encoder.put<std::uint32_t>(0);
+        encoder.put<std::uint32_t>(header::constant::connection_id_none);
     }
 };
 
@@ -25,13 +25,26 @@ namespace header
 namespace constant
 {
 
-const std::size_t version = 0;
+// Sent in handshakes. Version 1 receives compact frames.
+const std::size_t version = 1;
+const std::size_t version_compact = 1;
 
 const std::size_t size =
     sizeof(std::uint16_t) // type
     + sizeof(std::uint16_t) // ack-field
     + sizeof(std::uint32_t) // sequence number
-    + sizeof(std::uint32_t); // ack sequence number
+    + sizeof(std::uint32_t) // ack sequence number
+    + sizeof(std::uint32_t); // connection id
+
+// Compact frames have the same type word, followed by the lower half of the
+// sequence number (or of the ack sequence number of an acknowledgement) and
+// the connection id. Data frames add the lower half of the ack sequence
+// number and the window only when present.
+const std::size_t compact_size =
+    sizeof(std::uint16_t) // type
+    + sizeof(std::uint16_t) // sequence number
+    + sizeof(std::uint32_t); // connection id
+const std::size_t min_size = compact_size;
 
 const std::uint16_t mask_type = 0XF800;
 const std::uint16_t mask_retransmission = 0x0003;
@@ -41,9 +54,53 @@ const std::uint16_t type_data = 0xC000;
 const std::uint16_t type_handshake = 0xC800;
 const std::uint16_t type_shutdown = 0xD000;
 const std::uint16_t type_keepalive = 0xD800;
+const std::uint16_t type_cookie = 0xE000;
+const std::uint16_t type_ticket = 0xE800;
+const std::uint16_t type_parity = 0xF000;
+
+// Full frames have the two upper bits of the type set
+const std::uint16_t mask_compact = 0xC000;
+const std::uint16_t type_compact_data = 0x8000;
+// Acknowledges and advertises the window without taking up a sequence
+// number
+const std::uint16_t type_compact_ack = 0x8800;
+
+// The ack-field of a handshake holds the version in the upper byte and the
+// kind of token that starts the payload in the lower byte.
+const std::uint16_t handshake_token_none = 0x00;
+const std::uint16_t handshake_token_cookie = 0x01;
+const std::uint16_t handshake_token_ticket = 0x02;
+
+// Handshakes carry the connection id of the sender, and other frames the
+// connection id of the receiver as learned from its handshake. The receiver
+// finds the socket by its connection id before its remote endpoint, which
+// may have changed along the way (e.g. NAT rebinding.)
+const std::uint32_t connection_id_none = 0;
 
 const std::uint16_t ack_type_none = 0x0000;
 const std::uint16_t ack_type_cumulative = 0x0004;
+// Cumulative acknowledgement with the receive window in the ack-field
+const std::uint16_t ack_type_window = 0x0008;
+
+// A keepalive may ask for an immediate answer, with which an idle connection
+// finds out whether the remote endpoint is still there. Neither the probe nor
+// its answer takes up a sequence number. The answer echoes the sequence
+// number of the probe instead, so that a probe with a random one finds out
+// whether the remote endpoint receives at a new address.
+const std::uint16_t mask_probe = 0x0030;
+const std::uint16_t probe_none = 0x0000;
+const std::uint16_t probe_request = 0x0010;
+const std::uint16_t probe_reply = 0x0020;
+
+// Data and keepalives that advertise the receive window also echo how many
+// frames from the remote endpoint have arrived marked congestion experienced
+// (ECN), modulo 16.
+const std::uint16_t mask_congestion_echo = 0x03C0;
+const std::uint16_t shift_congestion_echo = 6;
+
+// The receive window is advertised in units of this many bytes
+const std::size_t window_unit = 64;
+const std::uint16_t max_window = 0xFFFF;
 
 } // namespace constant
 
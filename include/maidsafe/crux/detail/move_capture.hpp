@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_MOVE_CAPTURE_HPP
+#define MAIDSAFE_CRUX_DETAIL_MOVE_CAPTURE_HPP
+
+#include <type_traits>
+#include <utility>
+#include <boost/asio/detail/handler_alloc_helpers.hpp>
+#include <boost/asio/detail/handler_cont_helpers.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+// C++11 lambdas cannot capture by move, so a move-only handler is moved
+// into this wrapper instead and handed to the function by reference:
+//
+//   move_capture(std::move(handler),
+//                [] (handler_type& handler, error_code error) { ... });
+//
+// std::bind is not used because it evaluates handlers that happen to be
+// bind expressions themselves. Allocation, invocation and continuation
+// hooks are forwarded to the captured handler.
+
+template <typename Handler, typename Function>
+class move_capture_handler
+{
+public:
+    move_capture_handler(Handler handler, Function function)
+        : handler(std::move(handler))
+        , function(std::move(function))
+    {}
+
+    template <typename... Arguments>
+    auto operator()(Arguments&&... arguments)
+        -> decltype(std::declval<Function&>()(std::declval<Handler&>(),
+                                              std::forward<Arguments>(arguments)...))
+    {
+        return function(handler, std::forward<Arguments>(arguments)...);
+    }
+
+    friend void* asio_handler_allocate(std::size_t size, move_capture_handler* self)
+    {
+        return boost_asio_handler_alloc_helpers::allocate(size, self->handler);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, move_capture_handler* self)
+    {
+        boost_asio_handler_alloc_helpers::deallocate(pointer, size, self->handler);
+    }
+
+    friend bool asio_handler_is_continuation(move_capture_handler* self)
+    {
+        return boost_asio_handler_cont_helpers::is_continuation(self->handler);
+    }
+
+    template <typename F>
+    friend void asio_handler_invoke(F& f, move_capture_handler* self)
+    {
+        boost_asio_handler_invoke_helpers::invoke(f, self->handler);
+    }
+
+    template <typename F>
+    friend void asio_handler_invoke(const F& f, move_capture_handler* self)
+    {
+        boost_asio_handler_invoke_helpers::invoke(f, self->handler);
+    }
+
+private:
+    Handler handler;
+    Function function;
+};
+
+template <typename Handler, typename Function>
+move_capture_handler<typename std::decay<Handler>::type,
+                     typename std::decay<Function>::type>
+move_capture(Handler&& handler, Function&& function)
+{
+    return move_capture_handler<typename std::decay<Handler>::type,
+                                typename std::decay<Function>::type>
+        (std::forward<Handler>(handler), std::forward<Function>(function));
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_MOVE_CAPTURE_HPP
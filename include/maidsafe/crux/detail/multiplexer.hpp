@@ -11,12 +11,15 @@
 #ifndef MAIDSAFE_CRUX_DETAIL_MULTIPLEXER_HPP
 #define MAIDSAFE_CRUX_DETAIL_MULTIPLEXER_HPP
 
+#include <array>
 #include <atomic>
+#include <deque>
 #include <memory>
 #include <functional>
 #include <queue>
 #include <map>
 #include <list>
+#include <random>
 #include <queue>
 #include <tuple>
 
@@ -26,8 +29,20 @@
 #include <boost/asio/ip/udp.hpp>
 
 #include <maidsafe/crux/detail/buffer.hpp>
+#include <maidsafe/crux/detail/constants.hpp>
+#include <maidsafe/crux/detail/cookie.hpp>
+#include <maidsafe/crux/detail/function.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
 #include <maidsafe/crux/detail/header.hpp>
+#include <maidsafe/crux/detail/move_capture.hpp>
 #include <maidsafe/crux/detail/socket_base.hpp>
+#include <maidsafe/crux/detail/receive_timestamp.hpp>
+#include <maidsafe/crux/detail/segmentation.hpp>
+#include <maidsafe/crux/detail/udp_buffers.hpp>
+
+#if defined(MAIDSAFE_CRUX_WITH_IO_URING)
+# include <maidsafe/crux/detail/uring_socket.hpp>
+#endif
 
 namespace maidsafe
 {
@@ -49,12 +64,21 @@ class multiplexer : public std::enable_shared_from_this<multiplexer>
 
 public:
     using protocol_type = boost::asio::ip::udp;
+#if defined(MAIDSAFE_CRUX_WITH_IO_URING)
+    using next_layer_type = detail::uring_socket;
+#else
     using next_layer_type = protocol_type::socket;
+#endif
     using endpoint_type = protocol_type::endpoint;
     using buffer_type = detail::buffer;
+    using payload_type = detail::payload_buffer;
     using sequence_type = socket_base::sequence_type;
     using ack_sequence_type = socket_base::ack_sequence_type;
 
+    // Largest message that fits into a handshake along with a cookie
+    static const std::size_t max_handshake_message_size
+        = constant::max_datagram_size - header_size - cookie_generator::size;
+
     template <typename... Types>
     static std::shared_ptr<multiplexer> create(Types&&...);
 
@@ -62,6 +86,13 @@ public:
 
     void add(socket_base *);
     void remove(socket_base *);
+    // Like remove, but the UDP socket stays open for the socket to use again
+    void release(socket_base *);
+
+    // A connecting socket also receives from the other remote endpoints
+    // that it is racing.
+    void add(socket_base *, const endpoint_type&);
+    void release(socket_base *, const endpoint_type&);
 
     template <typename AcceptorType,
               typename SocketType,
@@ -70,29 +101,69 @@ public:
                       SocketType&,
                       AcceptHandler&& handler);
 
+    // Frames are sent with the connection id that the remote endpoint has
+    // assigned, except for handshakes which are sent with our own.
     template <typename ConstBufferSequence,
               typename WriteHandler>
     void send_data(ConstBufferSequence&& buffers,
                    const endpoint_type& endpoint,
+                   std::uint32_t connection_id,
                    sequence_type sequence,
                    boost::optional<ack_sequence_type> ack,
+                   boost::optional<std::uint16_t> window,
+                   std::uint16_t congestion_echo,
                    std::uint16_t retransmission_count,
+                   bool compact,
                    WriteHandler&& handler);
 
+    // Compact acknowledgement, which takes up no sequence number
+    template <typename WriteHandler>
+    void send_ack(const endpoint_type& remote_endpoint,
+                  std::uint32_t connection_id,
+                  ack_sequence_type ack,
+                  boost::optional<std::uint16_t> window,
+                  std::uint16_t congestion_echo,
+                  WriteHandler&& handler);
+
     template <typename ConnectHandler>
     void send_handshake(const endpoint_type& remote_endpoint,
+                        std::uint32_t connection_id,
                         sequence_type initial,
                         boost::optional<ack_sequence_type> ack,
+                        boost::optional<handshake_token> token,
+                        std::shared_ptr<payload_type> message,
                         std::size_t retransmission_count,
                         ConnectHandler&& handler);
 
     template <typename ConnectHandler>
     void send_keepalive(const endpoint_type& remote_endpoint,
+                        std::uint32_t connection_id,
                         sequence_type sequence,
                         boost::optional<ack_sequence_type> ack,
+                        boost::optional<std::uint16_t> window,
+                        std::uint16_t congestion_echo,
+                        std::uint16_t probe,
                         std::size_t retransmission_count,
                         ConnectHandler&& handler);
 
+    template <typename ShutdownHandler>
+    void send_shutdown(const endpoint_type& remote_endpoint,
+                       std::uint32_t connection_id,
+                       sequence_type sequence,
+                       boost::optional<ack_sequence_type> ack,
+                       std::size_t retransmission_count,
+                       ShutdownHandler&& handler);
+
+    // The parity is kept alive until it has been handed to the kernel
+    template <typename WriteHandler>
+    void send_parity(std::shared_ptr<buffer> parity,
+                     const endpoint_type& endpoint,
+                     std::uint32_t connection_id,
+                     sequence_type first,
+                     std::uint16_t count,
+                     std::uint32_t size_xor,
+                     WriteHandler&& handler);
+
     void start_receive();
     void stop_receive();
 
@@ -101,23 +172,103 @@ public:
 
     void disable_accept_requests_from(acceptor&);
 
+    // Bounds the handshakes that wait for an accept request
+    void listen(std::size_t backlog);
+
+    // The receive window that the socket grants has changed
+    void update_window(socket_base&);
+
+    // Moves an established connection to where its remote endpoint has
+    // moved to, once the socket has validated the new path
+    void rebind(socket_base&, const endpoint_type&);
+
+    udp_statistics statistics() const;
+
 private:
     multiplexer(next_layer_type&& udp_socket);
 
     void do_start_receive();
 
-    void process_peek(boost::system::error_code, endpoint_type);
-
-    void establish_connection(std::size_t, endpoint_type);
-
-    void process_handshake(socket_base&, endpoint_type, std::uint16_t, detail::decoder&);
+    socket_base* direct_receive_candidate();
+
+    void assign_connection_id(socket_base&);
+    void release_connection_id(socket_base&);
+    socket_base* find_recipient(const endpoint_type&, const unsigned char *header_data);
+    void resize_buffers();
+
+    void process_receive(boost::system::error_code,
+                         std::size_t datagram_size,
+                         std::size_t segment_size,
+                         endpoint_type);
+    bool process_received(const boost::system::error_code&,
+                          std::size_t frame_size,
+                          endpoint_type);
+
+    void process_frame(socket_base&,
+                       endpoint_type,
+                       const unsigned char *header_data,
+                       const boost::system::error_code&,
+                       std::size_t payload_size,
+                       std::shared_ptr<payload_type>);
+
+    void establish_connection(endpoint_type, std::size_t payload_size);
+    void enqueue_handshake(const endpoint_type&,
+                           sequence_type initial,
+                           std::uint32_t connection_id,
+                           std::uint16_t version,
+                           std::shared_ptr<payload_type> message);
+    void accept_from_backlog();
+    bool has_valid_cookie(const endpoint_type&, const header::handshake&, std::size_t payload_size);
+    bool redeem_ticket(const endpoint_type&, const header::handshake&, std::size_t payload_size);
+    bool is_handshake_pending(const endpoint_type&) const;
+    bool received_token(const header::handshake&,
+                        std::uint16_t kind,
+                        std::size_t payload_size,
+                        cookie_generator::value_type&) const;
+    std::shared_ptr<payload_type> handshake_message(const header::handshake&,
+                                                    std::size_t payload_size);
+    void send_cookie(const endpoint_type&, sequence_type initial);
+    void send_ticket(const endpoint_type&);
+    static endpoint_type ticket_endpoint(const endpoint_type&);
+
+    void process_handshake(socket_base&,
+                           endpoint_type,
+                           std::uint16_t,
+                           detail::decoder&,
+                           std::shared_ptr<payload_type> message = nullptr);
     void process_keepalive(socket_base&, std::uint16_t, detail::decoder&);
+    void process_shutdown(socket_base&, std::uint16_t, detail::decoder&);
+    void process_cookie(socket_base&,
+                        endpoint_type,
+                        std::uint16_t,
+                        detail::decoder&,
+                        std::size_t,
+                        std::shared_ptr<payload_type>);
+    void process_ticket(socket_base&,
+                        std::uint16_t,
+                        detail::decoder&,
+                        std::size_t,
+                        std::shared_ptr<payload_type>);
+    boost::optional<cookie_generator::value_type>
+    copy_token(socket_base&, std::size_t, const std::shared_ptr<payload_type>&);
+    void process_parity(socket_base&,
+                        std::uint16_t,
+                        detail::decoder&,
+                        std::size_t,
+                        std::shared_ptr<payload_type>);
     void process_data(socket_base&,
                       std::uint16_t,
                       detail::decoder&,
                       const boost::system::error_code&,
                       std::size_t,
-                      std::shared_ptr<buffer_type>);
+                      std::shared_ptr<payload_type>);
+    void process_compact_data(socket_base&,
+                              std::uint16_t,
+                              detail::decoder&,
+                              const boost::system::error_code&,
+                              std::size_t,
+                              std::shared_ptr<payload_type>);
+    void process_compact_ack(socket_base&, std::uint16_t, detail::decoder&);
 
     template <typename AcceptHandler>
     void process_accept(const boost::system::error_code& error,
@@ -129,23 +280,140 @@ private:
 
     endpoint_type local_loopback_endpoint() const;
 
-    void discard_message();
+    std::shared_ptr<header::data_type> make_header();
+    std::shared_ptr<payload_type> make_payload(std::size_t size);
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    using write_handler_type = detail::function<void (const boost::system::error_code&, std::size_t)>;
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void enqueue_segment(const endpoint_type&,
+                         std::shared_ptr<header::data_type>,
+                         std::size_t header_length,
+                         const ConstBufferSequence&,
+                         WriteHandler&&);
+    void flush_segments();
+    void process_readable(const boost::system::error_code&);
+    void process_segments(const boost::system::error_code&,
+                          std::size_t datagram_size,
+                          std::size_t segment_size,
+                          endpoint_type);
+#endif
 
 private:
     next_layer_type udp_socket;
 
+    // Recycles the memory of per-datagram operations
+    std::shared_ptr<handler_memory> memory;
+
     using socket_map = std::map<endpoint_type, socket_base *>;
     socket_map sockets;
 
+    // Sockets by the connection id that we have assigned to them. The lower
+    // half of a connection id is the index of its slot plus one, and the
+    // upper half is drawn at random for every assignment, so that neither a
+    // stale connection id finds the next socket in the same slot, nor can
+    // connection ids be guessed from the outside.
+    struct slot_type
+    {
+        socket_base *socket;
+        std::uint32_t connection_id;
+        // Receive window of the socket, as counted in aggregate_window
+        std::size_t window;
+    };
+    std::vector<slot_type> slots;
+    std::vector<std::size_t> free_slots;
+    std::mt19937 generator;
+
+    // The kernel buffers are sized to hold what the sockets with a slot let
+    // their remote endpoints send, but never below the size they had
+    // initially.
+    std::size_t aggregate_window;
+    std::size_t minimum_buffer_size;
+    std::size_t buffer_size;
+#if !defined(MAIDSAFE_CRUX_WITH_IO_URING)
+    std::uint32_t kernel_drops;
+#endif
+
     std::atomic<std::size_t> receive_calls;
 
+    cookie_generator cookies;
+
+    // Issues resumption tickets to established remote endpoints. The key
+    // only lives as long as the multiplexer.
+    cookie_generator tickets;
+
+    // A ticket is good for one connection. The handshake that redeems it is
+    // remembered until the ticket expires, and any other handshake that
+    // presents it is a replay.
+    struct redeemed_ticket
+    {
+        endpoint_type remote_endpoint;
+        sequence_type initial;
+        std::uint32_t timestamp;
+    };
+    std::map<cookie_generator::value_type, redeemed_ticket> redeemed_tickets;
+
     // FIXME: Move to acceptor class
-    // FIXME: Bounded queue with pending accept requests? (like listen() backlog)
-    using accept_handler_type = std::function<void (const boost::system::error_code&)>;
+    using accept_handler_type = detail::function<void (const boost::system::error_code&)>;
     using accept_input_type = std::tuple<acceptor*, socket_base *, accept_handler_type>;
     std::list<std::unique_ptr<accept_input_type>> acceptor_queue;
 
+    // Handshakes with a valid cookie that arrived while no accept request
+    // was ready for them, oldest first. Only the endpoint, the initial
+    // sequence number and the message that came along are kept, and the
+    // handshake is answered once an accept request takes it.
+    struct backlog_entry
+    {
+        endpoint_type remote_endpoint;
+        sequence_type initial;
+        std::uint32_t connection_id;
+        std::uint16_t version;
+        std::shared_ptr<payload_type> message;
+        std::uint32_t timestamp;
+    };
+    std::deque<backlog_entry> accept_backlog;
+    std::size_t accept_backlog_size;
+
     endpoint_type next_remote_endpoint;
+
+    // Incoming datagrams are received in one go into the header and a
+    // reusable payload buffer. If a single socket has posted a receive, its
+    // buffers are placed in between so that data lands there directly.
+    // The payload of a compact frame starts inside the header already.
+    alignas(std::uint32_t) header::data_type receive_header;
+    buffer_type receive_buffer;
+    // Of the datagram being processed
+    std::chrono::steady_clock::time_point receive_arrival;
+    std::uint8_t receive_ecn;
+    std::vector<boost::asio::mutable_buffer> receive_buffers;
+    socket_base *direct_recipient;
+    bool receive_direct;
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    struct segment_type
+    {
+        endpoint_type                      endpoint;
+        std::shared_ptr<header::data_type> header;
+        std::size_t                        header_length;
+        std::size_t                        first_buffer;
+        std::size_t                        buffer_count;
+        std::size_t                        size;
+        write_handler_type                 handler;
+    };
+
+    // Frames sent during the same handler are handed to the kernel together
+    // so that runs of equal-sized frames can use segmentation offload. The
+    // payload buffers of all frames are kept in one vector, and the vectors
+    // are swapped rather than reallocated when flushing.
+    std::vector<segment_type> pending_segments;
+    std::vector<boost::asio::const_buffer> pending_buffers;
+    std::vector<segment_type> flushing_segments;
+    std::vector<boost::asio::const_buffer> flushing_buffers;
+    std::vector<boost::asio::const_buffer> segment_buffers;
+    bool receive_offload;
+    bool receive_with_recvmsg;
+#endif
 };
 
 } // namespace detail
@@ -156,8 +424,10 @@ private:
 #include <algorithm>
 #include <utility>
 #include <boost/asio/buffer.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
 #include <maidsafe/crux/detail/socket_base.hpp>
 #include <maidsafe/crux/detail/concatenate.hpp>
+#include <maidsafe/crux/detail/ecn.hpp>
 #include <maidsafe/crux/detail/encoder.hpp>
 #include <maidsafe/crux/detail/decoder.hpp>
 
@@ -177,8 +447,55 @@ std::shared_ptr<multiplexer> multiplexer::create(Types&&... args)
 
 inline multiplexer::multiplexer(next_layer_type&& udp_socket)
     : udp_socket(std::move(udp_socket))
+    , memory(std::make_shared<handler_memory>())
+    , aggregate_window(0)
+    , minimum_buffer_size(0)
+    , buffer_size(0)
+#if !defined(MAIDSAFE_CRUX_WITH_IO_URING)
+    , kernel_drops(0)
+#endif
     , receive_calls(0)
+    , tickets(constant::ticket_lifetime)
+    , accept_backlog_size(constant::accept_backlog)
+    , receive_buffer(constant::max_datagram_size - header_size)
+    , receive_ecn(ecn::not_capable)
+    , direct_recipient(nullptr)
+    , receive_direct(false)
 {
+    std::random_device device;
+    generator.seed(device());
+
+    udp_statistics initial;
+    udp_buffers::get_sizes(next_layer(), initial);
+    minimum_buffer_size = std::max(initial.receive_buffer_size, initial.send_buffer_size);
+    buffer_size = minimum_buffer_size;
+
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+    const bool count_drops = udp_buffers::enable_drop_count(next_layer().native_handle());
+#else
+    const bool count_drops = false;
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+    const bool stamp_arrival = receive_timestamp::enable(next_layer().native_handle());
+#else
+    const bool stamp_arrival = false;
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+    const bool receive_ecn_codepoint = ecn::enable(next_layer().native_handle());
+#else
+    const bool receive_ecn_codepoint = false;
+#endif
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    receive_offload = segmentation::enable_receive_offload(next_layer().native_handle());
+    // The drop count, the timestamp and the ECN codepoint also arrive as
+    // control messages
+    receive_with_recvmsg = receive_offload || count_drops || stamp_arrival || receive_ecn_codepoint;
+#else
+    static_cast<void>(count_drops);
+    static_cast<void>(stamp_arrival);
+    static_cast<void>(receive_ecn_codepoint);
+#endif
 }
 
 inline multiplexer::~multiplexer()
@@ -191,23 +508,195 @@ inline multiplexer::~multiplexer()
 }
 
 inline void multiplexer::add(socket_base *socket)
+{
+    add(socket, socket->remote_endpoint());
+}
+
+inline void multiplexer::add(socket_base *socket, const endpoint_type& remote_endpoint)
 {
     assert(socket);
 
-    sockets.insert(socket_map::value_type(socket->remote_endpoint(), socket));
+    sockets.insert(socket_map::value_type(remote_endpoint, socket));
+    assign_connection_id(*socket);
+}
+
+inline void multiplexer::release(socket_base *socket, const endpoint_type& remote_endpoint)
+{
+    auto where = sockets.find(remote_endpoint);
+    if (where != sockets.end() && where->second == socket) {
+        sockets.erase(where);
+    }
 }
 
 inline void multiplexer::remove(socket_base *socket)
+{
+    release(socket);
+
+    if (sockets.empty()) {
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+        // Hand queued frames (e.g. the final acknowledgement) to the kernel
+        flush_segments();
+#endif
+        next_layer().close();
+    }
+}
+
+inline void multiplexer::release(socket_base *socket)
 {
     assert(socket);
 
     sockets.erase(socket->remote_endpoint());
+    release_connection_id(*socket);
 
-    if (sockets.empty()) {
-        next_layer().close();
+    if (socket == direct_recipient) {
+        // The pending receive refers to buffers that are about to be released.
+        direct_recipient = nullptr;
+        if (!sockets.empty()) {
+            next_layer().cancel();
+        }
     }
 }
 
+inline void multiplexer::assign_connection_id(socket_base& socket)
+{
+    if (socket.local_connection_id != header::constant::connection_id_none)
+        return;
+
+    std::size_t index;
+    if (!free_slots.empty())
+    {
+        index = free_slots.back();
+        free_slots.pop_back();
+    }
+    else if (slots.size() < 0xFFFF)
+    {
+        index = slots.size();
+        slots.push_back(slot_type{nullptr, header::constant::connection_id_none, 0});
+    }
+    else
+    {
+        // Out of slots, so the socket is only found by its remote endpoint
+        return;
+    }
+
+    const auto upper = std::uniform_int_distribution<std::uint32_t>(0, 0xFFFF)(generator);
+    const auto connection_id = (upper << 16) | std::uint32_t(index + 1);
+    const auto window = socket.max_receive_window();
+    slots[index] = slot_type{&socket, connection_id, window};
+    socket.local_connection_id = connection_id;
+
+    aggregate_window += window;
+    resize_buffers();
+}
+
+inline void multiplexer::release_connection_id(socket_base& socket)
+{
+    const auto connection_id = socket.local_connection_id;
+    if (connection_id == header::constant::connection_id_none)
+        return;
+
+    const std::size_t index = (connection_id & 0xFFFF) - 1;
+    assert(index < slots.size() && slots[index].socket == &socket);
+    aggregate_window -= slots[index].window;
+    slots[index] = slot_type{nullptr, header::constant::connection_id_none, 0};
+    free_slots.push_back(index);
+    resize_buffers();
+
+    // The remote endpoint will be told a new one on the next connect
+    socket.local_connection_id = header::constant::connection_id_none;
+    socket.remote_connection_id = header::constant::connection_id_none;
+}
+
+inline void multiplexer::update_window(socket_base& socket)
+{
+    const auto connection_id = socket.local_connection_id;
+    if (connection_id == header::constant::connection_id_none)
+        return;
+
+    auto& slot = slots[(connection_id & 0xFFFF) - 1];
+    assert(slot.socket == &socket);
+    aggregate_window -= slot.window;
+    slot.window = socket.max_receive_window();
+    aggregate_window += slot.window;
+    resize_buffers();
+}
+
+inline void multiplexer::resize_buffers()
+{
+    if (!next_layer().is_open())
+        return;
+
+    const auto wanted = std::min(constant::max_udp_buffer_size,
+                                 std::max(constant::udp_buffer_headroom * aggregate_window,
+                                          minimum_buffer_size));
+
+    // Grown right away, but only shrunk once well below, so that sockets
+    // coming and going do not resize the buffers every time.
+    if (wanted > buffer_size || wanted < buffer_size / 2)
+    {
+        udp_buffers::resize(next_layer(), wanted);
+        buffer_size = wanted;
+    }
+}
+
+inline udp_statistics multiplexer::statistics() const
+{
+    udp_statistics result;
+#if defined(MAIDSAFE_CRUX_WITH_IO_URING)
+    result.kernel_drops = next_layer().kernel_drops();
+#else
+    result.kernel_drops = kernel_drops;
+#endif
+    if (next_layer().is_open())
+    {
+        udp_buffers::get_sizes(next_layer(), result);
+    }
+    return result;
+}
+
+inline socket_base* multiplexer::find_recipient(const endpoint_type& remote_endpoint,
+                                                const unsigned char *header_data)
+{
+    detail::decoder decoder(header_data, header_data + header_size);
+    const auto type = decoder.get<std::uint16_t>();
+    const auto connection_id = header::connection_id(header_data);
+
+    // Handshakes carry the connection id of the sender instead
+    if ((type & header::constant::mask_type) != header::constant::type_handshake
+        && connection_id != header::constant::connection_id_none)
+    {
+        // Wraps around for a lower half of zero
+        const std::size_t index = std::size_t(connection_id & 0xFFFF) - 1;
+        if (index < slots.size() && slots[index].connection_id == connection_id)
+        {
+            auto socket = slots[index].socket;
+            // Frames that take part in a handshake are only accepted from
+            // the endpoint that the handshake is with. Frames from another
+            // endpoint go to the socket, which moves the connection there
+            // once it has validated the new path.
+            if (socket->state() == socket_base::connectivity::established)
+            {
+                return socket;
+            }
+        }
+    }
+
+    auto recipient = sockets.find(remote_endpoint);
+    return (recipient == sockets.end()) ? nullptr : recipient->second;
+}
+
+inline void multiplexer::rebind(socket_base& socket, const endpoint_type& remote_endpoint)
+{
+    // The remote endpoint has moved to another address or port, e.g. after
+    // its NAT has rebound, and the connection carries on from there. Unless
+    // the new endpoint is already taken, replies go there from now on.
+    if (!sockets.insert(socket_map::value_type(remote_endpoint, &socket)).second)
+        return;
+
+    release(&socket, socket.remote_endpoint());
+    socket.remote_endpoint(remote_endpoint);
+}
+
 template <typename AcceptorType,
           typename SocketType,
           typename AcceptHandler>
@@ -217,10 +706,93 @@ void multiplexer::async_accept(AcceptorType& acceptor,
 {
     std::unique_ptr<accept_input_type> operation(new accept_input_type(&acceptor,
                                                                        &socket,
-                                                                       std::move(handler)));
+                                                                       std::forward<AcceptHandler>(handler)));
     acceptor_queue.emplace_back(std::move(operation));
 
+    // The socket is not handshaking with anybody yet, but it tells the
+    // remote endpoint its connection id in the handshake.
+    socket.remote_endpoint(endpoint_type());
+    assign_connection_id(socket);
+
     start_receive();
+    accept_from_backlog();
+}
+
+inline void multiplexer::enqueue_handshake(const endpoint_type& remote_endpoint,
+                                           sequence_type initial,
+                                           std::uint32_t connection_id,
+                                           std::uint16_t version,
+                                           std::shared_ptr<payload_type> message)
+{
+    const auto now = cookie_generator::clock();
+
+    auto entry = std::find_if(accept_backlog.begin(),
+                              accept_backlog.end(),
+                              [&remote_endpoint] (const backlog_entry& entry)
+                              {
+                                  return entry.remote_endpoint == remote_endpoint;
+                              });
+    if (entry != accept_backlog.end())
+    {
+        // A retransmission, or a new attempt from the same endpoint
+        entry->initial = initial;
+        entry->connection_id = connection_id;
+        entry->version = version;
+        entry->message = message;
+        entry->timestamp = now;
+        return;
+    }
+
+    if (accept_backlog.size() >= accept_backlog_size)
+    {
+        // Like a full listen() backlog we drop the handshake, and the
+        // remote endpoint will retransmit it.
+        return;
+    }
+    accept_backlog.push_back(backlog_entry{remote_endpoint, initial, connection_id, version, message, now});
+}
+
+inline void multiplexer::accept_from_backlog()
+{
+    if (acceptor_queue.empty())
+        return;
+
+    // Only the oldest accept request takes part in handshakes
+    auto socket = std::get<1>(*acceptor_queue.front());
+    if (socket->remote_endpoint() != endpoint_type())
+        return;
+
+    const auto now = cookie_generator::clock();
+    const auto lifetime = static_cast<std::uint32_t>(constant::cookie_lifetime.count());
+
+    while (!accept_backlog.empty())
+    {
+        const auto entry = accept_backlog.front();
+        accept_backlog.pop_front();
+
+        // The remote endpoint retransmits its handshake while waiting, so
+        // entries that have not been refreshed have probably given up.
+        if (std::uint32_t(now - entry.timestamp) > lifetime)
+            continue;
+
+        socket->process_handshake(entry.initial,
+                                  entry.remote_endpoint,
+                                  entry.connection_id,
+                                  entry.message);
+        socket->remote_version = entry.version;
+        return;
+    }
+}
+
+inline void multiplexer::listen(std::size_t backlog)
+{
+    accept_backlog_size = backlog;
+
+    // The newest handshakes are dropped as if they had arrived now
+    while (accept_backlog.size() > accept_backlog_size)
+    {
+        accept_backlog.pop_back();
+    }
 }
 
 inline
@@ -230,10 +802,9 @@ void multiplexer::disable_accept_requests_from(acceptor& accept) {
     while (i != acceptor_queue.end()) {
         if (std::get<0>(**i) == &accept) {
             auto socket  = std::get<1>(**i);
-            auto handler = std::move(std::get<2>(**i));
-            get_io_service().post([handler]() {
-                    handler(boost::asio::error::operation_aborted);
-                    });
+            get_io_service().post
+                (boost::asio::detail::bind_handler(std::move(std::get<2>(**i)),
+                                                   boost::asio::error::operation_aborted));
             stop_receive();
             socket->close();
             acceptor_queue.erase(i++);
@@ -253,71 +824,494 @@ void multiplexer::process_accept(const boost::system::error_code& error,
 
 template <typename ConnectHandler>
 void multiplexer::send_handshake(const endpoint_type& remote_endpoint,
+                                 std::uint32_t connection_id,
                                  sequence_type initial,
                                  boost::optional<ack_sequence_type> ack,
+                                 boost::optional<handshake_token> token,
+                                 std::shared_ptr<payload_type> message,
                                  std::size_t retransmission_count,
                                  ConnectHandler&& handler)
 {
-    auto header = std::make_shared<header::data_type>();
+    auto header = make_header();
     detail::encoder encoder(header->data(), header->size());
-    header::handshake(retransmission_count, initial, ack).encode(encoder);
+    header::handshake(retransmission_count,
+                      initial,
+                      ack,
+                      token ? token->kind : header::constant::handshake_token_none,
+                      connection_id)
+        .encode(encoder);
+
+    using handler_type = typename std::decay<ConnectHandler>::type;
+
+    // A cookie or ticket received from the acceptor is echoed as payload,
+    // followed by the message of the application.
+    std::shared_ptr<cookie_generator::value_type> payload;
+    std::array<boost::asio::const_buffer, 2> payload_buffers;
+    if (token)
+    {
+        payload = std::allocate_shared<cookie_generator::value_type>
+            (handler_allocator<char>(memory), token->value);
+        payload_buffers[0] = boost::asio::buffer(*payload);
+    }
+    if (message)
+    {
+        payload_buffers[1] = boost::asio::buffer(*message);
+    }
+
+    // Handlers may be move-only, so they are moved into the completion
+    // rather than captured.
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    enqueue_segment(remote_endpoint,
+                    header,
+                    header_size,
+                    payload_buffers,
+                    move_capture(std::forward<ConnectHandler>(handler),
+                                 [payload, message] (handler_type& handler,
+                                            const boost::system::error_code& error,
+                                            std::size_t)
+                                 {
+                                     handler(error);
+                                 }));
+#else
     next_layer().async_send_to
-        (boost::asio::buffer(*header),
+        (concatenate(boost::asio::buffer(*header), payload_buffers),
+         remote_endpoint,
+         make_allocation_handler
+             (memory,
+              move_capture(std::forward<ConnectHandler>(handler),
+                           [header, payload, message] (handler_type& handler,
+                                                       boost::system::error_code error,
+                                                       std::size_t length)
+                           {
+                               assert(length == header->size()
+                                                + (payload ? payload->size() : 0)
+                                                + (message ? message->size() : 0));
+                               static_cast<void>(length);
+                               handler(error);
+                           })));
+#endif
+}
+
+inline void multiplexer::send_cookie(const endpoint_type& remote_endpoint,
+                                     sequence_type initial)
+{
+    // Header and cookie in one piece of recycled memory, and nothing else
+    // is kept about the remote endpoint.
+    using frame_type = std::array<std::uint8_t, header_size + cookie_generator::size>;
+    auto frame = std::allocate_shared<frame_type>(handler_allocator<char>(memory));
+
+    detail::encoder encoder(frame->data(), header_size);
+    header::cookie(initial).encode(encoder);
+    const auto cookie = cookies.generate(remote_endpoint, initial.value());
+    std::copy(cookie.begin(), cookie.end(), frame->begin() + header_size);
+
+    next_layer().async_send_to
+        (boost::asio::buffer(*frame),
+         remote_endpoint,
+         make_allocation_handler
+             (memory,
+              [frame] (const boost::system::error_code&, std::size_t) {}));
+}
+
+inline void multiplexer::send_ticket(const endpoint_type& remote_endpoint)
+{
+    // Like a cookie, but not bound to the port or initial sequence number
+    // of the next connection from the remote endpoint.
+    using frame_type = std::array<std::uint8_t, header_size + cookie_generator::size>;
+    auto frame = std::allocate_shared<frame_type>(handler_allocator<char>(memory));
+
+    detail::encoder encoder(frame->data(), header_size);
+    header::ticket().encode(encoder);
+    const auto ticket = tickets.generate(ticket_endpoint(remote_endpoint), 0);
+    std::copy(ticket.begin(), ticket.end(), frame->begin() + header_size);
+
+    next_layer().async_send_to
+        (boost::asio::buffer(*frame),
          remote_endpoint,
-         [handler, header] (boost::system::error_code error, std::size_t length) mutable
-         {
-             assert(length == header->size());
-             static_cast<void>(length);
-             handler(error);
-         });
+         make_allocation_handler
+             (memory,
+              [frame] (const boost::system::error_code&, std::size_t) {}));
+}
+
+inline multiplexer::endpoint_type
+multiplexer::ticket_endpoint(const endpoint_type& remote_endpoint)
+{
+    // The remote endpoint reconnects from another port
+    return endpoint_type(remote_endpoint.address(), 0);
 }
 
 template <typename ConnectHandler>
 void multiplexer::send_keepalive(const endpoint_type& remote_endpoint,
+                                 std::uint32_t connection_id,
                                  sequence_type sequence,
                                  boost::optional<ack_sequence_type> ack,
+                                 boost::optional<std::uint16_t> window,
+                                 std::uint16_t congestion_echo,
+                                 std::uint16_t probe,
                                  std::size_t retransmission_count,
                                  ConnectHandler&& handler)
 {
-    auto header = std::make_shared<header::data_type>();
+    auto header = make_header();
     detail::encoder encoder(header->data(), header->size());
-    header::keepalive(retransmission_count, sequence, ack).encode(encoder);
+    header::keepalive(retransmission_count,
+                      sequence,
+                      ack,
+                      window,
+                      connection_id,
+                      probe,
+                      congestion_echo)
+        .encode(encoder);
+
+    using handler_type = typename std::decay<ConnectHandler>::type;
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    enqueue_segment(remote_endpoint,
+                    header,
+                    header_size,
+                    std::array<boost::asio::const_buffer, 0>(),
+                    move_capture(std::forward<ConnectHandler>(handler),
+                                 [] (handler_type& handler,
+                                     const boost::system::error_code& error,
+                                     std::size_t)
+                                 {
+                                     handler(error);
+                                 }));
+#else
+    next_layer().async_send_to
+        (boost::asio::buffer(*header),
+         remote_endpoint,
+         make_allocation_handler
+             (memory,
+              move_capture(std::forward<ConnectHandler>(handler),
+                           [header] (handler_type& handler,
+                                     boost::system::error_code error,
+                                     std::size_t length)
+                           {
+                               assert(length == header->size());
+                               static_cast<void>(length);
+                               handler(error);
+                           })));
+#endif
+}
 
+template <typename ShutdownHandler>
+void multiplexer::send_shutdown(const endpoint_type& remote_endpoint,
+                                std::uint32_t connection_id,
+                                sequence_type sequence,
+                                boost::optional<ack_sequence_type> ack,
+                                std::size_t retransmission_count,
+                                ShutdownHandler&& handler)
+{
+    auto header = make_header();
+    detail::encoder encoder(header->data(), header->size());
+    header::shutdown(retransmission_count, sequence, ack, connection_id).encode(encoder);
+
+    using handler_type = typename std::decay<ShutdownHandler>::type;
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    enqueue_segment(remote_endpoint,
+                    header,
+                    header_size,
+                    std::array<boost::asio::const_buffer, 0>(),
+                    move_capture(std::forward<ShutdownHandler>(handler),
+                                 [] (handler_type& handler,
+                                     const boost::system::error_code& error,
+                                     std::size_t)
+                                 {
+                                     handler(error);
+                                 }));
+#else
     next_layer().async_send_to
         (boost::asio::buffer(*header),
          remote_endpoint,
-         [handler, header] (boost::system::error_code error, std::size_t length) mutable
-         {
-             assert(length == header->size());
-             static_cast<void>(length);
-             handler(error);
-         });
+         make_allocation_handler
+             (memory,
+              move_capture(std::forward<ShutdownHandler>(handler),
+                           [header] (handler_type& handler,
+                                     boost::system::error_code error,
+                                     std::size_t)
+                           {
+                               handler(error);
+                           })));
+#endif
+}
+
+template <typename WriteHandler>
+void multiplexer::send_parity(std::shared_ptr<buffer> parity,
+                              const endpoint_type& endpoint,
+                              std::uint32_t connection_id,
+                              sequence_type first,
+                              std::uint16_t count,
+                              std::uint32_t size_xor,
+                              WriteHandler&& handler)
+{
+    auto header = make_header();
+    detail::encoder encoder(header->data(), header->size());
+    header::parity(first, count, size_xor, connection_id).encode(encoder);
+
+    const std::array<boost::asio::const_buffer, 1> payload = {{ boost::asio::buffer(*parity) }};
+
+    using handler_type = typename std::decay<WriteHandler>::type;
+    auto done = move_capture(std::forward<WriteHandler>(handler),
+                             [parity] (handler_type& handler,
+                                       const boost::system::error_code& error,
+                                       std::size_t size)
+                             {
+                                 handler(error, size);
+                             });
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    enqueue_segment(endpoint, header, header_size, payload, std::move(done));
+#else
+    next_layer().async_send_to
+        (concatenate(boost::asio::buffer(*header), payload),
+         endpoint,
+         make_allocation_handler
+             (memory,
+              move_capture(std::move(done),
+                           [header] (decltype(done)& handler,
+                                     const boost::system::error_code& error,
+                                     std::size_t size)
+                           {
+                               const auto bytes_transferred = (size >= header_size) ? size - header_size : 0;
+                               handler(error, bytes_transferred);
+                           })));
+#endif
 }
 
 template <typename ConstBufferSequence,
           typename WriteHandler>
 void multiplexer::send_data(ConstBufferSequence&& buffers,
                             const endpoint_type& endpoint,
+                            std::uint32_t connection_id,
                             sequence_type sequence,
                             boost::optional<ack_sequence_type> ack,
+                            boost::optional<std::uint16_t> window,
+                            std::uint16_t congestion_echo,
                             std::uint16_t retransmission_count,
+                            bool compact,
                             WriteHandler&& handler)
 {
-    auto header = std::make_shared<header::data_type>();
+    auto header = make_header();
     detail::encoder encoder(header->data(), header->size());
-    header::data(retransmission_count, sequence, ack).encode(encoder);
+    if (compact)
+    {
+        header::compact_data(retransmission_count, sequence, ack, window, connection_id, congestion_echo)
+            .encode(encoder);
+    }
+    else
+    {
+        header::data(retransmission_count, sequence, ack, window, connection_id, congestion_echo)
+            .encode(encoder);
+    }
+    const auto header_length = header->size() - encoder.size();
 
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    enqueue_segment(endpoint, header, header_length, buffers, std::forward<WriteHandler>(handler));
+#else
     next_layer().async_send_to
-        (concatenate(boost::asio::buffer(*header),
+        (concatenate(boost::asio::buffer(*header, header_length),
                      std::forward<ConstBufferSequence>(buffers)),
          endpoint,
-         [handler, header](const boost::system::error_code& error, std::size_t size) mutable
-         {
-             const auto bytes_transferred = (size >= header_size) ? size - header_size : 0;
-             handler(error, bytes_transferred);
-        });
+         make_allocation_handler
+             (memory,
+              move_capture(std::forward<WriteHandler>(handler),
+                           [header, header_length] (typename std::decay<WriteHandler>::type& handler,
+                                                    const boost::system::error_code& error,
+                                                    std::size_t size)
+                           {
+                               const auto bytes_transferred = (size >= header_length) ? size - header_length : 0;
+                               handler(error, bytes_transferred);
+                           })));
+#endif
+}
+
+template <typename WriteHandler>
+void multiplexer::send_ack(const endpoint_type& remote_endpoint,
+                           std::uint32_t connection_id,
+                           ack_sequence_type ack,
+                           boost::optional<std::uint16_t> window,
+                           std::uint16_t congestion_echo,
+                           WriteHandler&& handler)
+{
+    auto header = make_header();
+    detail::encoder encoder(header->data(), header->size());
+    header::compact_ack(ack, window, connection_id, congestion_echo).encode(encoder);
+    const auto header_length = header->size() - encoder.size();
+
+    using handler_type = typename std::decay<WriteHandler>::type;
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    enqueue_segment(remote_endpoint,
+                    header,
+                    header_length,
+                    std::array<boost::asio::const_buffer, 0>(),
+                    move_capture(std::forward<WriteHandler>(handler),
+                                 [] (handler_type& handler,
+                                     const boost::system::error_code& error,
+                                     std::size_t)
+                                 {
+                                     handler(error);
+                                 }));
+#else
+    next_layer().async_send_to
+        (boost::asio::buffer(*header, header_length),
+         remote_endpoint,
+         make_allocation_handler
+             (memory,
+              move_capture(std::forward<WriteHandler>(handler),
+                           [header] (handler_type& handler,
+                                     boost::system::error_code error,
+                                     std::size_t)
+                           {
+                               handler(error);
+                           })));
+#endif
 }
 
+inline std::shared_ptr<header::data_type> multiplexer::make_header()
+{
+    return std::allocate_shared<header::data_type>(handler_allocator<char>(memory));
+}
+
+inline std::shared_ptr<multiplexer::payload_type> multiplexer::make_payload(std::size_t size)
+{
+    handler_allocator<char> allocator(memory);
+    auto payload = std::allocate_shared<payload_type>(allocator, size, allocator);
+    payload->arrival = receive_arrival;
+    return payload;
+}
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
+template <typename ConstBufferSequence, typename WriteHandler>
+void multiplexer::enqueue_segment(const endpoint_type& endpoint,
+                                  std::shared_ptr<header::data_type> header,
+                                  std::size_t header_length,
+                                  const ConstBufferSequence& payload,
+                                  WriteHandler&& handler)
+{
+    if (pending_segments.empty())
+    {
+        auto self(shared_from_this());
+        get_io_service().post(make_allocation_handler(memory, [self] { self->flush_segments(); }));
+    }
+
+    segment_type segment;
+    segment.endpoint = endpoint;
+    segment.header = std::move(header);
+    segment.header_length = header_length;
+    segment.first_buffer = pending_buffers.size();
+    for (auto i = payload.begin(); i != payload.end(); ++i)
+    {
+        pending_buffers.push_back(boost::asio::const_buffer(*i));
+    }
+    segment.buffer_count = pending_buffers.size() - segment.first_buffer;
+    segment.size = header_length + boost::asio::buffer_size(payload);
+    segment.handler = write_handler_type(std::allocator_arg,
+                                         handler_allocator<char>(memory),
+                                         std::forward<WriteHandler>(handler));
+    pending_segments.push_back(std::move(segment));
+}
+
+inline void multiplexer::flush_segments()
+{
+    flushing_segments.swap(pending_segments);
+    flushing_buffers.swap(pending_buffers);
+    auto& segments = flushing_segments;
+
+    std::size_t first = 0;
+    while (first < segments.size())
+    {
+        // Find the longest run of frames to the same endpoint where all
+        // frames but the last have the same size.
+        const auto& endpoint = segments[first].endpoint;
+        const auto segment_size = segments[first].size;
+        auto total_size = segment_size;
+        auto last = first + 1;
+        while (last < segments.size()
+               && last - first < segmentation::max_segments
+               && segments[last].endpoint == endpoint
+               && segments[last].size <= segment_size
+               && total_size + segments[last].size <= segmentation::max_size)
+        {
+            total_size += segments[last].size;
+            if (segments[last++].size < segment_size)
+                break;
+        }
+
+        if (last - first > 1)
+        {
+            segment_buffers.clear();
+            for (auto i = first; i < last; ++i)
+            {
+                const auto payload = flushing_buffers.begin() + segments[i].first_buffer;
+                segment_buffers.push_back(boost::asio::buffer(*segments[i].header,
+                                                              segments[i].header_length));
+                segment_buffers.insert(segment_buffers.end(),
+                                       payload,
+                                       payload + segments[i].buffer_count);
+            }
+
+            boost::system::error_code error;
+            segmentation::send(next_layer().native_handle(),
+                               segment_buffers,
+                               segment_size,
+                               endpoint,
+                               error);
+            if (!error)
+            {
+                for (auto i = first; i < last; ++i)
+                {
+                    get_io_service().post
+                        (make_allocation_handler
+                             (memory,
+                              boost::asio::detail::bind_handler
+                                  (std::move(segments[i].handler),
+                                   boost::system::error_code(),
+                                   segments[i].size - segments[i].header_length)));
+                }
+                first = last;
+                continue;
+            }
+            // Segmentation offload unavailable; send the frames one by one.
+        }
+
+        for (auto i = first; i < last; ++i)
+        {
+            using frame_type = std::vector<boost::asio::const_buffer,
+                                           handler_allocator<boost::asio::const_buffer>>;
+            const auto payload = flushing_buffers.begin() + segments[i].first_buffer;
+            frame_type frame{handler_allocator<boost::asio::const_buffer>(memory)};
+            frame.reserve(segments[i].buffer_count + 1);
+            frame.push_back(boost::asio::buffer(*segments[i].header, segments[i].header_length));
+            frame.insert(frame.end(), payload, payload + segments[i].buffer_count);
+
+            auto header = segments[i].header;
+            const auto header_length = segments[i].header_length;
+            next_layer().async_send_to
+                (frame,
+                 endpoint,
+                 make_allocation_handler
+                     (memory,
+                      move_capture(std::move(segments[i].handler),
+                                   [header, header_length] (write_handler_type& handler,
+                                                            const boost::system::error_code& error,
+                                                            std::size_t size)
+                                   {
+                                       const auto bytes_transferred = (size >= header_length) ? size - header_length : 0;
+                                       handler(error, bytes_transferred);
+                                   })));
+        }
+        first = last;
+    }
+
+    segments.clear();
+    flushing_buffers.clear();
+}
+
+#endif // defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
 inline multiplexer::endpoint_type multiplexer::local_loopback_endpoint() const {
     namespace ip = boost::asio::ip;
     auto local = next_layer().local_endpoint();
@@ -369,41 +1363,77 @@ inline void multiplexer::do_start_receive()
 {
     auto self(shared_from_this());
 
-    // We need to read with at least one zero sized buffer to
-    // get the remote_endpoint information.
+    direct_recipient = direct_receive_candidate();
+    receive_direct = (direct_recipient != nullptr);
+
+    receive_buffers.clear();
+    receive_buffers.push_back(boost::asio::buffer(receive_header));
+    if (receive_direct)
+    {
+        const auto& posted = *direct_recipient->get_recv_buffers();
+        receive_buffers.insert(receive_buffers.end(), posted.begin(), posted.end());
+    }
+    receive_buffers.push_back(boost::asio::buffer(receive_buffer));
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    if (receive_with_recvmsg)
+    {
+        // Wait for readability and receive with recvmsg to learn whether
+        // the kernel has coalesced several datagrams, and how many it has
+        // dropped.
+        next_layer().async_receive_from
+            (boost::asio::null_buffers(),
+             next_remote_endpoint,
+             make_allocation_handler
+                 (memory,
+                  [self] (boost::system::error_code error, std::size_t) mutable
+                  {
+                      self->process_readable(error);
+                  }));
+        return;
+    }
+#endif
+
     next_layer().async_receive_from
-        (boost::asio::buffer(static_cast<char*>(nullptr), 0),
+        (receive_buffers,
          next_remote_endpoint,
-         std::remove_reference<decltype(next_layer())>::type::message_peek,
-         [self]
-         (boost::system::error_code error, std::size_t /*size*/) mutable
-         {
-            // The size parameter is useless here because what we get
-            // is min(buffer_size, datagram_size) and our buffer size is 0.
-            self->process_peek(error, self->next_remote_endpoint);
-         });
+         make_allocation_handler
+             (memory,
+              [self] (boost::system::error_code error, std::size_t size) mutable
+              {
+#if defined(MAIDSAFE_CRUX_WITH_IO_URING)
+                  self->receive_arrival = self->next_layer().arrival();
+                  self->receive_ecn = self->next_layer().ecn();
+#else
+                  self->receive_arrival = std::chrono::steady_clock::now();
+                  self->receive_ecn = ecn::not_capable;
+#endif
+                  self->process_receive(error, size, 0, self->next_remote_endpoint);
+              }));
 }
 
-inline void multiplexer::discard_message() {
-    boost::system::error_code error;
-    endpoint_type remote_endpoint;
-    next_layer().receive_from
-        ( boost::asio::buffer(static_cast<char*>(nullptr), 0)
-        , remote_endpoint, next_layer_type::message_flags(), error );
+inline socket_base* multiplexer::direct_receive_candidate()
+{
+    // Only with a single possible recipient do we know in advance where
+    // the next datagram is going.
+    if (sockets.size() != 1 || !acceptor_queue.empty())
+        return nullptr;
+
+    auto socket = sockets.begin()->second;
+    return socket->get_recv_buffers() ? socket : nullptr;
 }
 
 inline
-void multiplexer::process_peek(boost::system::error_code error,
-                               endpoint_type remote_endpoint)
+void multiplexer::process_receive(boost::system::error_code error,
+                                  std::size_t datagram_size,
+                                  std::size_t segment_size,
+                                  endpoint_type remote_endpoint)
 {
-    namespace asio = boost::asio;
-
     if (!next_layer().is_open()) return;
 
     if (receive_calls == 0) {
         // We've received our own empty message to fullfill the last receive
         // request or we've received someone's else's message while doing so.
-        discard_message();
         return;
     }
 
@@ -420,140 +1450,483 @@ void multiplexer::process_peek(boost::system::error_code error,
         break;
 #endif // defined(BOOST_ASIO_WINDOWS)
 
-    case boost::asio::error::operation_aborted:
-        discard_message();
-        --receive_calls;
-        return;
-
     default:
-        // Since we're here a socket must have been receiving
-        // and its receive request must be fulfilled, so we
-        // must start receiving again.
-        discard_message();
+        // Since we're here a socket must have been receiving (or the
+        // receive was cancelled because its direct recipient went away)
+        // and its receive request must be fulfilled, so we must start
+        // receiving again.
         do_start_receive();
         return;
     }
 
-    auto recipient = sockets.find(remote_endpoint);
+    if (datagram_size < header::constant::min_size || (receive_direct && !direct_recipient)) {
+        // Our empty packet, corrupted packet, someone is being silly, or
+        // the data went into buffers that have been released meanwhile.
+        do_start_receive();
+        return;
+    }
 
-    next_layer_type::bytes_readable command(true);
-    next_layer().io_control(command);
-    std::size_t datagram_size = command.get();
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+    if (segment_size > 0 && datagram_size > segment_size)
+    {
+        process_segments(error, datagram_size, segment_size, remote_endpoint);
+        return;
+    }
+#else
+    static_cast<void>(segment_size);
+#endif
 
-    if (datagram_size < header_size) {
-        // Our empty packet, corrupted packet or someone is being silly.
-        discard_message();
+    if (!process_received(error, datagram_size, remote_endpoint)) {
         do_start_receive();
         return;
     }
 
-    header::data_type header_data;
-    std::size_t payload_size = datagram_size - header_size;
+    if (--receive_calls > 0) {
+        do_start_receive();
+    }
+}
 
-    // FIXME: gather-read (header, body)
-    // FIXME: Make socket.receive_from commands async.
-    if (recipient == sockets.end())
-    {
-        establish_connection(payload_size, remote_endpoint);
+inline
+bool multiplexer::process_received(const boost::system::error_code& error,
+                                   std::size_t frame_size,
+                                   endpoint_type remote_endpoint)
+{
+    namespace asio = boost::asio;
+
+    // The payload of a compact frame starts inside the header
+    const auto received_header_size = std::min(frame_size, header::constant::size);
+    const auto frame_header_size = header::size(receive_header.data());
+    if (frame_header_size == 0 || frame_header_size > received_header_size) {
+        return false;
     }
-    else
+    const auto spill = received_header_size - frame_header_size;
+
+    std::size_t payload_size = frame_size - frame_header_size;
+    auto recipient = find_recipient(remote_endpoint, receive_header.data());
+
+    if (!recipient)
     {
-        auto& crux_socket  = *(*recipient).second;
-        auto* recv_buffers = crux_socket.get_recv_buffers();
+        establish_connection(remote_endpoint, payload_size);
+        return true;
+    }
 
-        std::shared_ptr<buffer_type> payload;
+    auto& crux_socket = *recipient;
+    const bool was_receiving = crux_socket.receiving();
+    std::shared_ptr<payload_type> payload;
 
+    if (!receive_direct)
+    {
+        const std::array<asio::const_buffer, 2> received
+            = {{ asio::buffer(receive_header.data() + frame_header_size, spill),
+                 asio::buffer(receive_buffer, payload_size - spill) }};
+        auto* recv_buffers = crux_socket.get_recv_buffers();
         if (recv_buffers) {
-            next_layer().receive_from
-                ( concatenate( asio::buffer(header_data)
-                               , std::move(*recv_buffers))
-                  , remote_endpoint
-                  , next_layer_type::message_flags()
-                  , error );
+            asio::buffer_copy(*recv_buffers, received);
+        }
+        else {
+            payload = make_payload(payload_size);
+            asio::buffer_copy(asio::buffer(*payload), received);
+        }
+    }
+    else if (&crux_socket != direct_recipient || spill > 0)
+    {
+        // The payload was received into the posted buffers of another
+        // socket (followed by our own buffer), or into our own posted
+        // buffers but behind its start if the header was compact. The
+        // buffers received into are rebuilt by the next receive.
+        receive_buffers.front()
+            = asio::buffer(receive_header.data() + frame_header_size, spill);
+        const auto& received = receive_buffers;
+        auto* recv_buffers = crux_socket.get_recv_buffers();
+        if (recv_buffers && &crux_socket != direct_recipient) {
+            asio::buffer_copy(*recv_buffers, received, payload_size);
         }
         else {
-            payload = std::make_shared<buffer_type>(payload_size);
-
-            next_layer().receive_from
-                ( concatenate( asio::buffer(header_data)
-                               , asio::buffer(*payload))
-                  , remote_endpoint
-                  , next_layer_type::message_flags()
-                  , error );
+            payload = make_payload(payload_size);
+            asio::buffer_copy(asio::buffer(*payload), received);
+            if (recv_buffers) {
+                // Moved into place by way of the payload, as it
+                // overlaps with where it goes.
+                asio::buffer_copy(*recv_buffers, asio::buffer(*payload));
+                payload = nullptr;
+            }
         }
+    }
 
-        detail::decoder decoder(header_data.data(), header_data.data() + header_data.size());
-        auto type = decoder.get<std::uint16_t>();
-        switch (type & header::constant::mask_type)
-        {
-        case header::constant::type_handshake:
-            process_handshake(crux_socket, remote_endpoint, type, decoder);
-            break;
+    process_frame(crux_socket,
+                  remote_endpoint,
+                  receive_header.data(),
+                  error,
+                  payload_size,
+                  payload);
 
-        case header::constant::type_keepalive:
-            process_keepalive(crux_socket, type, decoder);
-            break;
+    if (!was_receiving)
+    {
+        // The datagram arrived while receiving on behalf of someone
+        // else, whose receive request is still pending.
+        ++receive_calls;
+    }
+    return true;
+}
 
-        case header::constant::type_data:
-            process_data(crux_socket, type, decoder, error, payload_size, payload);
-            break;
+inline
+void multiplexer::process_frame(socket_base& socket,
+                                endpoint_type remote_endpoint,
+                                const unsigned char *header_data,
+                                const boost::system::error_code& error,
+                                std::size_t payload_size,
+                                std::shared_ptr<payload_type> payload)
+{
+    socket.arrival = receive_arrival;
+    socket.sender = remote_endpoint;
+    if (receive_ecn == ecn::congestion_experienced) {
+        ++socket.congestion.marks_received;
+    }
 
-        default:
-            assert(false);
-            break;
+    detail::decoder decoder(header_data, header_data + header::size(header_data));
+    auto type = decoder.get<std::uint16_t>();
+    switch (type & header::constant::mask_type)
+    {
+    case header::constant::type_handshake:
+        process_handshake(socket, remote_endpoint, type, decoder);
+        break;
+
+    case header::constant::type_keepalive:
+        process_keepalive(socket, type, decoder);
+        break;
+
+    case header::constant::type_data:
+        process_data(socket, type, decoder, error, payload_size, payload);
+        break;
+
+    case header::constant::type_shutdown:
+        process_shutdown(socket, type, decoder);
+        break;
+
+    case header::constant::type_cookie:
+        process_cookie(socket, remote_endpoint, type, decoder, payload_size, payload);
+        break;
+
+    case header::constant::type_ticket:
+        process_ticket(socket, type, decoder, payload_size, payload);
+        break;
+
+    case header::constant::type_parity:
+        process_parity(socket, type, decoder, payload_size, payload);
+        break;
+
+    case header::constant::type_compact_data:
+        process_compact_data(socket, type, decoder, error, payload_size, payload);
+        break;
+
+    case header::constant::type_compact_ack:
+        process_compact_ack(socket, type, decoder);
+        break;
+
+    default:
+        break;
+    }
+}
+
+inline
+void multiplexer::process_cookie(socket_base& socket,
+                                 endpoint_type remote_endpoint,
+                                 std::uint16_t type,
+                                 detail::decoder& decoder,
+                                 std::size_t payload_size,
+                                 std::shared_ptr<payload_type> payload)
+{
+    // The initial sequence number is covered by the cookie
+    header::cookie(type, decoder);
+
+    socket.process_cookie(remote_endpoint, copy_token(socket, payload_size, payload));
+}
+
+inline
+void multiplexer::process_ticket(socket_base& socket,
+                                 std::uint16_t type,
+                                 detail::decoder& decoder,
+                                 std::size_t payload_size,
+                                 std::shared_ptr<payload_type> payload)
+{
+    header::ticket(type, decoder);
+
+    socket.process_ticket(copy_token(socket, payload_size, payload));
+}
+
+inline
+void multiplexer::process_parity(socket_base& socket,
+                                 std::uint16_t type,
+                                 detail::decoder& decoder,
+                                 std::size_t payload_size,
+                                 std::shared_ptr<payload_type> payload)
+{
+    header::parity msg(type, decoder);
+
+    if (!payload)
+    {
+        // Copied into buffers that the socket has posted, which it needs
+        // for data, so the parity is taken out of them.
+        payload = make_payload(payload_size);
+        auto* recv_buffers = socket.get_recv_buffers();
+        if (!recv_buffers
+            || boost::asio::buffer_copy(boost::asio::buffer(*payload), *recv_buffers) != payload_size)
+        {
+            socket.idempotent_start_receive();
+            return;
         }
     }
 
-    if (--receive_calls > 0) {
-        do_start_receive();
+    socket.process_parity(msg.first, msg.count, msg.size_xor, std::move(payload));
+}
+
+inline boost::optional<cookie_generator::value_type>
+multiplexer::copy_token(socket_base& socket,
+                        std::size_t payload_size,
+                        const std::shared_ptr<payload_type>& payload)
+{
+    namespace asio = boost::asio;
+
+    if (payload_size != cookie_generator::size)
+        return boost::none;
+
+    // The token has been copied like any payload, possibly into buffers
+    // that the socket has posted.
+    cookie_generator::value_type token;
+    if (payload)
+    {
+        std::copy(payload->begin(), payload->end(), token.begin());
+    }
+    else if (asio::buffer_copy(asio::buffer(token), *socket.get_recv_buffers()) != token.size())
+    {
+        return boost::none;
+    }
+    return token;
+}
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
+inline void multiplexer::process_readable(const boost::system::error_code& error)
+{
+    std::size_t segment_size = 0;
+    std::size_t size = 0;
+    boost::system::error_code receive_error = error;
+    if (!error && next_layer().is_open())
+    {
+        size = segmentation::receive(next_layer().native_handle(),
+                                     receive_buffers,
+                                     next_remote_endpoint,
+                                     segment_size,
+                                     kernel_drops,
+                                     receive_arrival,
+                                     receive_ecn,
+                                     receive_error);
+        if (receive_error == boost::asio::error::would_block
+            || receive_error == boost::asio::error::try_again)
+        {
+            // Spurious wakeup
+            do_start_receive();
+            return;
+        }
     }
+    process_receive(receive_error, size, segment_size, next_remote_endpoint);
 }
 
 inline
-void multiplexer::establish_connection(std::size_t payload_size,
-                                       endpoint_type remote_endpoint)
+void multiplexer::process_segments(const boost::system::error_code& error,
+                                   std::size_t datagram_size,
+                                   std::size_t segment_size,
+                                   endpoint_type remote_endpoint)
 {
-    header::data_type header_data;
-    auto payload = std::make_shared<buffer_type>(payload_size);
+    namespace asio = boost::asio;
 
-    boost::system::error_code error;
-    auto size = next_layer().receive_from(concatenate(boost::asio::buffer(header_data),
-                                                      boost::asio::buffer(*payload)),
-                                          remote_endpoint,
-                                          next_layer_type::message_flags(),
-                                          error);
-    if (error)
+    // The kernel has coalesced several datagrams from the same remote
+    // endpoint, so we split them where they have been received. Those
+    // behind the first normally start in our own buffer, but they begin
+    // in the header or in the posted buffers of a direct recipient if
+    // the frames are small or received directly. The first frame is done
+    // with those by the time the rest are processed, so the rest are
+    // moved into our own buffer up front.
+    const auto ahead = asio::buffer_size(receive_buffers) - receive_buffer.size();
+    std::size_t base = ahead;
+    if (segment_size < ahead)
     {
-        // Ignore errors on new connections
-        return;
+        datagram_size = std::min(datagram_size, segment_size + receive_buffer.size());
+        const auto moved = std::min(ahead, datagram_size) - segment_size;
+        const auto kept = datagram_size - moved - segment_size;
+        std::copy_backward(receive_buffer.data(),
+                           receive_buffer.data() + kept,
+                           receive_buffer.data() + moved + kept);
+        std::size_t position = 0;
+        std::size_t copied = 0;
+        for (auto i = receive_buffers.begin(); copied < moved; ++i)
+        {
+            const auto size = asio::buffer_size(*i);
+            if (position + size > segment_size)
+            {
+                const auto skip = segment_size > position ? segment_size - position : 0;
+                copied += asio::buffer_copy(asio::buffer(receive_buffer.data() + copied,
+                                                         moved - copied),
+                                            *i + skip);
+            }
+            position += size;
+        }
+        base = segment_size;
     }
-    if (size < header_data.size())
+
+    // Each frame fulfils a receive request like a datagram of its own
+    // would. The request is taken off before the next frame, but the last
+    // one stays until all frames are done so that no receive into our
+    // buffer starts in between.
+    std::size_t fulfilled = 0;
+    if (process_received(error, segment_size, remote_endpoint))
     {
-        // Ignore datagrams with incomplete header
-        return;
+        ++fulfilled;
     }
 
-    if (acceptor_queue.empty())
+    for (std::size_t offset = segment_size; offset < datagram_size; offset += segment_size)
     {
-        // Ignore handshakes that we did not expect.
-        // FIXME: Should we enqueue the most recent requests?
-        return;
+        const auto settled = std::min(fulfilled, receive_calls - 1);
+        receive_calls -= settled;
+        fulfilled -= settled;
+
+        const auto frame_size = std::min(segment_size, datagram_size - offset);
+        if (frame_size < header::constant::min_size)
+            continue;
+
+        char *frame = receive_buffer.data() + (offset - base);
+
+        // Frames of any size are coalesced, so the header is decoded from
+        // an aligned copy.
+        std::copy(frame,
+                  frame + std::min(frame_size, header::constant::size),
+                  receive_header.begin());
+        const auto frame_header_size = header::size(receive_header.data());
+        if (frame_header_size == 0 || frame_header_size > frame_size)
+            continue;
+
+        const auto payload_size = frame_size - frame_header_size;
+        auto recipient = find_recipient(remote_endpoint, receive_header.data());
+        if (!recipient)
+        {
+            // The frames before this one are done with, so its payload is
+            // moved to where that of a datagram of its own would be.
+            std::copy(frame + frame_header_size,
+                      frame + frame_size,
+                      receive_buffer.data());
+            establish_connection(remote_endpoint, payload_size);
+            ++fulfilled;
+            continue;
+        }
+
+        auto& crux_socket = *recipient;
+        const bool was_receiving = crux_socket.receiving();
+
+        std::shared_ptr<payload_type> payload;
+        auto* recv_buffers = crux_socket.get_recv_buffers();
+        if (recv_buffers)
+        {
+            asio::buffer_copy(*recv_buffers, asio::buffer(frame + frame_header_size, payload_size));
+        }
+        else
+        {
+            payload = make_payload(payload_size);
+            std::copy(frame + frame_header_size, frame + frame_size, payload->begin());
+        }
+
+        process_frame(crux_socket,
+                      remote_endpoint,
+                      receive_header.data(),
+                      error,
+                      payload_size,
+                      payload);
+
+        if (!was_receiving)
+        {
+            // Whoever we were receiving for is still waiting
+            ++receive_calls;
+        }
+        ++fulfilled;
     }
 
-    auto& input = acceptor_queue.front();
-    auto socket = std::get<1>(*input);
+    assert(receive_calls >= fulfilled);
+    receive_calls -= fulfilled;
+    if (receive_calls > 0) {
+        do_start_receive();
+    }
+}
+
+#endif // defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
 
-    detail::decoder decoder(header_data.data(), header_data.data() + header_data.size());
+inline
+void multiplexer::establish_connection(endpoint_type remote_endpoint,
+                                       std::size_t payload_size)
+{
+    // Unless the datagram completes an accept request, whoever we were
+    // receiving for is still waiting.
+    detail::decoder decoder(receive_header.data(), receive_header.data() + receive_header.size());
     auto type = decoder.get<std::uint16_t>();
+    // A valid resumption ticket skips the rest of the handshake
+    bool resumed = false;
     switch (type & header::constant::mask_type)
     {
     case header::constant::type_handshake:
-        process_handshake(*socket, remote_endpoint, type, decoder);
+        {
+            detail::decoder peek(receive_header.data() + sizeof(type),
+                                 receive_header.data() + receive_header.size());
+            header::handshake msg(type, peek);
+            if (msg.ack)
+            {
+                // Only sent in reply to our own handshakes
+                ++receive_calls;
+                return;
+            }
+            resumed = redeem_ticket(remote_endpoint, msg, payload_size);
+            if (!resumed && !has_valid_cookie(remote_endpoint, msg, payload_size))
+            {
+                // Nothing is committed to the remote endpoint until it has
+                // shown that it receives at its address by echoing a cookie.
+                send_cookie(remote_endpoint, msg.initial_sequence_number);
+                ++receive_calls;
+                return;
+            }
+
+            if (acceptor_queue.empty())
+            {
+                enqueue_handshake(remote_endpoint,
+                                  msg.initial_sequence_number,
+                                  msg.connection_id,
+                                  msg.version,
+                                  handshake_message(msg, payload_size));
+                ++receive_calls;
+                return;
+            }
+
+            const auto engaged = std::get<1>(*acceptor_queue.front())->remote_endpoint();
+            if (engaged != endpoint_type() && engaged != remote_endpoint)
+            {
+                // The accept request is handshaking with somebody else. A
+                // resumed handshake completes the usual way once it leaves
+                // the backlog.
+                enqueue_handshake(remote_endpoint,
+                                  msg.initial_sequence_number,
+                                  msg.connection_id,
+                                  msg.version,
+                                  handshake_message(msg, payload_size));
+                ++receive_calls;
+                return;
+            }
+        }
         break;
 
     case header::constant::type_keepalive:
-        // FIXME: Detect denial-of-service attacks
-        process_keepalive(*socket, type, decoder);
+        if (acceptor_queue.empty()
+            || std::get<1>(*acceptor_queue.front())->remote_endpoint() != remote_endpoint)
+        {
+            // Not the endpoint that an accept request is handshaking with
+            ++receive_calls;
+            return;
+        }
         break;
 
     default:
@@ -561,35 +1934,178 @@ void multiplexer::establish_connection(std::size_t payload_size,
         //   1) The initial handshake was lost in transmission. The handshake
         //      will be retransmitted later, and so will any packet we ignore.
         //   2) Denial-of-service attack, which we will ignore.
+        ++receive_calls;
         return;
     }
 
+    auto socket = std::get<1>(*acceptor_queue.front());
+    const bool was_receiving = socket->receiving();
+
+    if ((type & header::constant::mask_type) == header::constant::type_handshake)
+    {
+        detail::decoder peek(receive_header.data() + sizeof(type),
+                             receive_header.data() + receive_header.size());
+        process_handshake(*socket,
+                          remote_endpoint,
+                          type,
+                          decoder,
+                          handshake_message(header::handshake(type, peek), payload_size));
+        if (resumed && socket->remote_endpoint() == remote_endpoint)
+        {
+            // The remote endpoint considers itself connected already, and
+            // acknowledges our handshake along the way.
+            socket->state(socket_base::connectivity::established);
+        }
+    }
+    else
+    {
+        process_keepalive(*socket, type, decoder);
+    }
+
     if (socket->state() == socket_base::connectivity::established)
     {
         boost::system::error_code success;
         auto input = std::move(acceptor_queue.front());
         acceptor_queue.pop_front();
+        send_ticket(remote_endpoint);
         process_accept(success,
                        std::get<2>(*input));
         --receive_calls;
+
+        // The next accept request may be waiting for the backlog
+        accept_from_backlog();
     }
-    else {
+
+    if (!was_receiving)
+    {
+        // The datagram arrived while receiving on behalf of the acceptor,
+        // whose receive request is still pending.
         ++receive_calls;
     }
 }
 
+inline
+bool multiplexer::has_valid_cookie(const endpoint_type& remote_endpoint,
+                                   const header::handshake& msg,
+                                   std::size_t payload_size)
+{
+    cookie_generator::value_type cookie;
+    return received_token(msg, header::constant::handshake_token_cookie, payload_size, cookie)
+        && cookies.verify(cookie, remote_endpoint, msg.initial_sequence_number.value());
+}
+
+inline
+bool multiplexer::redeem_ticket(const endpoint_type& remote_endpoint,
+                                const header::handshake& msg,
+                                std::size_t payload_size)
+{
+    cookie_generator::value_type ticket;
+    if (!received_token(msg, header::constant::handshake_token_ticket, payload_size, ticket)
+        || !tickets.verify(ticket, ticket_endpoint(remote_endpoint), 0))
+        return false;
+
+    auto where = redeemed_tickets.find(ticket);
+    if (where != redeemed_tickets.end())
+    {
+        // Retransmissions of the handshake that redeemed the ticket are
+        // let through until the connection has been accepted.
+        return where->second.remote_endpoint == remote_endpoint
+            && where->second.initial == msg.initial_sequence_number
+            && is_handshake_pending(remote_endpoint);
+    }
+
+    const auto now = cookie_generator::clock();
+    if (redeemed_tickets.size() >= constant::max_redeemed_tickets)
+    {
+        const auto lifetime = static_cast<std::uint32_t>(constant::ticket_lifetime.count());
+        for (auto i = redeemed_tickets.begin(); i != redeemed_tickets.end();)
+        {
+            if (std::uint32_t(now - i->second.timestamp) >= lifetime)
+                redeemed_tickets.erase(i++);
+            else
+                ++i;
+        }
+        // The remote endpoint falls back to the full handshake rather than
+        // us forgetting a ticket that could then be replayed.
+        if (redeemed_tickets.size() >= constant::max_redeemed_tickets)
+            return false;
+    }
+    redeemed_tickets.emplace(ticket,
+                             redeemed_ticket{remote_endpoint, msg.initial_sequence_number, now});
+    return true;
+}
+
+inline
+bool multiplexer::is_handshake_pending(const endpoint_type& remote_endpoint) const
+{
+    if (!acceptor_queue.empty()
+        && std::get<1>(*acceptor_queue.front())->remote_endpoint() == remote_endpoint)
+        return true;
+
+    return std::any_of(accept_backlog.begin(),
+                       accept_backlog.end(),
+                       [&remote_endpoint] (const backlog_entry& entry)
+                       {
+                           return entry.remote_endpoint == remote_endpoint;
+                       });
+}
+
+inline
+bool multiplexer::received_token(const header::handshake& msg,
+                                 std::uint16_t kind,
+                                 std::size_t payload_size,
+                                 cookie_generator::value_type& token) const
+{
+    // The acceptor never receives directly into posted buffers
+    assert(!receive_direct);
+
+    if (msg.token != kind || payload_size < cookie_generator::size)
+        return false;
+
+    std::copy(receive_buffer.begin(), receive_buffer.begin() + token.size(), token.begin());
+    return true;
+}
+
+inline std::shared_ptr<multiplexer::payload_type>
+multiplexer::handshake_message(const header::handshake& msg, std::size_t payload_size)
+{
+    // The acceptor never receives directly into posted buffers
+    assert(!receive_direct);
+
+    const std::size_t offset = (msg.token == header::constant::handshake_token_none)
+        ? 0
+        : cookie_generator::size;
+    if (payload_size <= offset)
+        return nullptr;
+
+    auto message = make_payload(payload_size - offset);
+    boost::asio::buffer_copy(boost::asio::buffer(*message),
+                             boost::asio::buffer(receive_buffer, payload_size) + offset);
+    return message;
+}
+
 inline
 void multiplexer::process_handshake(socket_base& socket,
                                     endpoint_type remote_endpoint,
                                     std::uint16_t type,
-                                    detail::decoder& decoder)
+                                    detail::decoder& decoder,
+                                    std::shared_ptr<payload_type> message)
 {
     header::handshake msg(type, decoder);
-    socket.process_handshake(msg.initial_sequence_number, remote_endpoint);
+    socket.process_handshake(msg.initial_sequence_number,
+                             remote_endpoint,
+                             msg.connection_id,
+                             message);
+    // Of the remote endpoint that the socket has settled on, rather than
+    // any other that it is racing
+    if (socket.remote_endpoint() == remote_endpoint)
+    {
+        socket.remote_version = msg.version;
+    }
 
     if (msg.ack)
     {
-        socket.process_acknowledgement(*msg.ack);
+        socket.process_acknowledgement(*msg.ack, boost::none, 0);
     }
 }
 
@@ -599,11 +2115,25 @@ void multiplexer::process_keepalive(socket_base& socket,
                                     detail::decoder& decoder)
 {
     header::keepalive msg(type, decoder);
-    socket.process_keepalive(msg.sequence_number);
+    socket.process_keepalive(msg.sequence_number, msg.probe);
 
     if (msg.ack)
     {
-        socket.process_acknowledgement(*msg.ack);
+        socket.process_acknowledgement(*msg.ack, msg.window, msg.congestion_echo);
+    }
+}
+
+inline
+void multiplexer::process_shutdown(socket_base& socket,
+                                   std::uint16_t type,
+                                   detail::decoder& decoder)
+{
+    header::shutdown msg(type, decoder);
+    socket.process_shutdown(msg.sequence_number);
+
+    if (msg.ack)
+    {
+        socket.process_acknowledgement(*msg.ack, boost::none, 0);
     }
 }
 
@@ -613,14 +2143,68 @@ void multiplexer::process_data(socket_base& socket,
                                detail::decoder& decoder,
                                const boost::system::error_code& error,
                                std::size_t payload_size,
-                               std::shared_ptr<buffer_type> payload)
+                               std::shared_ptr<payload_type> payload)
 {
     header::data msg(type, decoder);
     socket.process_data(error, payload_size, payload, msg.sequence_number);
 
     if (msg.ack)
     {
-        socket.process_acknowledgement(*msg.ack);
+        socket.process_acknowledgement(*msg.ack, msg.window, msg.congestion_echo);
+    }
+}
+
+inline
+void multiplexer::process_compact_data(socket_base& socket,
+                                       std::uint16_t type,
+                                       detail::decoder& decoder,
+                                       const boost::system::error_code& error,
+                                       std::size_t payload_size,
+                                       std::shared_ptr<payload_type> payload)
+{
+    header::compact_data msg(type, decoder);
+
+    // The sequence numbers are expanded before processing the frame moves
+    // them along
+    const auto expected = socket.expected_sequence();
+    if (!expected)
+    {
+        socket.idempotent_start_receive();
+        return;
+    }
+    const auto sequence = header::expand(msg.sequence_number, *expected);
+    boost::optional<ack_sequence_type> ack;
+    if (msg.ack)
+    {
+        ack = header::expand_ack(*msg.ack, socket.last_sent_sequence());
+    }
+
+    socket.process_data(error, payload_size, payload, sequence);
+
+    if (ack)
+    {
+        socket.process_acknowledgement(*ack, msg.window, msg.congestion_echo);
+    }
+}
+
+inline
+void multiplexer::process_compact_ack(socket_base& socket,
+                                      std::uint16_t type,
+                                      detail::decoder& decoder)
+{
+    header::compact_ack msg(type, decoder);
+
+    boost::optional<ack_sequence_type> ack;
+    if (msg.ack)
+    {
+        ack = header::expand_ack(*msg.ack, socket.last_sent_sequence());
+    }
+
+    socket.process_keepalive(boost::none, header::constant::probe_none);
+
+    if (ack)
+    {
+        socket.process_acknowledgement(*ack, msg.window, msg.congestion_echo);
     }
 }
 
@@ -0,0 +1,362 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_PARITY_HPP
+#define MAIDSAFE_CRUX_DETAIL_PARITY_HPP
+
+// Forward error correction with XOR parity. A parity frame follows a group
+// of data frames, and lets the receiver reconstruct any one frame of the
+// group that went missing without waiting for its retransmission.
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <boost/asio/buffer.hpp>
+#include <maidsafe/crux/detail/buffer.hpp>
+#include <maidsafe/crux/detail/constants.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
+#include <maidsafe/crux/detail/sequence_number.hpp>
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+# define MAIDSAFE_CRUX_PARITY_SSE2 1
+#endif
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace parity
+{
+
+// output ^= input. Vectorised with whatever the compiler targets.
+void xor_into(char* output, const char* input, std::size_t size);
+
+} // namespace parity
+
+// The parity payload is the XOR of the payloads of the group, each padded
+// with zeroes to the longest. The XOR of their sizes tells the size of the
+// missing one.
+class parity_encoder
+{
+public:
+    parity_encoder();
+
+    template <typename ConstBufferSequence>
+    void add(const ConstBufferSequence&);
+
+    // Frames added
+    std::size_t count() const;
+    std::uint32_t size_xor() const;
+
+    // The parity payload. Leaves the encoder empty.
+    buffer release();
+
+private:
+    std::size_t count_value;
+    std::uint32_t size_xor_value;
+    buffer data;
+};
+
+// Frames that the receiver keeps for reconstruction, once the remote
+// endpoint is known to send parity frames: the ones it has received last,
+// and the ones that arrived ahead of a missing one.
+class parity_window
+{
+public:
+    using sequence_type = sequence_number<std::uint32_t>;
+    using payload_pointer = std::shared_ptr<payload_buffer>;
+
+    parity_window();
+
+    // Nothing is kept until a parity frame has arrived
+    bool active() const;
+    void activate();
+
+    // Remember a frame that has been handed on
+    void delivered(sequence_type, payload_pointer);
+
+    // Hold back a frame that arrived ahead of the expected one. Returns
+    // false if it is too far ahead.
+    bool hold(sequence_type expected, sequence_type, payload_pointer);
+
+    // Remove the held frame with the sequence number, or return null
+    payload_pointer take(sequence_type);
+
+    // Reconstruct the expected frame from the parity of the group of count
+    // frames starting at first. Returns null unless it is the only frame of
+    // the group that is missing.
+    payload_pointer recover(sequence_type expected,
+                            sequence_type first,
+                            std::size_t count,
+                            std::uint32_t size_xor,
+                            const payload_buffer& parity,
+                            handler_allocator<char>) const;
+
+    void clear();
+
+private:
+    payload_pointer find(sequence_type) const;
+
+private:
+    using entries_type = std::deque<std::pair<sequence_type, payload_pointer>>;
+
+    bool is_active;
+    entries_type recent;
+    entries_type held;
+};
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <algorithm>
+#include <cstring>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace parity
+{
+
+inline void xor_into(char* output, const char* input, std::size_t size)
+{
+    std::size_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + sizeof(__m256i) <= size; i += sizeof(__m256i))
+    {
+        auto* target = reinterpret_cast<__m256i*>(output + i);
+        const auto source = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        _mm256_storeu_si256(target, _mm256_xor_si256(_mm256_loadu_si256(target), source));
+    }
+#elif defined(MAIDSAFE_CRUX_PARITY_SSE2)
+    for (; i + sizeof(__m128i) <= size; i += sizeof(__m128i))
+    {
+        auto* target = reinterpret_cast<__m128i*>(output + i);
+        const auto source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        _mm_storeu_si128(target, _mm_xor_si128(_mm_loadu_si128(target), source));
+    }
+#endif
+
+    // Whole words, then the tail
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+    {
+        std::uint64_t target;
+        std::uint64_t source;
+        std::memcpy(&target, output + i, sizeof(target));
+        std::memcpy(&source, input + i, sizeof(source));
+        target ^= source;
+        std::memcpy(output + i, &target, sizeof(target));
+    }
+    for (; i < size; ++i)
+    {
+        output[i] ^= input[i];
+    }
+}
+
+} // namespace parity
+
+//-----------------------------------------------------------------------------
+// parity_encoder
+//-----------------------------------------------------------------------------
+
+inline parity_encoder::parity_encoder()
+    : count_value(0)
+    , size_xor_value(0)
+{
+}
+
+template <typename ConstBufferSequence>
+void parity_encoder::add(const ConstBufferSequence& buffers)
+{
+    const auto size = boost::asio::buffer_size(buffers);
+    if (data.size() < size) {
+        data.resize(size, 0);
+    }
+
+    std::size_t offset = 0;
+    for (auto i = buffers.begin(); i != buffers.end(); ++i)
+    {
+        const boost::asio::const_buffer part(*i);
+        const auto part_size = boost::asio::buffer_size(part);
+        parity::xor_into(&data[offset],
+                         boost::asio::buffer_cast<const char*>(part),
+                         part_size);
+        offset += part_size;
+    }
+
+    ++count_value;
+    size_xor_value ^= static_cast<std::uint32_t>(size);
+}
+
+inline std::size_t parity_encoder::count() const
+{
+    return count_value;
+}
+
+inline std::uint32_t parity_encoder::size_xor() const
+{
+    return size_xor_value;
+}
+
+inline buffer parity_encoder::release()
+{
+    count_value = 0;
+    size_xor_value = 0;
+    buffer result;
+    result.swap(data);
+    return result;
+}
+
+//-----------------------------------------------------------------------------
+// parity_window
+//-----------------------------------------------------------------------------
+
+inline parity_window::parity_window()
+    : is_active(false)
+{
+}
+
+inline bool parity_window::active() const
+{
+    return is_active;
+}
+
+inline void parity_window::activate()
+{
+    is_active = true;
+}
+
+inline void parity_window::delivered(sequence_type sequence, payload_pointer payload)
+{
+    if (!is_active || !payload)
+        return;
+
+    recent.emplace_back(sequence, std::move(payload));
+    // Older frames belong to groups that have been dealt with
+    if (recent.size() > constant::max_parity_group) {
+        recent.pop_front();
+    }
+
+    // Held frames cannot be behind
+    while (!held.empty() && !(sequence < held.front().first)) {
+        held.pop_front();
+    }
+}
+
+inline bool parity_window::hold(sequence_type expected,
+                                sequence_type sequence,
+                                payload_pointer payload)
+{
+    if (!is_active || !payload)
+        return false;
+
+    const auto distance = expected.distance(sequence);
+    if (distance <= 0 || static_cast<std::size_t>(distance) >= constant::max_parity_group)
+        return false;
+
+    // Kept in order, and retransmissions replace what was held
+    auto i = held.begin();
+    for (; i != held.end() && i->first < sequence; ++i) {}
+    if (i != held.end() && i->first == sequence) {
+        i->second = std::move(payload);
+    }
+    else {
+        held.emplace(i, sequence, std::move(payload));
+    }
+    return true;
+}
+
+inline parity_window::payload_pointer parity_window::take(sequence_type sequence)
+{
+    if (held.empty() || held.front().first != sequence)
+        return nullptr;
+
+    auto payload = std::move(held.front().second);
+    held.pop_front();
+    return payload;
+}
+
+inline parity_window::payload_pointer
+parity_window::recover(sequence_type expected,
+                       sequence_type first,
+                       std::size_t count,
+                       std::uint32_t size_xor,
+                       const payload_buffer& parity,
+                       handler_allocator<char> allocator) const
+{
+    if (count == 0 || count > constant::max_parity_group)
+        return nullptr;
+
+    const auto offset = first.distance(expected);
+    if (offset < 0 || static_cast<std::size_t>(offset) >= count)
+        return nullptr;
+
+    auto result = std::allocate_shared<payload_buffer>(allocator,
+                                                       parity.begin(),
+                                                       parity.end(),
+                                                       allocator);
+    std::uint32_t size = size_xor;
+
+    auto sequence = first;
+    for (std::size_t i = 0; i < count; ++i, ++sequence)
+    {
+        if (sequence == expected)
+            continue;
+
+        auto frame = find(sequence);
+        if (!frame || frame->size() > result->size())
+            return nullptr;
+
+        parity::xor_into(result->data(), frame->data(), frame->size());
+        size ^= static_cast<std::uint32_t>(frame->size());
+    }
+
+    if (size > result->size())
+        return nullptr;
+
+    result->resize(size);
+    return result;
+}
+
+inline void parity_window::clear()
+{
+    recent.clear();
+    held.clear();
+}
+
+inline parity_window::payload_pointer parity_window::find(sequence_type sequence) const
+{
+    for (const auto& entry : recent) {
+        if (entry.first == sequence)
+            return entry.second;
+    }
+    for (const auto& entry : held) {
+        if (entry.first == sequence)
+            return entry.second;
+    }
+    return nullptr;
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_PARITY_HPP
@@ -11,43 +11,66 @@
 #ifndef MAIDSAFE_CRUX_DETAIL_RECEIVE_INPUT_TYPE_HPP
 #define MAIDSAFE_CRUX_DETAIL_RECEIVE_INPUT_TYPE_HPP
 
-#include <functional>
+#include <vector>
 #include <boost/asio/buffer.hpp>
 #include <boost/system/system_error.hpp>
 #include <maidsafe/crux/detail/buffer.hpp>
+#include <maidsafe/crux/detail/function.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
 
 namespace maidsafe { namespace crux { namespace detail {
 
+using mutable_buffers_type
+    = std::vector<boost::asio::mutable_buffer,
+                  handler_allocator<boost::asio::mutable_buffer>>;
+
 struct receive_input_type
 {
     using read_handler_type
-        = std::function<void (const boost::system::error_code&, std::size_t)>;
+        = detail::function<void (const boost::system::error_code&, std::size_t)>;
+
+    using message_handler_type
+        = detail::function<void (const boost::system::error_code&, payload_handle)>;
 
-    read_handler_type                        handler;
-    std::vector<boost::asio::mutable_buffer> buffers;
+    read_handler_type    handler;
+    mutable_buffers_type buffers;
+    // Set instead of the above by receives that take the payload as is
+    message_handler_type message_handler;
 
-    template<class MutableBufferSequence>
-    receive_input_type( const MutableBufferSequence& payload_buffers
-                      , read_handler_type&&          handler);
+    template<class MutableBufferSequence, class ReadHandler>
+    receive_input_type( const MutableBufferSequence&   payload_buffers
+                      , ReadHandler&&                  handler
+                      , const handler_allocator<char>& allocator);
+
+    template<class MessageHandler>
+    receive_input_type( MessageHandler&&               handler
+                      , const handler_allocator<char>& allocator);
 };
 
 }}} // namespace maidsafe::crux::detail
 
 namespace maidsafe { namespace crux { namespace detail {
 
-template<class MutableBufferSequence>
-receive_input_type::receive_input_type( const MutableBufferSequence& payload_buffers
-                                      , read_handler_type&& handler)
-    : handler(std::move(handler))
-    , buffers(boost::asio::buffer_size(payload_buffers))
+template<class MutableBufferSequence, class ReadHandler>
+receive_input_type::receive_input_type( const MutableBufferSequence&   payload_buffers
+                                      , ReadHandler&&                  handler
+                                      , const handler_allocator<char>& allocator)
+    : handler(std::allocator_arg, allocator, std::forward<ReadHandler>(handler))
+    , buffers(allocator)
 {
-    std::size_t i = 0;
     for (const auto& buffer : payload_buffers) {
-        this->buffers[i++] = buffer;
+        this->buffers.push_back(buffer);
     }
 }
 
+template<class MessageHandler>
+receive_input_type::receive_input_type( MessageHandler&&               handler
+                                      , const handler_allocator<char>& allocator)
+    : buffers(allocator)
+    , message_handler(std::allocator_arg, allocator, std::forward<MessageHandler>(handler))
+{
+}
+
 }}} // namespace maidsafe::crux::detail
 
 #endif // ifndef MAIDSAFE_CRUX_DETAIL_RECEIVE_INPUT_TYPE_HPP
-
@@ -18,7 +18,7 @@ namespace maidsafe { namespace crux { namespace detail {
 struct receive_output_type
 {
     boost::system::error_code error;
-    std::shared_ptr<detail::buffer> data;
+    std::shared_ptr<detail::payload_buffer> data;
 };
 
 }}} // namespace maidsafe::crux::detail
@@ -0,0 +1,121 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_RECEIVE_TIMESTAMP_HPP
+#define MAIDSAFE_CRUX_DETAIL_RECEIVE_TIMESTAMP_HPP
+
+// Linux stamps every received datagram with the time it arrived at the
+// socket (SO_TIMESTAMPNS), which leaves out however long it then waited for
+// the io_service. The stamp is only received by the transports that receive
+// with recvmsg. Elsewhere the time of receipt is used instead.
+
+#include <chrono>
+
+#if defined(__linux__)
+# include <sys/socket.h>
+# include <time.h>
+# if defined(SO_TIMESTAMPNS) && defined(SCM_TIMESTAMPNS)
+#  define MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP 1
+# endif
+#endif
+
+#if defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+
+#include <cstddef>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace receive_timestamp
+{
+
+using native_handle_type = int;
+using clock_type = std::chrono::steady_clock;
+
+// Returns false if the kernel does not stamp datagrams
+bool enable(native_handle_type);
+
+// Look for the stamp among the control messages of a received datagram,
+// and leave the arrival time alone if there is none.
+void find(const msghdr&, clock_type::time_point& arrival);
+
+// The stamp is taken from the real time clock, and the steady clock
+// arrival time is found from its age.
+clock_type::time_point to_steady_clock(const timespec&);
+
+// Room for the stamp among the control messages
+const std::size_t space = CMSG_SPACE(sizeof(timespec));
+
+} // namespace receive_timestamp
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <cstring>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace receive_timestamp
+{
+
+inline bool enable(native_handle_type handle)
+{
+    int enable = 1;
+    return ::setsockopt(handle, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0;
+}
+
+inline void find(const msghdr& message, clock_type::time_point& arrival)
+{
+    auto& header_message = const_cast<msghdr&>(message);
+    for (auto header = CMSG_FIRSTHDR(&header_message);
+         header;
+         header = CMSG_NXTHDR(&header_message, header))
+    {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            timespec stamp;
+            std::memcpy(&stamp, CMSG_DATA(header), sizeof(stamp));
+            arrival = to_steady_clock(stamp);
+        }
+    }
+}
+
+inline clock_type::time_point to_steady_clock(const timespec& stamp)
+{
+    using namespace std::chrono;
+
+    timespec now;
+    ::clock_gettime(CLOCK_REALTIME, &now);
+    const auto steady_now = clock_type::now();
+
+    const auto age = seconds(now.tv_sec - stamp.tv_sec)
+                   + nanoseconds(now.tv_nsec - stamp.tv_nsec);
+
+    // The real time clock may have been set back in the meantime
+    if (age < nanoseconds::zero())
+        return steady_now;
+    return steady_now - duration_cast<clock_type::duration>(age);
+}
+
+} // namespace receive_timestamp
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+
+#endif // MAIDSAFE_CRUX_DETAIL_RECEIVE_TIMESTAMP_HPP
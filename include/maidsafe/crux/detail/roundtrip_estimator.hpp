@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_ROUNDTRIP_ESTIMATOR_HPP
+#define MAIDSAFE_CRUX_DETAIL_ROUNDTRIP_ESTIMATOR_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <maidsafe/crux/detail/constants.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+// Smoothed roundtrip time and its variation, as in RFC 6298 section 2.
+// Samples must not be taken from retransmitted packets (Karn's algorithm.)
+class roundtrip_estimator
+{
+public:
+    using duration_type = std::chrono::microseconds;
+
+    roundtrip_estimator();
+
+    void sample(duration_type);
+
+    // No samples have been taken yet
+    bool empty() const;
+
+    duration_type smoothed() const;
+    duration_type variation() const;
+
+    // The initial roundtrip time until the first sample
+    duration_type timeout() const;
+
+private:
+    bool          has_sample;
+    duration_type srtt;
+    duration_type rttvar;
+};
+
+inline roundtrip_estimator::roundtrip_estimator()
+    : has_sample(false)
+    , srtt(duration_type::zero())
+    , rttvar(duration_type::zero())
+{
+}
+
+inline void roundtrip_estimator::sample(duration_type roundtrip)
+{
+    roundtrip = std::max(roundtrip, duration_type::zero());
+
+    if (!has_sample) {
+        has_sample = true;
+        srtt = roundtrip;
+        rttvar = roundtrip / 2;
+        return;
+    }
+
+    // alpha = 1/8, beta = 1/4
+    const auto deviation = (srtt > roundtrip) ? srtt - roundtrip : roundtrip - srtt;
+    rttvar = (3 * rttvar + deviation) / 4;
+    srtt = (7 * srtt + roundtrip) / 8;
+}
+
+inline bool roundtrip_estimator::empty() const
+{
+    return !has_sample;
+}
+
+inline roundtrip_estimator::duration_type roundtrip_estimator::smoothed() const
+{
+    return srtt;
+}
+
+inline roundtrip_estimator::duration_type roundtrip_estimator::variation() const
+{
+    return rttvar;
+}
+
+inline roundtrip_estimator::duration_type roundtrip_estimator::timeout() const
+{
+    if (!has_sample) {
+        return constant::initial_roundtrip_time;
+    }
+    // The clock granularity is taken to be a millisecond
+    return srtt + std::max<duration_type>(std::chrono::milliseconds(1), 4 * rttvar);
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_ROUNDTRIP_ESTIMATOR_HPP
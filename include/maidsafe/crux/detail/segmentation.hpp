@@ -0,0 +1,261 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_SEGMENTATION_HPP
+#define MAIDSAFE_CRUX_DETAIL_SEGMENTATION_HPP
+
+// UDP segmentation offload (Linux 4.18) and generic receive offload
+// (Linux 5.0) let us exchange a run of equal-sized frames with the kernel
+// as one super-datagram. The io_uring transport does not pass control
+// messages, so offload is only used with the plain asio socket.
+
+#if defined(__linux__) && !defined(MAIDSAFE_CRUX_WITH_IO_URING)
+# include <netinet/in.h>
+# include <netinet/udp.h>
+# if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#  define MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD 1
+# endif
+#endif
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/system/error_code.hpp>
+#include <maidsafe/crux/detail/ecn.hpp>
+#include <maidsafe/crux/detail/receive_timestamp.hpp>
+#include <maidsafe/crux/detail/udp_buffers.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace segmentation
+{
+
+using native_handle_type = int;
+using endpoint_type = boost::asio::ip::udp::endpoint;
+
+// Largest number of segments the kernel accepts in one send (UDP_MAX_SEGMENTS)
+const std::size_t max_segments = 64;
+
+// Largest super-datagram the kernel accepts in one send
+const std::size_t max_size = 65507;
+
+// Ask the kernel to deliver coalesced datagrams. Returns false if the
+// kernel does not support it.
+bool enable_receive_offload(native_handle_type);
+
+// Receive the next datagram without blocking. If the datagram was
+// coalesced by the kernel, segment_size is set to the size of each segment
+// (the last may be shorter), otherwise it is set to zero. The kernel drop
+// count is updated if the kernel reports it, the arrival time is the
+// kernel timestamp if there is one, or else now, and the ECN codepoint is
+// not_capable unless the kernel reports another.
+std::size_t receive(native_handle_type,
+                    const std::vector<boost::asio::mutable_buffer>&,
+                    endpoint_type&,
+                    std::size_t& segment_size,
+                    std::uint32_t& kernel_drops,
+                    std::chrono::steady_clock::time_point& arrival,
+                    std::uint8_t& ecn_codepoint,
+                    boost::system::error_code&);
+
+// Send buffers as one super-datagram that the kernel splits into
+// segment_size datagrams. Every segment but the last must be exactly
+// segment_size bytes.
+std::size_t send(native_handle_type,
+                 const std::vector<boost::asio::const_buffer>&,
+                 std::size_t segment_size,
+                 const endpoint_type&,
+                 boost::system::error_code&);
+
+} // namespace segmentation
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <boost/asio/error.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace segmentation
+{
+
+// Scatter/gather array that only allocates for unusually long buffer
+// sequences.
+class io_vectors
+{
+public:
+    template <typename BufferSequence>
+    explicit io_vectors(const BufferSequence& buffers)
+        : count(0)
+    {
+        if (buffers.size() > local_size)
+            dynamic.resize(buffers.size());
+        iovec* output = dynamic.empty() ? local : dynamic.data();
+        for (const auto& buffer : buffers)
+        {
+            output[count].iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(buffer));
+            output[count].iov_len = boost::asio::buffer_size(buffer);
+            ++count;
+        }
+    }
+
+    iovec* data() { return dynamic.empty() ? local : dynamic.data(); }
+    std::size_t size() const { return count; }
+
+private:
+    static const std::size_t local_size = 16;
+    iovec local[local_size];
+    std::vector<iovec> dynamic;
+    std::size_t count;
+};
+
+inline bool enable_receive_offload(native_handle_type handle)
+{
+    int enable = 1;
+    return ::setsockopt(handle, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
+}
+
+inline std::size_t receive(native_handle_type handle,
+                           const std::vector<boost::asio::mutable_buffer>& buffers,
+                           endpoint_type& endpoint,
+                           std::size_t& segment_size,
+                           std::uint32_t& kernel_drops,
+                           std::chrono::steady_clock::time_point& arrival,
+                           std::uint8_t& ecn_codepoint,
+                           boost::system::error_code& error)
+{
+    io_vectors vectors(buffers);
+
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(int))
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+                    + udp_buffers::drop_count_space
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+                    + receive_timestamp::space
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+                    + ecn::space
+#endif
+                    ];
+        cmsghdr align;
+    } control;
+
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_name = endpoint.data();
+    message.msg_namelen = static_cast<socklen_t>(endpoint.capacity());
+    message.msg_iov = vectors.data();
+    message.msg_iovlen = vectors.size();
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    segment_size = 0;
+    auto result = ::recvmsg(handle, &message, MSG_DONTWAIT);
+    if (result < 0)
+    {
+        error = boost::system::error_code(errno, boost::asio::error::get_system_category());
+        return 0;
+    }
+    error = boost::system::error_code();
+    endpoint.resize(message.msg_namelen);
+
+    for (auto header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO)
+        {
+            int size;
+            std::memcpy(&size, CMSG_DATA(header), sizeof(size));
+            segment_size = static_cast<std::size_t>(size);
+        }
+    }
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+    udp_buffers::find_drop_count(message, kernel_drops);
+#else
+    static_cast<void>(kernel_drops);
+#endif
+    arrival = std::chrono::steady_clock::now();
+#if defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+    receive_timestamp::find(message, arrival);
+#endif
+    ecn_codepoint = ecn::not_capable;
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+    ecn::find(message, ecn_codepoint);
+#endif
+    return static_cast<std::size_t>(result);
+}
+
+inline std::size_t send(native_handle_type handle,
+                        const std::vector<boost::asio::const_buffer>& buffers,
+                        std::size_t segment_size,
+                        const endpoint_type& endpoint,
+                        boost::system::error_code& error)
+{
+    io_vectors vectors(buffers);
+
+    union
+    {
+        char buffer[CMSG_SPACE(sizeof(std::uint16_t))];
+        cmsghdr align;
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_name = const_cast<endpoint_type&>(endpoint).data();
+    message.msg_namelen = static_cast<socklen_t>(endpoint.size());
+    message.msg_iov = vectors.data();
+    message.msg_iovlen = vectors.size();
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    auto header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_UDP;
+    header->cmsg_type = UDP_SEGMENT;
+    header->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+    auto size = static_cast<std::uint16_t>(segment_size);
+    std::memcpy(CMSG_DATA(header), &size, sizeof(size));
+
+    auto result = ::sendmsg(handle, &message, MSG_DONTWAIT);
+    if (result < 0)
+    {
+        error = boost::system::error_code(errno, boost::asio::error::get_system_category());
+        return 0;
+    }
+    error = boost::system::error_code();
+    return static_cast<std::size_t>(result);
+}
+
+} // namespace segmentation
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
+#endif // MAIDSAFE_CRUX_DETAIL_SEGMENTATION_HPP
@@ -11,11 +11,14 @@
 #ifndef MAIDSAFE_CRUX_DETAIL_SERVICE_HPP
 #define MAIDSAFE_CRUX_DETAIL_SERVICE_HPP
 
+#include <algorithm>
 #include <memory>
 #include <map>
 #include <random>
+#include <boost/optional.hpp>
 #include <boost/asio/io_service.hpp>
 #include <maidsafe/crux/endpoint.hpp>
+#include <maidsafe/crux/detail/cookie.hpp>
 
 namespace maidsafe
 {
@@ -41,6 +44,12 @@ public:
 
     std::uint32_t random();
 
+    // Resumption tickets issued by remote endpoints, by remote endpoint. A
+    // ticket is good for one connection, so taking it removes it.
+    void store_ticket(const endpoint_type& remote_endpoint,
+                      const cookie_generator::value_type& ticket);
+    boost::optional<cookie_generator::value_type> take_ticket(const endpoint_type& remote_endpoint);
+
     // Required by boost::asio::basic_io_object
     struct implementation_type {};
     void construct(implementation_type& /*impl*/) {}
@@ -55,6 +64,15 @@ private:
 private:
     multiplexer_map multiplexers;
 
+    // At most max_stored_tickets, the oldest is evicted to make room
+    struct ticket_entry
+    {
+        cookie_generator::value_type ticket;
+        std::uint32_t timestamp;
+    };
+    using ticket_map = std::map<endpoint_type, ticket_entry>;
+    ticket_map tickets;
+
     std::mt19937 generator;
     std::uniform_int_distribution<std::uint32_t> distribution;
 };
@@ -143,6 +161,47 @@ inline std::uint32_t service::random()
     return distribution(generator);
 }
 
+inline void service::store_ticket(const endpoint_type& remote_endpoint,
+                                  const cookie_generator::value_type& ticket)
+{
+    // FIXME: Thread-safety
+    const auto now = cookie_generator::clock();
+    if (tickets.size() >= constant::max_stored_tickets
+        && tickets.find(remote_endpoint) == tickets.end())
+    {
+        auto oldest = std::min_element(tickets.begin(),
+                                       tickets.end(),
+                                       [now] (const ticket_map::value_type& lhs,
+                                              const ticket_map::value_type& rhs)
+                                       {
+                                           return std::uint32_t(now - lhs.second.timestamp)
+                                               > std::uint32_t(now - rhs.second.timestamp);
+                                       });
+        tickets.erase(oldest);
+    }
+    tickets[remote_endpoint] = ticket_entry{ticket, now};
+}
+
+inline boost::optional<cookie_generator::value_type>
+service::take_ticket(const endpoint_type& remote_endpoint)
+{
+    // FIXME: Thread-safety
+    auto where = tickets.find(remote_endpoint);
+    if (where == tickets.end())
+        return boost::none;
+
+    const auto entry = where->second;
+    tickets.erase(where);
+
+    const auto lifetime = static_cast<std::uint32_t>(constant::ticket_lifetime.count());
+    if (std::uint32_t(cookie_generator::clock() - entry.timestamp) >= lifetime)
+    {
+        // The remote endpoint would reject it
+        return boost::none;
+    }
+    return entry.ticket;
+}
+
 } // namespace detail
 } // namespace crux
 } // namespace maidsafe
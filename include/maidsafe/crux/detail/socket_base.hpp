@@ -12,14 +12,20 @@
 #define MAIDSAFE_CRUX_DETAIL_SOCKET_BASE_HPP
 
 #include <cstdint>
+#include <chrono>
 #include <memory>
 #include <queue>
 #include <utility>
 
+#include <boost/optional.hpp>
 #include <boost/asio/socket_base.hpp>
 #include <boost/asio/ip/udp.hpp>
 
 #include <maidsafe/crux/detail/buffer.hpp>
+#include <maidsafe/crux/detail/cookie.hpp>
+#include <maidsafe/crux/detail/ecn.hpp>
+#include <maidsafe/crux/detail/header_constants.hpp>
+#include <maidsafe/crux/detail/receive_input_type.hpp>
 #include <maidsafe/crux/detail/sequence_number.hpp>
 
 namespace maidsafe
@@ -34,7 +40,12 @@ class socket_base : public boost::asio::socket_base
 public:
     using endpoint_type = boost::asio::ip::udp::endpoint;
 
-    socket_base() : state_value(connectivity::closed) {}
+    socket_base()
+        : state_value(connectivity::closed)
+        , local_connection_id(header::constant::connection_id_none)
+        , remote_connection_id(header::constant::connection_id_none)
+        , remote_version(0)
+    {}
     virtual ~socket_base() {}
 
     endpoint_type remote_endpoint() const { return remote; }
@@ -60,26 +71,80 @@ protected:
 
     void remote_endpoint(const endpoint_type& r) { remote = r; }
 
-    virtual std::vector<boost::asio::mutable_buffer>* get_recv_buffers() = 0;
+    virtual mutable_buffers_type* get_recv_buffers() = 0;
 
+    // The connection id is the one that the remote endpoint has assigned to
+    // the connection, and the message is the payload that came along with
+    // the handshake, if any.
     virtual void process_handshake(sequence_type initial,
-                                   endpoint_type remote_endpoint) = 0;
+                                   endpoint_type remote_endpoint,
+                                   std::uint32_t connection_id,
+                                   std::shared_ptr<payload_buffer> message) = 0;
 
-    virtual void process_acknowledgement(const ack_sequence_type& ack) = 0;
+    // The window is the receive window advertised by the remote endpoint,
+    // in units of header::constant::window_unit, and the congestion echo
+    // goes along with it.
+    virtual void process_acknowledgement(const ack_sequence_type& ack,
+                                         boost::optional<std::uint16_t> window,
+                                         std::uint16_t congestion_echo) = 0;
 
     virtual void process_data(const boost::system::error_code&,
                               std::size_t bytes_transferred,
-                              std::shared_ptr<detail::buffer>,
+                              std::shared_ptr<detail::payload_buffer>,
                               sequence_type) = 0;
 
-    virtual void process_keepalive(sequence_type) = 0;
+    // No sequence number for an acknowledgement that takes up none
+    virtual void process_keepalive(boost::optional<sequence_type>, std::uint16_t probe) = 0;
+
+    // Parity of the count data frames starting at first
+    virtual void process_parity(sequence_type first,
+                                std::size_t count,
+                                std::uint32_t size_xor,
+                                std::shared_ptr<payload_buffer> parity) = 0;
+
+    // The remote endpoint sends nothing after the shutdown
+    virtual void process_shutdown(sequence_type) = 0;
+
+    // Cookie sent by an acceptor in reply to a handshake, or none if the
+    // cookie was malformed
+    virtual void process_cookie(endpoint_type,
+                                boost::optional<cookie_generator::value_type>) = 0;
+
+    // Resumption ticket sent by an acceptor on an established connection,
+    // or none if the ticket was malformed
+    virtual void process_ticket(boost::optional<cookie_generator::value_type>) = 0;
+    // Most that the remote endpoint may have in flight towards us
+    virtual std::size_t max_receive_window() const = 0;
+
+    // What the truncated sequence numbers of compact frames are expanded
+    // from: the next one expected from the remote endpoint, unless nothing
+    // has arrived yet, and the last one that we have used.
+    virtual boost::optional<sequence_type> expected_sequence() = 0;
+    virtual sequence_type last_sent_sequence() const = 0;
+
     virtual void idempotent_start_receive() = 0;
+    virtual bool receiving() const = 0;
 
     virtual void close() = 0;
 
 protected:
     endpoint_type remote;
     connectivity state_value;
+    // Assigned by the multiplexer, and by the remote endpoint respectively
+    std::uint32_t local_connection_id;
+    std::uint32_t remote_connection_id;
+    // Header version of the remote endpoint, as told by its handshake. Set
+    // by the multiplexer.
+    std::uint16_t remote_version;
+    // When the frame being processed arrived, as stamped by the kernel where
+    // it does so. Set by the multiplexer.
+    std::chrono::steady_clock::time_point arrival;
+    // Where the frame being processed came from, which differs from the
+    // remote endpoint if the remote endpoint has moved. Set by the
+    // multiplexer.
+    endpoint_type sender;
+    // Marks received are counted by the multiplexer
+    congestion_statistics congestion;
 };
 
 }}} // namespace maidsafe::crux::detail
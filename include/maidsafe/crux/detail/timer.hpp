@@ -12,6 +12,8 @@
 #define MAIDSAFE_CRUX_DETAIL_PERIODIC_TIMER_HPP
 
 #include <boost/asio/steady_timer.hpp>
+#include <maidsafe/crux/detail/function.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
 
 namespace maidsafe
 {
@@ -22,7 +24,7 @@ namespace detail
 
 class timer {
 public:
-    using handler_type  = std::function<void()>;
+    using handler_type  = detail::function<void()>;
     using timer_type    = boost::asio::steady_timer;
     using duration_type = timer_type::duration;
 
@@ -70,6 +72,7 @@ private:
     handler_type  handler;
 
     std::shared_ptr<bool> was_destroyed;
+    std::shared_ptr<handler_memory> memory;
 };
 
 } // namespace detail
@@ -88,6 +91,7 @@ timer::timer(boost::asio::io_service& ios)
     : state(stopped)
     , asio_timer(ios)
     , was_destroyed(std::make_shared<bool>(false))
+    , memory(std::make_shared<handler_memory>())
 {}
 
 template<class HandlerType>
@@ -97,6 +101,7 @@ timer::timer( boost::asio::io_service& ios
     , asio_timer(ios)
     , handler(std::forward<HandlerType>(handler))
     , was_destroyed(std::make_shared<bool>(false))
+    , memory(std::make_shared<handler_memory>())
 {}
 
 inline
@@ -161,11 +166,11 @@ void timer::do_start() {
 
     auto was_destroyed_copy = was_destroyed;
 
-    asio_timer.async_wait(
+    asio_timer.async_wait(make_allocation_handler(memory,
             [=](const boost::system::error_code&) {
               if (*was_destroyed_copy) return;
               do_handle_tick();
-            });
+            }));
 }
 
 inline void timer::do_handle_tick() {
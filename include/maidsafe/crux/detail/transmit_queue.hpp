@@ -11,66 +11,208 @@
 #ifndef MAIDSAFE_CRUX_DETAIL_TRANSMIT_QUEUE_HPP
 #define MAIDSAFE_CRUX_DETAIL_TRANSMIT_QUEUE_HPP
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <limits>
 #include <map>
+#include <vector>
+#include <boost/none.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <maidsafe/crux/detail/roundtrip_estimator.hpp>
 #include <maidsafe/crux/detail/sequence_number.hpp>
 #include <maidsafe/crux/detail/timer.hpp>
 #include <maidsafe/crux/detail/constants.hpp>
+#include <maidsafe/crux/detail/function.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
 
 namespace maidsafe { namespace crux { namespace detail {
 
+// How often and for how long an entry is transmitted before it fails with
+// timed_out. The timeout doubles after every transmission up to the maximum.
+struct retransmission_schedule {
+    // Fixed period without limits
+    retransmission_schedule();
+
+    retransmission_schedule( std::chrono::milliseconds initial_timeout
+                           , std::chrono::milliseconds max_timeout
+                           , std::size_t               max_attempts
+                           , std::chrono::milliseconds deadline);
+
+    std::chrono::milliseconds initial_timeout;
+    std::chrono::milliseconds max_timeout;
+    // Transmissions, including the first one
+    std::size_t               max_attempts;
+    // Counted from the first transmission
+    std::chrono::milliseconds deadline;
+};
+
 // FIXME: I'm not sure about the nomenclature here, feel free to change it.
 
 template<typename Index> class transmit_queue {
 private:
     using index_type = Index;
     using duration_type = typename detail::timer::duration_type;
+    using clock_type = std::chrono::steady_clock;
 
 public:
-    using iteration_handler = std::function<void(const boost::system::error_code&, std::size_t)>;
-    using iteration_step    = std::function<void(iteration_handler)>;
+    using iteration_handler = detail::function<void(const boost::system::error_code&, std::size_t)>;
+    // The step is told which of the sequence numbers of the entry to send,
+    // as the offsets [first, last) from its index. Those that have already
+    // been acknowledged are not sent again.
+    using iteration_step    = detail::function<void(std::size_t, std::size_t, iteration_handler)>;
+    using frame_sizes_type  = std::vector<std::size_t, handler_allocator<std::size_t>>;
 
 private:
     struct entry_type {
+        explicit entry_type(const handler_allocator<char>& allocator)
+            : frame_sizes(allocator)
+        {}
+
+        std::size_t       count;
+        std::size_t       acknowledged;
+        // Sent in the current transmission, counting the acknowledged ones
+        std::size_t       sent;
         std::size_t       buffer_size;
+        // Of every sequence number of a batch, and empty otherwise
+        frame_sizes_type  frame_sizes;
+        // Not sent at once, because the window did not allow it
+        bool              paced;
         duration_type     period;
+        retransmission_schedule schedule;
+        std::size_t       attempts;
+        clock_type::time_point started;
         iteration_step    step;
         iteration_handler handler;
     };
 
-    // Shared pointer used because lambdas don't support move semantics in c++11
-    using entries_type = std::map<index_type, std::shared_ptr<entry_type>>;
+    // Indices wrap around. The outstanding ones are never half their range
+    // apart, so they are ordered from the oldest even across the wrap.
+    struct index_less {
+        bool operator()(index_type lhs, index_type rhs) const {
+            return sequence_number<index_type>(lhs) < sequence_number<index_type>(rhs);
+        }
+    };
+
+    using entries_type = std::map<index_type,
+                                  entry_type,
+                                  index_less,
+                                  handler_allocator<std::pair<const index_type, entry_type>>>;
 
 public:
-    transmit_queue(boost::asio::io_service&);
+    transmit_queue(boost::asio::io_service&, std::shared_ptr<handler_memory>);
 
+    template <typename Step, typename Handler>
     void push( index_type
              , std::size_t buffer_size
-             , iteration_step
-             , iteration_handler);
+             , Step&&
+             , Handler&&);
 
-    void apply_ack(index_type);
-
-    void shutdown();
+    // Push an entry that is transmitted according to the schedule
+    template <typename Step, typename Handler>
+    void push( index_type
+             , std::size_t buffer_size
+             , const retransmission_schedule&
+             , Step&&
+             , Handler&&);
+
+    // Push a batch that spans consecutive sequence numbers starting at the
+    // index, one for each of the frame sizes. The frames are sent as far as
+    // the receive window allows, and the rest as acknowledgements make room
+    // for them. The entry completes when the last of them has been
+    // acknowledged, and its handler is passed the number of acknowledged
+    // sequence numbers rather than a size.
+    template <typename Step, typename Handler>
+    void push_batch( index_type
+                   , frame_sizes_type
+                   , Step&&
+                   , Handler&&);
+
+    // Acknowledgements are cumulative within an entry. An entry that was
+    // transmitted only once gives a roundtrip sample when it completes,
+    // measured up to when the acknowledgement arrived.
+    void apply_ack(index_type, clock_type::time_point arrival);
+
+    // Frames larger than what is left of the receive window advertised by
+    // the remote endpoint are held back. The first of them is still sent
+    // when the retransmission timer expires, which serves as a probe in case
+    // a window update has been lost.
+    void set_window(std::size_t);
+
+    // Send the active entry again now rather than when the timer expires
+    void retransmit();
+
+    // Abort all entries with the error. No entries may be pushed after.
+    void shutdown(const boost::system::error_code& = boost::asio::error::operation_aborted);
 
     bool empty() const;
     std::size_t size() const;
 
+    roundtrip_estimator& roundtrip();
+    const roundtrip_estimator& roundtrip() const;
+
 private:
+    template <typename Step, typename Handler>
+    void push( index_type
+             , std::size_t count
+             , std::size_t buffer_size
+             , frame_sizes_type
+             , const retransmission_schedule&
+             , Step&&
+             , Handler&&);
+
     void on_timer_tick();
     void start_step(typename entries_type::iterator);
+    void start_or_wait(typename entries_type::iterator);
+    void send_frames(typename entries_type::iterator, bool is_attempt);
+    void resume();
+    void process_step(index_type, bool is_attempt, const boost::system::error_code&, std::size_t);
+    bool is_expired(const entry_type&) const;
+    static std::chrono::milliseconds elapsed(const entry_type&);
+    static std::size_t frame_size(const entry_type&, std::size_t);
+    static std::size_t result(const entry_type&);
+    void abort(typename entries_type::iterator, const boost::system::error_code&);
 
 private:
     boost::asio::io_service&       ios;
+    handler_allocator<char>        allocator;
     entries_type                   entries;
     detail::timer                  timer;
     std::shared_ptr<boost::none_t> shutdown_indicator;
+    std::size_t                    window;
+    bool                           is_blocked;
+    roundtrip_estimator            roundtrip_value;
 };
 
+inline retransmission_schedule::retransmission_schedule()
+    : initial_timeout(constant::initial_roundtrip_time)
+    , max_timeout(constant::initial_roundtrip_time)
+    , max_attempts(std::numeric_limits<std::size_t>::max())
+    , deadline(std::chrono::milliseconds::max())
+{ }
+
+inline retransmission_schedule::retransmission_schedule
+    ( std::chrono::milliseconds initial_timeout
+    , std::chrono::milliseconds max_timeout
+    , std::size_t               max_attempts
+    , std::chrono::milliseconds deadline)
+    : initial_timeout(initial_timeout)
+    , max_timeout(std::max(initial_timeout, max_timeout))
+    , max_attempts(max_attempts)
+    , deadline(deadline)
+{ }
+
 template<typename Index>
-transmit_queue<Index>::transmit_queue(boost::asio::io_service& ios)
+transmit_queue<Index>::transmit_queue(boost::asio::io_service& ios,
+                                      std::shared_ptr<handler_memory> memory)
     : ios(ios)
+    , allocator(std::move(memory))
+    , entries(allocator)
     , timer(ios, [=]() { on_timer_tick(); })
     , shutdown_indicator(std::make_shared<boost::none_t>())
+    , window(std::numeric_limits<std::size_t>::max())
+    , is_blocked(false)
 { }
 
 template<typename Index>
@@ -80,7 +222,42 @@ void transmit_queue<Index>::on_timer_tick()
         return;
     }
 
-    start_step(entries.begin());
+    auto entry_i = entries.begin();
+
+    if (is_expired(entry_i->second)) {
+        return abort(entry_i, boost::asio::error::timed_out);
+    }
+
+    start_step(entry_i);
+}
+
+template<typename Index>
+std::chrono::milliseconds transmit_queue<Index>::elapsed(const entry_type& entry)
+{
+    // Milliseconds, so that an unlimited deadline does not overflow
+    return std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now()
+                                                                 - entry.started);
+}
+
+template<typename Index>
+bool transmit_queue<Index>::is_expired(const entry_type& entry) const
+{
+    if (entry.attempts >= entry.schedule.max_attempts) {
+        return true;
+    }
+    return entry.attempts > 0 && elapsed(entry) >= entry.schedule.deadline;
+}
+
+template<typename Index>
+std::size_t transmit_queue<Index>::frame_size(const entry_type& entry, std::size_t offset)
+{
+    return entry.frame_sizes.empty() ? entry.buffer_size : entry.frame_sizes[offset];
+}
+
+template<typename Index>
+std::size_t transmit_queue<Index>::result(const entry_type& entry)
+{
+    return entry.frame_sizes.empty() ? entry.buffer_size : entry.acknowledged;
 }
 
 template<typename Index>
@@ -94,17 +271,55 @@ std::size_t transmit_queue<Index>::size() const {
 }
 
 template<typename Index>
-void transmit_queue<Index>::apply_ack(index_type index)
+roundtrip_estimator& transmit_queue<Index>::roundtrip() {
+    return roundtrip_value;
+}
+
+template<typename Index>
+const roundtrip_estimator& transmit_queue<Index>::roundtrip() const {
+    return roundtrip_value;
+}
+
+template<typename Index>
+void transmit_queue<Index>::apply_ack(index_type index,
+                                      clock_type::time_point arrival)
 {
-    auto entry_i = entries.find(index);
+    auto entry_i = entries.upper_bound(index);
 
-    if (entry_i == entries.end()) {
+    if (entry_i == entries.begin()) {
+        return;
+    }
+    --entry_i;
+
+    auto& entry = entry_i->second;
+    const std::size_t acknowledged = static_cast<index_type>(index - entry_i->first) + 1;
+
+    if (acknowledged > entry.count) {
+        return;
+    }
+    if (acknowledged < entry.count) {
+        if (acknowledged > entry.acknowledged) {
+            entry.acknowledged = acknowledged;
+            entry.sent = std::max(entry.sent, acknowledged);
+
+            // The acknowledged frames no longer take up the window
+            if (entry_i == entries.begin()) {
+                resume();
+            }
+        }
         return;
     }
 
     bool is_active = entry_i == entries.begin();
 
-    std::shared_ptr<entry_type> entry = std::move(entry_i->second);
+    if (entry.attempts == 1 && !entry.paced) {
+        roundtrip_value.sample(std::chrono::duration_cast<roundtrip_estimator::duration_type>(
+            arrival - entry.started));
+    }
+
+    entry.acknowledged = acknowledged;
+    auto handler = std::move(entry.handler);
+    auto buffer_size = result(entry);
 
     entries.erase(entry_i);
 
@@ -112,15 +327,54 @@ void transmit_queue<Index>::apply_ack(index_type index)
         timer.stop();
 
         if (!entries.empty()) {
-            start_step(entries.begin());
+            start_or_wait(entries.begin());
         }
     }
 
-    entry->handler(boost::system::error_code(), entry->buffer_size);
+    handler(boost::system::error_code(), buffer_size);
+}
+
+template<typename Index>
+void transmit_queue<Index>::set_window(std::size_t bytes)
+{
+    window = bytes;
+    resume();
+}
+
+template<typename Index>
+void transmit_queue<Index>::resume()
+{
+    if (entries.empty()) {
+        return;
+    }
+
+    auto entry_i = entries.begin();
+    auto& entry = entry_i->second;
+
+    if (is_blocked) {
+        if (frame_size(entry, entry.acknowledged) <= window) {
+            timer.stop();
+            start_or_wait(entry_i);
+        }
+    }
+    else if (entry.attempts > 0) {
+        send_frames(entry_i, false);
+    }
+}
+
+template<typename Index>
+void transmit_queue<Index>::retransmit()
+{
+    if (entries.empty() || is_blocked) {
+        return;
+    }
+
+    timer.stop();
+    start_step(entries.begin());
 }
 
 template<typename Index>
-void transmit_queue<Index>::shutdown() {
+void transmit_queue<Index>::shutdown(const boost::system::error_code& error) {
     shutdown_indicator.reset();
 
     timer.stop();
@@ -128,57 +382,245 @@ void transmit_queue<Index>::shutdown() {
     auto moved_entries = std::move(entries);
 
     for (auto& entry_pair : moved_entries) {
-        auto entry = std::move(entry_pair.second);
+        auto& entry = entry_pair.second;
 
-        ios.post([entry]() {
-            entry->handler(boost::asio::error::operation_aborted, entry->buffer_size);
-            });
+        ios.post(boost::asio::detail::bind_handler(std::move(entry.handler),
+                                                   error,
+                                                   result(entry)));
     }
 }
 
 template<typename Index>
-void transmit_queue<Index>::push( index_type        index
-                                , std::size_t       buffer_size
-                                , iteration_step    step
-                                , iteration_handler handler)
+template<typename Step, typename Handler>
+void transmit_queue<Index>::push( index_type  index
+                                , std::size_t buffer_size
+                                , Step&&      step
+                                , Handler&&   handler)
+{
+    push(index,
+         buffer_size,
+         retransmission_schedule(),
+         std::forward<Step>(step),
+         std::forward<Handler>(handler));
+}
+
+template<typename Index>
+template<typename Step, typename Handler>
+void transmit_queue<Index>::push( index_type                     index
+                                , std::size_t                    buffer_size
+                                , const retransmission_schedule& schedule
+                                , Step&&                         step
+                                , Handler&&                      handler)
+{
+    push(index,
+         1,
+         buffer_size,
+         frame_sizes_type(allocator),
+         schedule,
+         std::forward<Step>(step),
+         std::forward<Handler>(handler));
+}
+
+template<typename Index>
+template<typename Step, typename Handler>
+void transmit_queue<Index>::push_batch( index_type       index
+                                      , frame_sizes_type frame_sizes
+                                      , Step&&           step
+                                      , Handler&&        handler)
+{
+    const auto count = frame_sizes.size();
+    std::size_t buffer_size = 0;
+    for (auto size : frame_sizes) {
+        buffer_size += size;
+    }
+
+    push(index,
+         count,
+         buffer_size,
+         std::move(frame_sizes),
+         retransmission_schedule(),
+         std::forward<Step>(step),
+         std::forward<Handler>(handler));
+}
+
+template<typename Index>
+template<typename Step, typename Handler>
+void transmit_queue<Index>::push( index_type                     index
+                                , std::size_t                    count
+                                , std::size_t                    buffer_size
+                                , frame_sizes_type               frame_sizes
+                                , const retransmission_schedule& schedule
+                                , Step&&                         step
+                                , Handler&&                      handler)
 {
+    assert(count > 0);
+    assert(schedule.max_attempts > 0);
+
     bool was_empty = entries.empty();
 
-    auto insert_result = entries.insert(std::make_pair(index, std::make_shared<entry_type>()));
+    auto insert_result = entries.emplace(index, entry_type(allocator));
 
     if (!insert_result.second) {
-        return ios.post([=]() {
-                handler(boost::asio::error::already_started, 0);
-                });
+        return ios.post(boost::asio::detail::bind_handler(std::forward<Handler>(handler),
+                                                          boost::asio::error::already_started,
+                                                          0));
     }
 
-    auto& entry       = *insert_result.first->second;
-    entry.buffer_size = buffer_size;
-    entry.period      = constant::initial_roundtrip_time;
-    entry.step        = std::move(step);
-    entry.handler     = std::move(handler);
+    auto& entry        = insert_result.first->second;
+    entry.count        = count;
+    entry.acknowledged = 0;
+    entry.sent         = 0;
+    entry.buffer_size  = buffer_size;
+    entry.frame_sizes  = std::move(frame_sizes);
+    entry.paced        = false;
+    entry.period       = schedule.initial_timeout;
+    entry.schedule     = schedule;
+    entry.attempts     = 0;
+    entry.step         = iteration_step(std::allocator_arg, allocator, std::forward<Step>(step));
+    entry.handler      = iteration_handler(std::allocator_arg,
+                                           allocator,
+                                           std::forward<Handler>(handler));
 
     if (was_empty) {
-        start_step(insert_result.first);
+        start_or_wait(insert_result.first);
     }
 }
 
 template<typename Index>
 void transmit_queue<Index>::start_step(typename entries_type::iterator entry_i) {
-    auto entry = entry_i->second;
+    auto& entry = entry_i->second;
+
+    if (entry.attempts++ == 0) {
+        entry.started = clock_type::now();
+    }
+
+    // Everything that has not been acknowledged is sent again
+    entry.sent = entry.acknowledged;
+    send_frames(entry_i, true);
+}
+
+template<typename Index>
+void transmit_queue<Index>::send_frames( typename entries_type::iterator entry_i
+                                       , bool is_attempt)
+{
+    auto& entry = entry_i->second;
+
+    // Frames that have not been acknowledged yet take up the window too
+    std::size_t credit = window;
+    for (auto i = entry.acknowledged; i < entry.sent && credit > 0; ++i) {
+        credit -= std::min(credit, frame_size(entry, i));
+    }
+
+    const auto first = entry.sent;
+    auto last = first;
+    for (; last < entry.count && frame_size(entry, last) <= credit; ++last) {
+        credit -= frame_size(entry, last);
+    }
+
+    if (last == first) {
+        if (!is_attempt || first == entry.count) {
+            return;
+        }
+        // Probe with the first frame regardless
+        ++last;
+    }
+    if (last < entry.count) {
+        entry.paced = true;
+    }
+    entry.sent = last;
+
+    // The entry is looked up again when the step completes, because it may
+    // have been acknowledged (or the queue destroyed) in the meantime.
+    auto index = entry_i->first;
 
     std::weak_ptr<boost::none_t> shutdown_guard = shutdown_indicator;
 
-    entry->step([=]( const boost::system::error_code& error
-                   , std::size_t bytes_transferred) {
-                   if (!shutdown_guard.lock() || error) {
-                       return entry->handler(error, bytes_transferred);
+    entry.step(first,
+               last,
+               iteration_handler(std::allocator_arg, allocator,
+               [=]( const boost::system::error_code& error
+                  , std::size_t bytes_transferred) {
+                   if (!shutdown_guard.lock()) {
+                       // Handlers have already been aborted by shutdown.
+                       return;
                    }
-                   // FIXME: Period should be = 
-                   //        max(0, entry->period - duration of this step)
-                   this->timer.set_period(entry->period);
-                   this->timer.start();
-               });
+                   this->process_step(index, is_attempt, error, bytes_transferred);
+               }));
+}
+
+template<typename Index>
+void transmit_queue<Index>::start_or_wait(typename entries_type::iterator entry_i) {
+    auto& entry = entry_i->second;
+    is_blocked = frame_size(entry, entry.acknowledged) > window;
+
+    if (is_blocked) {
+        timer.set_period(entry_i->second.period);
+        timer.start();
+        return;
+    }
+    start_step(entry_i);
+}
+
+template<typename Index>
+void transmit_queue<Index>::process_step( index_type                       index
+                                        , bool                             is_attempt
+                                        , const boost::system::error_code& error
+                                        , std::size_t                      bytes_transferred)
+{
+    auto entry_i = entries.find(index);
+
+    if (entry_i == entries.end()) {
+        return;
+    }
+
+    if (error) {
+        if (entry_i->second.frame_sizes.empty()) {
+            entry_i->second.buffer_size = bytes_transferred;
+        }
+        return abort(entry_i, error);
+    }
+
+    // Frames sent as the window opened are covered by the timer of the
+    // transmission they belong to
+    if (!is_attempt) {
+        return;
+    }
+
+    // FIXME: Period should be = 
+    //        max(0, entry->period - duration of this step)
+    auto& entry = entry_i->second;
+    duration_type period = entry.period;
+    entry.period = std::min<duration_type>(2 * entry.period, entry.schedule.max_timeout);
+
+    // Wake up in time to report that the deadline has passed
+    const auto remaining = entry.schedule.deadline - std::min(elapsed(entry),
+                                                              entry.schedule.deadline);
+    if (remaining < std::chrono::duration_cast<std::chrono::milliseconds>(period)) {
+        period = remaining;
+    }
+
+    timer.set_period(period);
+    timer.start();
+}
+
+template<typename Index>
+void transmit_queue<Index>::abort( typename entries_type::iterator entry_i
+                                 , const boost::system::error_code& error)
+{
+    auto handler = std::move(entry_i->second.handler);
+    bool is_active = entry_i == entries.begin();
+    const auto bytes_transferred = result(entry_i->second);
+
+    entries.erase(entry_i);
+
+    if (is_active) {
+        timer.stop();
+
+        if (!entries.empty()) {
+            start_or_wait(entries.begin());
+        }
+    }
+    handler(error, bytes_transferred);
 }
 
 }}} // namespace maidsafe::crux::detail
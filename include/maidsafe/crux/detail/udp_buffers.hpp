@@ -0,0 +1,170 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_UDP_BUFFERS_HPP
+#define MAIDSAFE_CRUX_DETAIL_UDP_BUFFERS_HPP
+
+// The kernel buffers of the UDP socket that a multiplexer shares between
+// its sockets. Linux reports how many datagrams it has dropped because the
+// receive buffer was full along with every received datagram (SO_RXQ_OVFL),
+// which tells such drops apart from loss in the network. It is only
+// received by the transports that receive with recvmsg.
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <boost/asio/socket_base.hpp>
+#include <boost/system/error_code.hpp>
+
+#if defined(__linux__)
+# include <sys/socket.h>
+# if defined(SO_RXQ_OVFL)
+#  define MAIDSAFE_CRUX_HAS_DROP_COUNT 1
+# endif
+#endif
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+struct udp_statistics
+{
+    udp_statistics()
+        : kernel_drops(0)
+        , receive_buffer_size(0)
+        , send_buffer_size(0)
+    {}
+
+    // Datagrams that the kernel dropped because the receive buffer was
+    // full, as last reported. Wraps around, and stays zero where the kernel
+    // does not report it.
+    std::uint32_t kernel_drops;
+
+    // Comparable to the sizes asked for, without the bookkeeping overhead
+    // that Linux adds
+    std::size_t receive_buffer_size;
+    std::size_t send_buffer_size;
+};
+
+namespace udp_buffers
+{
+
+// Ask for both buffers to be the given size. The system limit is bypassed
+// where we are permitted to (SO_RCVBUFFORCE needs CAP_NET_ADMIN on Linux.)
+template <typename Socket>
+void resize(Socket&, std::size_t bytes);
+
+// Fill in the buffer sizes of the statistics
+template <typename Socket>
+void get_sizes(Socket&, udp_statistics&);
+
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+
+using native_handle_type = int;
+
+// Returns false if the kernel does not report drops
+bool enable_drop_count(native_handle_type);
+
+// Look for the drop count among the control messages of a received
+// datagram. The kernel leaves it out as long as nothing has been dropped.
+void find_drop_count(const msghdr&, std::uint32_t& kernel_drops);
+
+// Room for the drop count among the control messages
+const std::size_t drop_count_space = CMSG_SPACE(sizeof(std::uint32_t));
+
+#endif // defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+
+} // namespace udp_buffers
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <cstring>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+namespace udp_buffers
+{
+
+template <typename Socket>
+void resize(Socket& socket, std::size_t bytes)
+{
+    const int size = static_cast<int>(std::min<std::size_t>(bytes, 0x7FFFFFFF));
+
+#if defined(__linux__) && defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+    const auto handle = socket.native_handle();
+    const bool receive_forced
+        = ::setsockopt(handle, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == 0;
+    const bool send_forced
+        = ::setsockopt(handle, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) == 0;
+#else
+    const bool receive_forced = false;
+    const bool send_forced = false;
+#endif
+
+    // Otherwise capped by the system limit
+    boost::system::error_code error;
+    if (!receive_forced)
+        socket.set_option(boost::asio::socket_base::receive_buffer_size(size), error);
+    if (!send_forced)
+        socket.set_option(boost::asio::socket_base::send_buffer_size(size), error);
+}
+
+template <typename Socket>
+void get_sizes(Socket& socket, udp_statistics& statistics)
+{
+    boost::system::error_code error;
+
+    boost::asio::socket_base::receive_buffer_size receive_size;
+    socket.get_option(receive_size, error);
+    statistics.receive_buffer_size = error ? 0 : static_cast<std::size_t>(receive_size.value());
+
+    boost::asio::socket_base::send_buffer_size send_size;
+    socket.get_option(send_size, error);
+    statistics.send_buffer_size = error ? 0 : static_cast<std::size_t>(send_size.value());
+}
+
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+
+inline bool enable_drop_count(native_handle_type handle)
+{
+    int enable = 1;
+    return ::setsockopt(handle, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) == 0;
+}
+
+inline void find_drop_count(const msghdr& message, std::uint32_t& kernel_drops)
+{
+    auto& header_message = const_cast<msghdr&>(message);
+    for (auto header = CMSG_FIRSTHDR(&header_message);
+         header;
+         header = CMSG_NXTHDR(&header_message, header))
+    {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SO_RXQ_OVFL)
+        {
+            std::memcpy(&kernel_drops, CMSG_DATA(header), sizeof(kernel_drops));
+        }
+    }
+}
+
+#endif // defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+
+} // namespace udp_buffers
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_UDP_BUFFERS_HPP
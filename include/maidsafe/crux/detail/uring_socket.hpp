@@ -0,0 +1,1054 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MAIDSAFE_CRUX_DETAIL_URING_SOCKET_HPP
+#define MAIDSAFE_CRUX_DETAIL_URING_SOCKET_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
+#include <maidsafe/crux/detail/ecn.hpp>
+#include <maidsafe/crux/detail/function.hpp>
+#include <maidsafe/crux/detail/receive_timestamp.hpp>
+#include <maidsafe/crux/detail/udp_buffers.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+// UDP socket that performs its I/O through a Linux io_uring instance.
+//
+// Receives are served by a single multishot recvmsg operation that draws
+// its buffers from a provided buffer ring, so a datagram is already in user
+// space when its completion is reaped. Peeking, bytes_readable and the
+// subsequent receive_from are answered from the queue of completed
+// datagrams without further system calls. Sends are prepared as sendmsg
+// submissions and handed to the kernel in one batch per io_service turn.
+//
+// The interface is the subset of boost::asio::ip::udp::socket used by the
+// multiplexer. If the kernel lacks the required io_uring features the
+// socket falls back to a plain asio socket at runtime.
+
+class uring_socket : public boost::asio::socket_base
+{
+public:
+    using protocol_type = boost::asio::ip::udp;
+    using endpoint_type = protocol_type::endpoint;
+    using handler_type = detail::function<void (const boost::system::error_code&, std::size_t)>;
+
+    uring_socket(boost::asio::io_service&, const endpoint_type& local_endpoint);
+    uring_socket(uring_socket&&) = default;
+    uring_socket& operator=(uring_socket&&) = default;
+    ~uring_socket();
+
+    boost::asio::io_service& get_io_service();
+
+    bool is_open() const;
+    void close();
+
+    // Abort pending receives. Sends are handed to the kernel right away and
+    // are not affected.
+    void cancel();
+    endpoint_type local_endpoint() const;
+
+    // Returns false if we had to fall back to the plain asio socket.
+    bool is_accelerated() const;
+
+    using native_handle_type = protocol_type::socket::native_handle_type;
+    native_handle_type native_handle();
+
+    template <typename SettableSocketOption>
+    void set_option(const SettableSocketOption&, boost::system::error_code&);
+
+    template <typename GettableSocketOption>
+    void get_option(GettableSocketOption&, boost::system::error_code&) const;
+
+    // As last reported along with a received datagram. Stays zero after
+    // falling back to the plain asio socket.
+    std::uint32_t kernel_drops() const;
+
+    // When the datagram last received arrived at the socket, as stamped by
+    // the kernel where it does so. Now after falling back to the plain asio
+    // socket.
+    std::chrono::steady_clock::time_point arrival() const;
+
+    // The ECN codepoint of the datagram last received. Not capable after
+    // falling back to the plain asio socket.
+    std::uint8_t ecn() const;
+
+    void io_control(bytes_readable&);
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_send_to(const ConstBufferSequence&,
+                       const endpoint_type&,
+                       WriteHandler&&);
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_receive_from(const MutableBufferSequence&,
+                            endpoint_type&,
+                            ReadHandler&&);
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_receive_from(const MutableBufferSequence&,
+                            endpoint_type&,
+                            message_flags,
+                            ReadHandler&&);
+
+    template <typename MutableBufferSequence>
+    std::size_t receive_from(const MutableBufferSequence&,
+                             endpoint_type&,
+                             message_flags,
+                             boost::system::error_code&);
+
+private:
+    class implementation;
+    std::shared_ptr<implementation> impl;
+};
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+namespace maidsafe
+{
+namespace crux
+{
+namespace detail
+{
+
+class uring_socket::implementation
+    : public std::enable_shared_from_this<uring_socket::implementation>
+{
+    static const unsigned submission_entries = 256;
+    static const unsigned buffer_count = 16; // Must be a power of two
+    static const std::size_t buffer_size = 64 * 1024;
+    static const std::uint16_t buffer_group = 0;
+
+    static const std::uint64_t receive_tag = 0;
+    static const std::uint64_t cancel_tag = 1;
+
+    struct send_operation
+    {
+        endpoint_type      endpoint;
+        std::vector<iovec> vectors;
+        msghdr             message;
+        handler_type       handler;
+    };
+
+    struct receive_operation
+    {
+        std::vector<boost::asio::mutable_buffer> buffers;
+        endpoint_type*                           endpoint;
+        message_flags                            flags;
+        handler_type                             handler;
+    };
+
+    struct datagram_type
+    {
+        std::uint16_t buffer_id;
+        endpoint_type endpoint;
+        const char*   data;
+        std::size_t   size;
+        std::chrono::steady_clock::time_point arrival;
+        std::uint8_t  ecn;
+    };
+
+public:
+    implementation(boost::asio::io_service&, const endpoint_type&);
+    ~implementation();
+
+    void start();
+
+    boost::asio::io_service& io;
+    protocol_type::socket socket;
+    bool accelerated;
+    std::uint32_t kernel_drops;
+    std::chrono::steady_clock::time_point arrival;
+    std::uint8_t ecn;
+
+    bool is_open() const { return socket.is_open(); }
+    void close();
+    void cancel();
+
+    std::size_t readable();
+
+    void async_send_to(std::vector<iovec>, const endpoint_type&, handler_type);
+    void async_receive_from(std::vector<boost::asio::mutable_buffer>,
+                            endpoint_type&,
+                            message_flags,
+                            handler_type);
+    std::size_t receive_from(const std::vector<boost::asio::mutable_buffer>&,
+                             endpoint_type&,
+                             message_flags,
+                             boost::system::error_code&);
+
+private:
+    bool setup();
+    void teardown();
+
+    io_uring_sqe* next_submission();
+    void submit();
+    void schedule_submit();
+    void arm_receive();
+    bool cancel_receive();
+    void start_wait();
+    void process_completions();
+    void process_receive(const io_uring_cqe&);
+    void process_send(const io_uring_cqe&);
+    void deliver();
+    std::size_t consume(const std::vector<boost::asio::mutable_buffer>&,
+                        endpoint_type&,
+                        message_flags);
+    void recycle(std::uint16_t buffer_id);
+    void release(std::uint16_t buffer_id);
+    void fall_back();
+
+private:
+    int ring_fd;
+    int event_fd;
+    std::unique_ptr<boost::asio::posix::stream_descriptor> event_descriptor;
+    std::uint64_t event_value;
+
+    // Submission and completion rings shared with the kernel
+    void* ring_memory;
+    std::size_t ring_size;
+    io_uring_sqe* submissions;
+    std::size_t submissions_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* completions;
+    unsigned pending_submissions;
+    bool submit_scheduled;
+    bool waiting;
+
+    // Provided buffer ring from which the multishot receive draws
+    io_uring_buf* buffer_ring;
+    std::vector<char> buffers;
+    msghdr receive_message;
+    bool receive_armed;
+    bool receive_cancelling;
+
+    std::size_t sends_in_flight;
+    std::deque<datagram_type> datagrams;
+    std::deque<receive_operation> receive_queue;
+};
+
+inline
+uring_socket::implementation::implementation(boost::asio::io_service& io,
+                                             const endpoint_type& local_endpoint)
+    : io(io)
+    , socket(io, local_endpoint)
+    , accelerated(false)
+    , kernel_drops(0)
+    , ecn(detail::ecn::not_capable)
+    , ring_fd(-1)
+    , event_fd(-1)
+    , event_value(0)
+    , ring_memory(MAP_FAILED)
+    , ring_size(0)
+    , submissions(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , submissions_size(0)
+    , pending_submissions(0)
+    , submit_scheduled(false)
+    , waiting(false)
+    , buffer_ring(static_cast<io_uring_buf*>(MAP_FAILED))
+    , receive_armed(false)
+    , receive_cancelling(false)
+    , sends_in_flight(0)
+{
+}
+
+inline uring_socket::implementation::~implementation()
+{
+    teardown();
+}
+
+inline void uring_socket::implementation::start()
+{
+    accelerated = setup();
+    if (!accelerated)
+    {
+        teardown();
+        return;
+    }
+    arm_receive();
+    submit();
+}
+
+inline bool uring_socket::implementation::setup()
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, submission_entries, &params));
+    if (ring_fd < 0)
+        return false;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+        return false;
+
+    ring_size = std::max<std::size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    ring_memory = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring_memory == MAP_FAILED)
+        return false;
+
+    submissions_size = params.sq_entries * sizeof(io_uring_sqe);
+    submissions = static_cast<io_uring_sqe*>(::mmap(nullptr, submissions_size,
+                                                    PROT_READ | PROT_WRITE,
+                                                    MAP_SHARED | MAP_POPULATE,
+                                                    ring_fd, IORING_OFF_SQES));
+    if (submissions == MAP_FAILED)
+        return false;
+
+    auto base = static_cast<char*>(ring_memory);
+    sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    completions = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+
+    // Completions are announced through an eventfd so that the io_service
+    // reactor can wait for them together with everything else.
+    event_fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd < 0)
+        return false;
+    if (::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0)
+        return false;
+
+    buffer_ring = static_cast<io_uring_buf*>(::mmap(nullptr,
+                                                    buffer_count * sizeof(io_uring_buf),
+                                                    PROT_READ | PROT_WRITE,
+                                                    MAP_PRIVATE | MAP_ANONYMOUS,
+                                                    -1, 0));
+    if (buffer_ring == MAP_FAILED)
+        return false;
+
+    io_uring_buf_reg registration;
+    std::memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<std::uint64_t>(buffer_ring);
+    registration.ring_entries = buffer_count;
+    registration.bgid = buffer_group;
+    if (::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+        return false;
+
+    buffers.resize(buffer_count * buffer_size);
+    for (unsigned i = 0; i < buffer_count; ++i)
+    {
+        recycle(static_cast<std::uint16_t>(i));
+    }
+
+    std::memset(&receive_message, 0, sizeof(receive_message));
+    receive_message.msg_namelen = sizeof(sockaddr_storage);
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+    receive_message.msg_controllen += udp_buffers::drop_count_space;
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+    receive_message.msg_controllen += receive_timestamp::space;
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+    receive_message.msg_controllen += detail::ecn::space;
+#endif
+
+    event_descriptor.reset(new boost::asio::posix::stream_descriptor(io, event_fd));
+    return true;
+}
+
+inline void uring_socket::implementation::teardown()
+{
+    if (ring_fd >= 0)
+    {
+        // The kernel may still be referencing the buffer ring and the send
+        // operations, so cancel the receive and wait for all outstanding
+        // completions before the memory is released. A receive that could
+        // not be cancelled never completes, and is left to the kernel when
+        // the ring is closed.
+        const bool wait_receive = receive_armed && cancel_receive();
+        while (((wait_receive && receive_armed) || sends_in_flight > 0)
+               && submissions != MAP_FAILED)
+        {
+            auto result = ::syscall(__NR_io_uring_enter, ring_fd, pending_submissions, 1,
+                                    IORING_ENTER_GETEVENTS, nullptr, 0);
+            pending_submissions = 0;
+            if (result < 0 && errno != EINTR)
+                break;
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe& completion = completions[head & *cq_mask];
+                if (completion.user_data == receive_tag)
+                {
+                    if (!(completion.flags & IORING_CQE_F_MORE))
+                    {
+                        receive_armed = false;
+                        receive_cancelling = false;
+                    }
+                }
+                else if (completion.user_data != cancel_tag)
+                {
+                    delete reinterpret_cast<send_operation*>(completion.user_data);
+                    --sends_in_flight;
+                }
+            }
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+        ::close(ring_fd);
+        ring_fd = -1;
+    }
+    if (event_descriptor)
+    {
+        // The descriptor owns the eventfd
+        event_descriptor.reset();
+        event_fd = -1;
+    }
+    if (event_fd >= 0)
+    {
+        ::close(event_fd);
+        event_fd = -1;
+    }
+    if (buffer_ring != MAP_FAILED)
+    {
+        ::munmap(buffer_ring, buffer_count * sizeof(io_uring_buf));
+        buffer_ring = static_cast<io_uring_buf*>(MAP_FAILED);
+    }
+    if (submissions != MAP_FAILED)
+    {
+        ::munmap(submissions, submissions_size);
+        submissions = static_cast<io_uring_sqe*>(MAP_FAILED);
+    }
+    if (ring_memory != MAP_FAILED)
+    {
+        ::munmap(ring_memory, ring_size);
+        ring_memory = MAP_FAILED;
+    }
+}
+
+inline void uring_socket::implementation::close()
+{
+    // Queued sends refer to the socket descriptor, so hand them to the
+    // kernel before the descriptor is closed. The multishot receive holds a
+    // reference to the socket, which keeps the port bound until it is
+    // cancelled.
+    if (ring_fd >= 0)
+    {
+        cancel_receive();
+        submit();
+    }
+
+    if (event_descriptor)
+    {
+        boost::system::error_code ignored;
+        event_descriptor->cancel(ignored);
+    }
+
+    cancel();
+
+    boost::system::error_code ignored;
+    socket.close(ignored);
+}
+
+inline void uring_socket::implementation::cancel()
+{
+    if (!accelerated)
+    {
+        boost::system::error_code ignored;
+        socket.cancel(ignored);
+        return;
+    }
+
+    while (!receive_queue.empty())
+    {
+        auto handler = std::move(receive_queue.front().handler);
+        receive_queue.pop_front();
+        io.post(boost::asio::detail::bind_handler(std::move(handler),
+                                                  boost::asio::error::operation_aborted,
+                                                  0));
+    }
+}
+
+inline io_uring_sqe* uring_socket::implementation::next_submission()
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail;
+    if (tail - head >= sq_entries)
+    {
+        submit();
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= sq_entries)
+            return nullptr;
+    }
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe* entry = &submissions[index];
+    std::memset(entry, 0, sizeof(*entry));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++pending_submissions;
+    return entry;
+}
+
+inline void uring_socket::implementation::submit()
+{
+    if (pending_submissions == 0)
+        return;
+
+    auto result = ::syscall(__NR_io_uring_enter, ring_fd, pending_submissions, 0, 0, nullptr, 0);
+    if (result > 0)
+    {
+        pending_submissions -= static_cast<unsigned>(result);
+    }
+}
+
+inline void uring_socket::implementation::schedule_submit()
+{
+    // Sends issued during the same io_service turn are submitted together.
+    if (submit_scheduled)
+        return;
+    submit_scheduled = true;
+
+    auto self = shared_from_this();
+    io.post([self]() {
+            self->submit_scheduled = false;
+            if (self->ring_fd >= 0)
+            {
+                self->submit();
+            }
+        });
+}
+
+inline void uring_socket::implementation::arm_receive()
+{
+    if (receive_armed || !socket.is_open())
+        return;
+
+    if (auto entry = next_submission())
+    {
+        entry->opcode = IORING_OP_RECVMSG;
+        entry->fd = socket.native_handle();
+        entry->addr = reinterpret_cast<std::uint64_t>(&receive_message);
+        entry->len = 1;
+        entry->ioprio = IORING_RECV_MULTISHOT;
+        entry->flags = IOSQE_BUFFER_SELECT;
+        entry->buf_group = buffer_group;
+        entry->user_data = receive_tag;
+        receive_armed = true;
+    }
+}
+
+inline bool uring_socket::implementation::cancel_receive()
+{
+    if (!receive_armed || receive_cancelling)
+        return true;
+
+    auto entry = next_submission();
+    if (!entry)
+        return false;
+
+    entry->opcode = IORING_OP_ASYNC_CANCEL;
+    entry->fd = -1;
+    entry->addr = receive_tag;
+    entry->user_data = cancel_tag;
+    receive_cancelling = true;
+    return true;
+}
+
+inline void uring_socket::implementation::start_wait()
+{
+    // Only wait while there are operations outstanding, so that an idle
+    // socket does not keep the io_service running. The multishot receive
+    // keeps filling the buffer ring in the meantime.
+    if (waiting || !event_descriptor || !socket.is_open())
+        return;
+    if (receive_queue.empty() && sends_in_flight == 0)
+        return;
+
+    waiting = true;
+    auto self = shared_from_this();
+    event_descriptor->async_read_some
+        (boost::asio::buffer(&event_value, sizeof(event_value)),
+         [self](const boost::system::error_code& error, std::size_t)
+         {
+             self->waiting = false;
+             if (error == boost::asio::error::operation_aborted)
+                 return;
+             self->process_completions();
+             self->start_wait();
+         });
+}
+
+inline void uring_socket::implementation::process_completions()
+{
+    // Copy the completions out of the shared ring before acting on them,
+    // because handlers may close this socket.
+    std::vector<io_uring_cqe> reaped;
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+    {
+        reaped.push_back(completions[head & *cq_mask]);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    for (const auto& completion : reaped)
+    {
+        switch (completion.user_data)
+        {
+        case receive_tag:
+            process_receive(completion);
+            break;
+        case cancel_tag:
+            break;
+        default:
+            process_send(completion);
+            break;
+        }
+    }
+
+    if (accelerated)
+    {
+        deliver();
+        arm_receive();
+        submit();
+    }
+}
+
+inline void uring_socket::implementation::process_receive(const io_uring_cqe& completion)
+{
+    if (!(completion.flags & IORING_CQE_F_MORE))
+    {
+        receive_armed = false;
+        receive_cancelling = false;
+    }
+
+    if (completion.res < 0)
+    {
+        if (completion.res == -EINVAL && datagrams.empty())
+        {
+            // Multishot receive is not supported by this kernel
+            fall_back();
+        }
+        // -ENOBUFS is resolved by arm_receive() once buffers are recycled
+        return;
+    }
+
+    assert(completion.flags & IORING_CQE_F_BUFFER);
+    auto buffer_id = static_cast<std::uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+    const char* base = &buffers[buffer_id * buffer_size];
+    auto output = reinterpret_cast<const io_uring_recvmsg_out*>(base);
+
+    if (output->flags & MSG_TRUNC)
+    {
+        recycle(buffer_id);
+        return;
+    }
+
+    datagram_type datagram;
+    datagram.buffer_id = buffer_id;
+    const char* name = base + sizeof(io_uring_recvmsg_out);
+    std::size_t name_size = std::min<std::size_t>(output->namelen, receive_message.msg_namelen);
+    std::memcpy(datagram.endpoint.data(), name, name_size);
+    datagram.endpoint.resize(name_size);
+    datagram.data = name + receive_message.msg_namelen + receive_message.msg_controllen;
+    datagram.size = output->payloadlen;
+    datagram.arrival = std::chrono::steady_clock::now();
+    datagram.ecn = detail::ecn::not_capable;
+
+    if (output->controllen > 0)
+    {
+        msghdr control;
+        std::memset(&control, 0, sizeof(control));
+        control.msg_control = const_cast<char*>(name + receive_message.msg_namelen);
+        control.msg_controllen = output->controllen;
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+        udp_buffers::find_drop_count(control, kernel_drops);
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_RECEIVE_TIMESTAMP)
+        receive_timestamp::find(control, datagram.arrival);
+#endif
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+        detail::ecn::find(control, datagram.ecn);
+#endif
+    }
+    datagrams.push_back(datagram);
+}
+
+inline void uring_socket::implementation::process_send(const io_uring_cqe& completion)
+{
+    std::unique_ptr<send_operation> operation(reinterpret_cast<send_operation*>(completion.user_data));
+    --sends_in_flight;
+
+    if (completion.res < 0)
+    {
+        operation->handler(boost::system::error_code(-completion.res,
+                                                     boost::asio::error::get_system_category()),
+                           0);
+    }
+    else
+    {
+        operation->handler(boost::system::error_code(),
+                           static_cast<std::size_t>(completion.res));
+    }
+}
+
+inline void uring_socket::implementation::deliver()
+{
+    while (!receive_queue.empty() && !datagrams.empty())
+    {
+        auto operation = std::move(receive_queue.front());
+        receive_queue.pop_front();
+        auto size = consume(operation.buffers, *operation.endpoint, operation.flags);
+        operation.handler(boost::system::error_code(), size);
+    }
+}
+
+inline std::size_t
+uring_socket::implementation::consume(const std::vector<boost::asio::mutable_buffer>& output,
+                                      endpoint_type& endpoint,
+                                      message_flags flags)
+{
+    assert(!datagrams.empty());
+
+    const auto& datagram = datagrams.front();
+    endpoint = datagram.endpoint;
+    arrival = datagram.arrival;
+    ecn = datagram.ecn;
+    auto size = boost::asio::buffer_copy(output,
+                                         boost::asio::buffer(datagram.data, datagram.size));
+    if (!(flags & message_peek))
+    {
+        auto buffer_id = datagram.buffer_id;
+        datagrams.pop_front();
+        release(buffer_id);
+    }
+    return size;
+}
+
+inline void uring_socket::implementation::recycle(std::uint16_t buffer_id)
+{
+    // The ring tail shares storage with the reserved field of the first
+    // entry. We do not use io_uring_buf_ring because its flexible array
+    // member is laid out differently when the header is compiled as C++.
+    std::uint16_t* ring_tail = &buffer_ring[0].resv;
+    std::uint16_t tail = *ring_tail;
+    io_uring_buf& entry = buffer_ring[tail & (buffer_count - 1)];
+    entry.addr = reinterpret_cast<std::uint64_t>(&buffers[buffer_id * buffer_size]);
+    entry.len = buffer_size;
+    entry.bid = buffer_id;
+    __atomic_store_n(ring_tail, static_cast<std::uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+inline void uring_socket::implementation::release(std::uint16_t buffer_id)
+{
+    recycle(buffer_id);
+
+    // The multishot receive terminates when it runs out of buffers.
+    if (!receive_armed)
+    {
+        arm_receive();
+        schedule_submit();
+    }
+}
+
+inline void uring_socket::implementation::fall_back()
+{
+    accelerated = false;
+
+    // Hand pending receives over to the plain socket.
+    while (!receive_queue.empty())
+    {
+        auto operation = std::move(receive_queue.front());
+        receive_queue.pop_front();
+        async_receive_from(std::move(operation.buffers),
+                           *operation.endpoint,
+                           operation.flags,
+                           std::move(operation.handler));
+    }
+}
+
+inline std::size_t uring_socket::implementation::readable()
+{
+    if (!accelerated)
+    {
+        protocol_type::socket::bytes_readable command(true);
+        socket.io_control(command);
+        return command.get();
+    }
+    return datagrams.empty() ? 0 : datagrams.front().size;
+}
+
+inline void uring_socket::implementation::async_send_to(std::vector<iovec> vectors,
+                                                        const endpoint_type& endpoint,
+                                                        handler_type handler)
+{
+    io_uring_sqe* entry = (ring_fd >= 0) ? next_submission() : nullptr;
+    if (!entry)
+    {
+        std::vector<boost::asio::const_buffer> output;
+        for (const auto& vector : vectors)
+        {
+            output.push_back(boost::asio::const_buffer(vector.iov_base, vector.iov_len));
+        }
+        socket.async_send_to(output, endpoint, std::move(handler));
+        return;
+    }
+
+    std::unique_ptr<send_operation> operation(new send_operation);
+    operation->endpoint = endpoint;
+    operation->vectors = std::move(vectors);
+    operation->handler = std::move(handler);
+    std::memset(&operation->message, 0, sizeof(operation->message));
+    operation->message.msg_name = operation->endpoint.data();
+    operation->message.msg_namelen = static_cast<socklen_t>(operation->endpoint.size());
+    operation->message.msg_iov = operation->vectors.data();
+    operation->message.msg_iovlen = operation->vectors.size();
+
+    entry->opcode = IORING_OP_SENDMSG;
+    entry->fd = socket.native_handle();
+    entry->addr = reinterpret_cast<std::uint64_t>(&operation->message);
+    entry->len = 1;
+    entry->user_data = reinterpret_cast<std::uint64_t>(operation.release());
+    ++sends_in_flight;
+
+    schedule_submit();
+    start_wait();
+}
+
+inline void
+uring_socket::implementation::async_receive_from(std::vector<boost::asio::mutable_buffer> output,
+                                                 endpoint_type& endpoint,
+                                                 message_flags flags,
+                                                 handler_type handler)
+{
+    if (!accelerated)
+    {
+        socket.async_receive_from(output, endpoint, flags, std::move(handler));
+        return;
+    }
+
+    receive_queue.push_back(receive_operation{ std::move(output), &endpoint, flags, std::move(handler) });
+
+    if (!datagrams.empty())
+    {
+        // Never invoke the handler from within the initiating function.
+        auto self = shared_from_this();
+        io.post([self]() { self->deliver(); });
+    }
+    else
+    {
+        start_wait();
+    }
+}
+
+inline std::size_t
+uring_socket::implementation::receive_from(const std::vector<boost::asio::mutable_buffer>& output,
+                                           endpoint_type& endpoint,
+                                           message_flags flags,
+                                           boost::system::error_code& error)
+{
+    if (!accelerated)
+    {
+        return socket.receive_from(output, endpoint, flags, error);
+    }
+
+    if (datagrams.empty())
+    {
+        error = boost::asio::error::would_block;
+        return 0;
+    }
+
+    error = boost::system::error_code();
+    return consume(output, endpoint, flags);
+}
+
+inline uring_socket::uring_socket(boost::asio::io_service& io,
+                                  const endpoint_type& local_endpoint)
+    : impl(std::make_shared<implementation>(io, local_endpoint))
+{
+    impl->start();
+}
+
+inline uring_socket::~uring_socket()
+{
+    if (impl)
+    {
+        close();
+    }
+}
+
+inline boost::asio::io_service& uring_socket::get_io_service()
+{
+    return impl->io;
+}
+
+inline bool uring_socket::is_open() const
+{
+    return impl && impl->is_open();
+}
+
+inline void uring_socket::close()
+{
+    impl->close();
+}
+
+inline void uring_socket::cancel()
+{
+    impl->cancel();
+}
+
+inline uring_socket::endpoint_type uring_socket::local_endpoint() const
+{
+    return impl->socket.local_endpoint();
+}
+
+inline bool uring_socket::is_accelerated() const
+{
+    return impl->accelerated;
+}
+
+inline uring_socket::native_handle_type uring_socket::native_handle()
+{
+    return impl->socket.native_handle();
+}
+
+template <typename SettableSocketOption>
+void uring_socket::set_option(const SettableSocketOption& option,
+                              boost::system::error_code& error)
+{
+    impl->socket.set_option(option, error);
+}
+
+template <typename GettableSocketOption>
+void uring_socket::get_option(GettableSocketOption& option,
+                              boost::system::error_code& error) const
+{
+    impl->socket.get_option(option, error);
+}
+
+inline std::uint32_t uring_socket::kernel_drops() const
+{
+    return impl->kernel_drops;
+}
+
+inline std::chrono::steady_clock::time_point uring_socket::arrival() const
+{
+    if (!impl->accelerated)
+        return std::chrono::steady_clock::now();
+    return impl->arrival;
+}
+
+inline std::uint8_t uring_socket::ecn() const
+{
+    if (!impl->accelerated)
+        return detail::ecn::not_capable;
+    return impl->ecn;
+}
+
+inline void uring_socket::io_control(bytes_readable& command)
+{
+    command = bytes_readable(impl->readable());
+}
+
+template <typename ConstBufferSequence, typename WriteHandler>
+void uring_socket::async_send_to(const ConstBufferSequence& buffers,
+                                 const endpoint_type& endpoint,
+                                 WriteHandler&& handler)
+{
+    std::vector<iovec> vectors;
+    for (auto i = buffers.begin(); i != buffers.end(); ++i)
+    {
+        boost::asio::const_buffer buffer(*i);
+        iovec vector;
+        vector.iov_base = const_cast<void*>(boost::asio::buffer_cast<const void*>(buffer));
+        vector.iov_len = boost::asio::buffer_size(buffer);
+        vectors.push_back(vector);
+    }
+    impl->async_send_to(std::move(vectors), endpoint, std::forward<WriteHandler>(handler));
+}
+
+template <typename MutableBufferSequence, typename ReadHandler>
+void uring_socket::async_receive_from(const MutableBufferSequence& buffers,
+                                      endpoint_type& endpoint,
+                                      ReadHandler&& handler)
+{
+    async_receive_from(buffers, endpoint, message_flags(), std::forward<ReadHandler>(handler));
+}
+
+template <typename MutableBufferSequence, typename ReadHandler>
+void uring_socket::async_receive_from(const MutableBufferSequence& buffers,
+                                      endpoint_type& endpoint,
+                                      message_flags flags,
+                                      ReadHandler&& handler)
+{
+    std::vector<boost::asio::mutable_buffer> output;
+    for (auto i = buffers.begin(); i != buffers.end(); ++i)
+    {
+        output.push_back(*i);
+    }
+    impl->async_receive_from(std::move(output), endpoint, flags, std::forward<ReadHandler>(handler));
+}
+
+template <typename MutableBufferSequence>
+std::size_t uring_socket::receive_from(const MutableBufferSequence& buffers,
+                                       endpoint_type& endpoint,
+                                       message_flags flags,
+                                       boost::system::error_code& error)
+{
+    std::vector<boost::asio::mutable_buffer> output;
+    for (auto i = buffers.begin(); i != buffers.end(); ++i)
+    {
+        output.push_back(*i);
+    }
+    return impl->receive_from(output, endpoint, flags, error);
+}
+
+} // namespace detail
+} // namespace crux
+} // namespace maidsafe
+
+#endif // MAIDSAFE_CRUX_DETAIL_URING_SOCKET_HPP
@@ -11,9 +11,12 @@
 #ifndef MAIDSAFE_CRUX_SOCKET_HPP
 #define MAIDSAFE_CRUX_SOCKET_HPP
 
+#include <deque>
 #include <functional>
 #include <memory>
+#include <queue>
 #include <tuple>
+#include <vector>
 
 #include <boost/optional.hpp>
 #include <boost/asio/basic_io_object.hpp>
@@ -23,6 +26,9 @@
 #include <maidsafe/crux/detail/socket_base.hpp>
 #include <maidsafe/crux/detail/service.hpp>
 #include <maidsafe/crux/detail/cumulative_set.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
+#include <maidsafe/crux/detail/move_capture.hpp>
+#include <maidsafe/crux/detail/parity.hpp>
 #include <maidsafe/crux/detail/timer.hpp>
 #include <maidsafe/crux/endpoint.hpp>
 #include <maidsafe/crux/resolver.hpp>
@@ -31,6 +37,7 @@
 #include <maidsafe/crux/detail/receive_output_type.hpp>
 #include <maidsafe/crux/detail/transmit_queue.hpp>
 #include <maidsafe/crux/detail/constants.hpp>
+#include <maidsafe/crux/detail/udp_buffers.hpp>
 
 namespace maidsafe
 {
@@ -67,6 +74,22 @@ public:
         >::type
     async_connect(endpoint_type remote_endpoint, CompletionToken&& token);
 
+    // Start asynchronous connect to remote endpoint with a message that
+    // travels in the handshake. The accepted socket receives it as its
+    // first message. Fails with message_size if the message does not fit
+    // into the handshake datagram.
+    template <typename ConstBufferSequence,
+              typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code)>::type
+        >::type
+    async_connect(endpoint_type remote_endpoint,
+                  const ConstBufferSequence& message,
+                  CompletionToken&& token);
+
+    // Start asynchronous connect to whichever resolved endpoint answers
+    // first, trying IPv6 and IPv4 endpoints in turn (see async_connect_any)
     template <typename CompletionToken>
     typename boost::asio::async_result<
         typename boost::asio::handler_type<CompletionToken,
@@ -76,6 +99,41 @@ public:
                   const std::string& remote_service,
                   CompletionToken&& token);
 
+    // Start asynchronous connect to whichever of the remote endpoints
+    // answers first. Handshakes are started in the order of the sequence,
+    // one connect attempt delay after the other, until an endpoint answers.
+    // The other endpoints are then abandoned. Endpoints of an address
+    // family that the local endpoint cannot reach are skipped.
+    //
+    // If the first endpoint has issued a resumption ticket on an earlier
+    // connection, only that endpoint is tried and the connect completes
+    // without waiting for an answer. A ticket is good for one connection.
+    // If the acceptor no longer honours it, the acceptor answers with a
+    // cookie and the handshake falls back to the full exchange, unnoticed
+    // by the application. If the handshake is not answered at all, pending
+    // sends and receives fail with timed_out, the socket is closed, and
+    // later operations fail with not_connected.
+    template <typename EndpointSequence,
+              typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code)>::type
+        >::type
+    async_connect_any(const EndpointSequence& remote_endpoints,
+                      CompletionToken&& token);
+
+    // As above, with a message that travels in the handshake
+    template <typename EndpointSequence,
+              typename ConstBufferSequence,
+              typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code)>::type
+        >::type
+    async_connect_any(const EndpointSequence& remote_endpoints,
+                      const ConstBufferSequence& message,
+                      CompletionToken&& token);
+
     // Start asynchronous receive on a connected socket
     template <typename MutableBufferSequence,
               typename CompletionToken>
@@ -86,6 +144,34 @@ public:
     async_receive(const MutableBufferSequence& buffers,
                   CompletionToken&& token);
 
+    // Received message as handed out by async_receive_many. Its arrival
+    // member tells when it arrived at the UDP socket. It may be handed to
+    // other threads and released there.
+    using message_type = detail::payload_handle;
+
+    // Start asynchronous receive of a message on a connected socket. The
+    // message is handed to the handler as received, without being copied
+    // into an application buffer.
+    template <typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code, message_type)>::type
+        >::type
+    async_receive(CompletionToken&& token);
+
+    // Start asynchronous receive of up to max_count messages on a connected
+    // socket. Completes with the messages that are already available, or
+    // with the next message to arrive. The messages are appended to the
+    // vector without being copied and the handler is passed their number.
+    template <typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code, std::size_t)>::type
+        >::type
+    async_receive_many(std::vector<message_type>& messages,
+                       std::size_t max_count,
+                       CompletionToken&& token);
+
     // Start asynchronous send on a connected socket
     template <typename ConstBufferSequence,
               typename CompletionToken>
@@ -95,12 +181,117 @@ public:
         >::type
     async_send(ConstBufferSequence&& buffers, CompletionToken&& token);
 
+    // Start asynchronous send of a message whose ownership is shared with
+    // the socket. The message is never copied, and is released once it
+    // has been acknowledged and no transmission of it is pending. It must
+    // not be modified until then.
+    template <typename Message,
+              typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code, std::size_t)>::type
+        >::type
+    async_send_shared(std::shared_ptr<Message> message, CompletionToken&& token);
+
+    // Start asynchronous send of several messages on a connected socket.
+    // Each element of the sequence is a buffer holding one message. The
+    // messages are sent together as far as the receive window of the remote
+    // endpoint allows, and the rest as acknowledgements make room for them.
+    // The handler is called once all of them have been acknowledged, or on
+    // error, with the number of messages that have been acknowledged.
+    template <typename MessageSequence,
+              typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code, std::size_t)>::type
+        >::type
+    async_send_many(const MessageSequence& messages, CompletionToken&& token);
+
+    // Start asynchronous shutdown of a connected socket. Data that has
+    // been sent already is transmitted until it has been acknowledged, and
+    // then the remote endpoint is told about the shutdown. The socket is
+    // closed once that has been acknowledged too, or once the linger time
+    // has passed, in which case the handler fails with timed_out. Pending
+    // receives of the remote endpoint complete with eof.
+    template <typename CompletionToken>
+    typename boost::asio::async_result<
+        typename boost::asio::handler_type<CompletionToken,
+                                           void(boost::system::error_code)>::type
+        >::type
+    async_shutdown(CompletionToken&& token);
+
     // Get the io_service associated with the socket
     boost::asio::io_service& get_io_service();
 
     // Get the local endpoint of the socket
     endpoint_type local_endpoint() const;
 
+    // Get when the message last received into an application buffer
+    // arrived at the UDP socket, as stamped by the kernel where it does so,
+    // rather than when the handler was dispatched.
+    std::chrono::steady_clock::time_point receive_arrival() const;
+
+    // Get or set the number of received bytes that may be held for the
+    // application before the remote endpoint is told to stop sending
+    std::size_t receive_budget() const;
+    void receive_budget(std::size_t bytes);
+
+    // Get the counters of the UDP socket, which is shared by all sockets
+    // bound to the same local endpoint. Its kernel buffers are sized to
+    // hold the receive budgets of all of them.
+    using udp_statistics_type = detail::udp_statistics;
+    udp_statistics_type udp_statistics() const;
+
+    // Get the counts of frames that routers marked congestion experienced
+    // (ECN) on the way, in both directions. Outbound frames are sent as ECN
+    // capable where the system lets us mark them.
+    using congestion_statistics_type = detail::congestion_statistics;
+    congestion_statistics_type congestion_statistics() const;
+
+    // Get or set how many data frames that are sent together share a
+    // parity frame. The remote endpoint reconstructs any one frame of a
+    // group that goes missing from the parity, rather than waiting for its
+    // retransmission. A message sent on its own is a group by itself, so
+    // its parity frame is a copy. Zero, the default, sends no parity. At
+    // most constant::max_parity_group.
+    std::size_t forward_error_correction() const;
+    void forward_error_correction(std::size_t group_size);
+
+    // Get the number of data frames that have been reconstructed from the
+    // parity frames of the remote endpoint
+    std::uint64_t recovered_frames() const;
+
+    // Get or set how handshakes are retransmitted by async_connect. The
+    // connect fails with timed_out once the handshake has been sent
+    // max_attempts times, or the deadline has passed, without an answer.
+    using retransmission_schedule = detail::retransmission_schedule;
+    const retransmission_schedule& connect_schedule() const;
+    void connect_schedule(const retransmission_schedule& schedule);
+
+    // Get or set the delay between handshakes to different endpoints
+    std::chrono::milliseconds connect_attempt_delay() const;
+    void connect_attempt_delay(std::chrono::milliseconds delay);
+
+    // Get or set how long async_shutdown waits for acknowledgements
+    std::chrono::milliseconds linger() const;
+    void linger(std::chrono::milliseconds duration);
+
+    // Get or set how long an established connection may go without
+    // receiving anything before it is probed, and how many probes in a row
+    // may go unanswered before the socket is closed. Pending operations then
+    // fail with timed_out. Probes are one retransmission timeout apart, as
+    // estimated from the measured roundtrip time.
+    //
+    // Connections are only probed while an operation is pending, unless
+    // keepalive is enabled. The io_service then does not run out of work
+    // until the socket is closed.
+    bool keepalive() const;
+    void keepalive(bool enabled);
+    std::chrono::milliseconds keepalive_idle() const;
+    void keepalive_idle(std::chrono::milliseconds duration);
+    std::size_t keepalive_probes() const;
+    void keepalive_probes(std::size_t count);
+
     void close() override;
 
 private:
@@ -109,43 +300,101 @@ private:
 
     void set_multiplexer(std::shared_ptr<detail::multiplexer> multiplexer);
 
-    std::vector<boost::asio::mutable_buffer>* get_recv_buffers() override {
-        if (receive_input_queue.empty()) {
+    detail::mutable_buffers_type* get_recv_buffers() override {
+        if (receive_input_queue.empty() || receive_input_queue.front().message_handler) {
             return nullptr;
         }
 
-        return &receive_input_queue.front()->buffers;
+        return &receive_input_queue.front().buffers;
     }
 
     virtual void process_handshake(sequence_type initial,
-                                   endpoint_type remote_endpoint) override;
-    virtual void process_acknowledgement(const ack_sequence_type& ack) override;
+                                   endpoint_type remote_endpoint,
+                                   std::uint32_t connection_id,
+                                   std::shared_ptr<detail::payload_buffer> message) override;
+    virtual void process_acknowledgement(const ack_sequence_type& ack,
+                                         boost::optional<std::uint16_t> window,
+                                         std::uint16_t congestion_echo) override;
     virtual void process_data(const boost::system::error_code& error,
                               std::size_t payload_size,
-                              std::shared_ptr<detail::buffer> payload,
+                              std::shared_ptr<detail::payload_buffer> payload,
                               sequence_type) override;
+    // Returns false if the frame was not accepted for lack of budget
+    bool accept_data(const boost::system::error_code& error,
+                     std::size_t payload_size,
+                     std::shared_ptr<detail::payload_buffer> payload,
+                     sequence_type);
+    // Accept the frames that were held back behind the one just accepted
+    void accept_held_frames();
+    // Copy of a frame that was received into the posted buffers
+    std::shared_ptr<detail::payload_buffer> copy_received(std::size_t payload_size);
+    void process_parity(sequence_type first,
+                        std::size_t count,
+                        std::uint32_t size_xor,
+                        std::shared_ptr<detail::payload_buffer> parity) override;
 
     void process_receive( const boost::system::error_code& error
                         , std::size_t                      bytes_received
                         , read_handler_type&&              handler);
 
-    void process_keepalive(sequence_type) override;
+    void process_keepalive(boost::optional<sequence_type>, std::uint16_t probe) override;
+
+    void process_shutdown(sequence_type) override;
+
+    void process_cookie(endpoint_type,
+                        boost::optional<detail::cookie_generator::value_type>) override;
+
+    void process_ticket(boost::optional<detail::cookie_generator::value_type>) override;
 
     template <typename Handler>
     void send_handshake(endpoint_type remote_endpoint,
                         boost::optional<sequence_type> ack,
                         Handler&& handler);
 
+    template <typename Handler>
+    void send_connect_handshake(Handler&& handler);
+
+    struct connect_candidate;
+    void send_candidate_handshake(const connect_candidate&);
+    void start_next_candidate();
+    void release_candidates();
+    boost::optional<endpoint_type> connect_endpoint(endpoint_type) const;
+    void abort_connect();
+
     template <typename Handler>
     void send_keepalive(endpoint_type remote_endpoint,
                         boost::optional<sequence_type> ack,
                         Handler&& handler);
-
+    // Acknowledge what has been received, with a compact frame if the
+    // remote endpoint receives them
+    void send_ack();
+    // The sequence number of a probe is not used up, and its answer echoes
+    // it
+    void send_probe(std::uint16_t probe, sequence_type sequence);
+    void send_parity(sequence_type first, detail::parity_encoder&);
+    // Challenges the sender of a frame that passed sequence validation, or
+    // of a retransmission of the last one, if it is not the remote endpoint
+    void challenge_path();
+    void send_path_challenge();
+
+    // Data is sent to wherever the remote endpoint is at the time of each
+    // transmission, as it may move while the connection is established.
     template <typename ConstBufferSequence, typename Handler>
-    void send_data(endpoint_type remote_endpoint,
-                   ConstBufferSequence&&,
+    void send_data(ConstBufferSequence&&,
                    Handler&& handler);
 
+    template <typename Message, typename Handler>
+    void send_shared(std::shared_ptr<Message>,
+                     Handler&& handler);
+
+    template <typename MessageSequence, typename Handler>
+    void send_many(const MessageSequence&,
+                   Handler&& handler);
+
+    template <typename Handler>
+    void send_shutdown(Handler&& handler);
+    void complete_shutdown(const boost::system::error_code&);
+
 private:
     template <typename Handler,
               typename ErrorCode>
@@ -161,59 +410,132 @@ private:
     template <typename ConnectHandler>
     void process_connect(ConnectHandler&& handler);
 
-    template <typename ConnectHandler>
-    void async_next_connect(resolver_type::iterator where,
-                            std::shared_ptr<resolver_type> resolver,
-                            ConnectHandler&& handler);
+    bool is_expected_packet(sequence_type seq);
+    boost::optional<sequence_type> expected_sequence() override;
+    sequence_type last_sent_sequence() const override;
+    // Whether a data frame goes with a compact header
+    bool compact_header(std::size_t payload_size) const;
 
-    template <typename ConnectHandler>
-    void process_next_connect(const boost::system::error_code& error,
-                              resolver_type::iterator where,
-                              std::shared_ptr<resolver_type> resolver,
-                              ConnectHandler&& handler);
+    boost::optional<std::uint16_t> receive_window();
+    void update_receive_window();
+    std::size_t max_receive_window() const override;
 
-    template <typename MutableBufferSequence>
-    void copy_buffers_and_process_receive(const boost::system::error_code& error,
-                                          std::shared_ptr<detail::buffer> datagram,
-                                          const MutableBufferSequence&,
-                                          read_handler_type&&);
+    // The marks received, as echoed to the remote endpoint
+    std::uint16_t echo_marks() const;
+    void apply_congestion_echo(std::uint16_t congestion_echo);
 
-    bool is_expected_packet(sequence_type seq);
+    void abort_receives(const boost::system::error_code&);
 
     void on_any_packet_received();
     void idempotent_start_receive() override;
     void idempotent_stop_receive();
+    bool receiving() const override { return is_receiving; }
+    void start_keepalive();
     void on_keepalive_timeout();
+    std::chrono::milliseconds keepalive_interval() const;
 
 private:
     std::shared_ptr<detail::multiplexer> multiplexer;
 
-    std::queue<std::unique_ptr<detail::receive_input_type>> receive_input_queue;
-    std::queue<std::unique_ptr<detail::receive_output_type>> receive_output_queue;
+    // Recycles the memory of per-message operations
+    std::shared_ptr<detail::handler_memory> memory;
+
+    template <typename T>
+    using operation_queue = std::queue<T, std::deque<T, detail::handler_allocator<T>>>;
+
+    operation_queue<detail::receive_input_type> receive_input_queue;
+    operation_queue<detail::receive_output_type> receive_output_queue;
+
+    // Flow control of the receive_output_queue
+    std::size_t receive_budget_value;
+    std::chrono::steady_clock::time_point receive_arrival_value;
+    std::size_t receive_output_size;
+    std::size_t advertised_window;
 
 
-    using connect_handler_type = std::function<void (const boost::system::error_code&)>;
+    using connect_handler_type = detail::function<void (const boost::system::error_code&)>;
     connect_handler_type connect_handler;
 
     sequence_type next_sequence;
 
+    // Endpoints that async_connect_any races, of which the first
+    // started_candidates have been sent a handshake
+    struct connect_candidate
+    {
+        endpoint_type endpoint;
+        // Cookie from the acceptor, to be echoed by our handshake
+        boost::optional<detail::cookie_generator::value_type> cookie;
+        // Resumption ticket from an earlier connection, echoed until the
+        // acceptor sends a cookie instead
+        boost::optional<detail::cookie_generator::value_type> ticket;
+    };
+    std::vector<connect_candidate> connect_candidates;
+    std::size_t started_candidates;
+    sequence_type connect_sequence;
+    // Sent along with the handshake
+    std::shared_ptr<detail::payload_buffer> connect_message;
+
+    retransmission_schedule connect_schedule_value;
+    std::chrono::milliseconds connect_attempt_delay_value;
+    detail::timer connect_timer;
+
+    // Keepalive that acknowledged the handshake of the acceptor, sent again
+    // if the handshake is retransmitted. A resumed connect reuses the
+    // sequence number of its handshake, because data may already follow.
+    boost::optional<sequence_type> handshake_keepalive;
+
     transmit_queue_type transmit_queue;
 
-    using sequence_history_type = detail::cumulative_set<sequence_type, ack_field_type>;
+    using shutdown_handler_type = detail::function<void (const boost::system::error_code&)>;
+    shutdown_handler_type shutdown_handler;
+    std::chrono::milliseconds linger_value;
+    detail::timer linger_timer;
+    // The remote endpoint has shut down, so nothing more is received and
+    // nothing sent will be acknowledged
+    bool remote_shutdown;
+
+    using sequence_history_type
+        = detail::cumulative_set<sequence_type, ack_field_type>;
     sequence_history_type sequence_history;
 
     bool is_receiving;
 
+    // Armed with the idle time once the connection is established, and
+    // with the keepalive timeout before.
     detail::timer keepalive_timer;
+    bool keepalive_value;
+    std::chrono::milliseconds keepalive_idle_value;
+    std::size_t keepalive_probes_value;
+    // Unanswered probes since anything was last received
+    std::size_t probes_sent;
+    std::chrono::steady_clock::time_point probe_started;
+
+    // Frames in sequence from another endpoint only move the connection
+    // there once that endpoint has echoed a probe with a random sequence
+    // number, so that nobody who merely knows the connection id can move
+    // it. Frames from the candidate repeat the challenge until then.
+    endpoint_type path_candidate;
+    boost::optional<std::uint32_t> path_challenge;
+
+    // As last echoed by the remote endpoint
+    std::uint16_t last_congestion_echo;
+
+    std::size_t parity_group_value;
+    detail::parity_window parity_window;
+    std::uint64_t recovered_frames_value;
 };
 
 } // namespace crux
 } // namespace maidsafe
 
 #include <algorithm>
+#include <array>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <boost/asio/error.hpp>
 #include <boost/asio/io_service.hpp>
+#include <boost/asio/detail/bind_handler.hpp>
 #include <maidsafe/crux/detail/multiplexer.hpp>
 
 namespace maidsafe
@@ -223,10 +545,33 @@ namespace crux
 
 inline socket::socket(boost::asio::io_service& io)
     : boost::asio::basic_io_object<service_type>(io),
+      memory(std::make_shared<detail::handler_memory>()),
+      receive_input_queue(detail::handler_allocator<detail::receive_input_type>(memory)),
+      receive_output_queue(detail::handler_allocator<detail::receive_output_type>(memory)),
+      receive_budget_value(detail::constant::default_receive_budget),
+      receive_output_size(0),
+      advertised_window(0),
       next_sequence(get_service().random()),
-      transmit_queue(io),
+      started_candidates(0),
+      connect_schedule_value(detail::constant::connect_initial_timeout,
+                             detail::constant::initial_roundtrip_time,
+                             detail::constant::connect_max_attempts,
+                             detail::constant::connect_deadline),
+      connect_attempt_delay_value(detail::constant::connect_attempt_delay),
+      connect_timer(io, [=]() { start_next_candidate(); }),
+      transmit_queue(io, memory),
+      linger_value(detail::constant::shutdown_linger),
+      linger_timer(io, [=]() { complete_shutdown(boost::asio::error::timed_out); }),
+      remote_shutdown(false),
       is_receiving(false),
-      keepalive_timer(io, [=]() { on_keepalive_timeout(); })
+      keepalive_timer(io, [=]() { on_keepalive_timeout(); }),
+      keepalive_value(false),
+      keepalive_idle_value(detail::constant::keepalive_idle),
+      keepalive_probes_value(detail::constant::keepalive_probes),
+      probes_sent(0),
+      last_congestion_echo(0),
+      parity_group_value(0),
+      recovered_frames_value(0)
 {
 }
 
@@ -234,10 +579,33 @@ inline socket::socket(boost::asio::io_service& io,
                       const endpoint_type& local_endpoint)
     : boost::asio::basic_io_object<service_type>(io),
       multiplexer(get_service().add(local_endpoint)),
+      memory(std::make_shared<detail::handler_memory>()),
+      receive_input_queue(detail::handler_allocator<detail::receive_input_type>(memory)),
+      receive_output_queue(detail::handler_allocator<detail::receive_output_type>(memory)),
+      receive_budget_value(detail::constant::default_receive_budget),
+      receive_output_size(0),
+      advertised_window(0),
       next_sequence(get_service().random()),
-      transmit_queue(io),
+      started_candidates(0),
+      connect_schedule_value(detail::constant::connect_initial_timeout,
+                             detail::constant::initial_roundtrip_time,
+                             detail::constant::connect_max_attempts,
+                             detail::constant::connect_deadline),
+      connect_attempt_delay_value(detail::constant::connect_attempt_delay),
+      connect_timer(io, [=]() { start_next_candidate(); }),
+      transmit_queue(io, memory),
+      linger_value(detail::constant::shutdown_linger),
+      linger_timer(io, [=]() { complete_shutdown(boost::asio::error::timed_out); }),
+      remote_shutdown(false),
       is_receiving(false),
-      keepalive_timer(io, [=]() { on_keepalive_timeout(); })
+      keepalive_timer(io, [=]() { on_keepalive_timeout(); }),
+      keepalive_value(false),
+      keepalive_idle_value(detail::constant::keepalive_idle),
+      keepalive_probes_value(detail::constant::keepalive_probes),
+      probes_sent(0),
+      last_congestion_echo(0),
+      parity_group_value(0),
+      recovered_frames_value(0)
 {
 }
 
@@ -251,23 +619,45 @@ inline void socket::close() {
     if (!multiplexer) return;
 
     keepalive_timer.stop();
+    linger_timer.stop();
     transmit_queue.shutdown();
 
-    while (!receive_input_queue.empty()) {
-        auto handler = std::move(receive_input_queue.front()->handler);
-        receive_input_queue.pop();
+    abort_receives(boost::asio::error::operation_aborted);
+    parity_window.clear();
+    path_challenge = boost::none;
 
-        get_io_service().post([handler]() {
-                handler(boost::asio::error::operation_aborted, 0);
-                });
+    if (shutdown_handler) {
+        get_io_service().post
+            (boost::asio::detail::bind_handler(std::move(shutdown_handler),
+                                               boost::asio::error::operation_aborted));
+        shutdown_handler = nullptr;
     }
 
     get_service().remove(local_endpoint());
     idempotent_stop_receive();
+    release_candidates();
     multiplexer->remove(this);
     multiplexer = 0;
 }
 
+inline void socket::abort_receives(const boost::system::error_code& error) {
+    while (!receive_input_queue.empty()) {
+        auto input = std::move(receive_input_queue.front());
+        receive_input_queue.pop();
+
+        if (input.message_handler) {
+            get_io_service().post
+                (boost::asio::detail::bind_handler(std::move(input.message_handler),
+                                                   error,
+                                                   message_type()));
+        }
+        else {
+            get_io_service().post
+                (boost::asio::detail::bind_handler(std::move(input.handler), error, 0));
+        }
+    }
+}
+
 inline void socket::idempotent_stop_receive() {
     if (!is_receiving) { return; }
     is_receiving = false;
@@ -279,17 +669,69 @@ inline void socket::idempotent_start_receive() {
     is_receiving = true;
     multiplexer->start_receive();
 
-    keepalive_timer.set_period(detail::constant::keepalive_timeout);
-    keepalive_timer.start();
+    if (state() != connectivity::established) {
+        keepalive_timer.set_period(detail::constant::keepalive_timeout);
+        keepalive_timer.start();
+    }
+    else if (probes_sent == 0 && !keepalive_value) {
+        start_keepalive();
+    }
 }
 
 inline void socket::on_any_packet_received() {
     is_receiving = false;
-    keepalive_timer.stop();
+    probes_sent = 0;
+
+    if (path_challenge && sender == path_candidate) {
+        send_path_challenge();
+    }
+
+    if (state() == connectivity::established && !remote_shutdown && keepalive_value) {
+        start_keepalive();
+    }
+    else {
+        keepalive_timer.stop();
+    }
+}
+
+inline void socket::start_keepalive() {
+    // Nobody is waiting on the connection
+    if (!keepalive_value && !is_receiving) {
+        return;
+    }
+    keepalive_timer.set_period(keepalive_idle_value);
+    keepalive_timer.start();
 }
 
 inline void socket::on_keepalive_timeout() {
-    close();
+    if (!multiplexer) return;
+
+    if (state() != connectivity::established) {
+        return close();
+    }
+
+    if (probes_sent == keepalive_probes_value) {
+        // The remote endpoint is gone
+        abort_receives(boost::asio::error::timed_out);
+        transmit_queue.shutdown(boost::asio::error::timed_out);
+        return close();
+    }
+
+    if (probes_sent++ == 0) {
+        probe_started = std::chrono::steady_clock::now();
+    }
+    send_probe(detail::header::constant::probe_request, next_sequence);
+    idempotent_start_receive();
+
+    keepalive_timer.set_period(keepalive_interval());
+    keepalive_timer.start();
+}
+
+inline std::chrono::milliseconds socket::keepalive_interval() const {
+    return std::max<std::chrono::milliseconds>
+        (detail::constant::keepalive_min_interval,
+         std::chrono::duration_cast<std::chrono::milliseconds>
+             (transmit_queue.roundtrip().timeout()));
 }
 
 inline boost::asio::io_service& socket::get_io_service()
@@ -304,6 +746,206 @@ inline socket::endpoint_type socket::local_endpoint() const
     return multiplexer->next_layer().local_endpoint();
 }
 
+inline std::chrono::steady_clock::time_point socket::receive_arrival() const
+{
+    return receive_arrival_value;
+}
+
+inline std::size_t socket::receive_budget() const
+{
+    return receive_budget_value;
+}
+
+inline void socket::receive_budget(std::size_t bytes)
+{
+    receive_budget_value = bytes;
+
+    if (multiplexer) {
+        multiplexer->update_window(*this);
+    }
+}
+
+inline socket::udp_statistics_type socket::udp_statistics() const
+{
+    if (!multiplexer) {
+        return udp_statistics_type();
+    }
+    return multiplexer->statistics();
+}
+
+inline socket::congestion_statistics_type socket::congestion_statistics() const
+{
+    return congestion;
+}
+
+inline std::size_t socket::forward_error_correction() const
+{
+    return parity_group_value;
+}
+
+inline void socket::forward_error_correction(std::size_t group_size)
+{
+    parity_group_value = std::min(group_size, detail::constant::max_parity_group);
+}
+
+inline std::uint64_t socket::recovered_frames() const
+{
+    return recovered_frames_value;
+}
+
+inline std::size_t socket::max_receive_window() const
+{
+    // As advertised while nothing is held for the application
+    return std::max(receive_budget_value, detail::constant::max_datagram_size);
+}
+
+inline const socket::retransmission_schedule& socket::connect_schedule() const
+{
+    return connect_schedule_value;
+}
+
+inline void socket::connect_schedule(const retransmission_schedule& schedule)
+{
+    connect_schedule_value = schedule;
+}
+
+inline std::chrono::milliseconds socket::connect_attempt_delay() const
+{
+    return connect_attempt_delay_value;
+}
+
+inline void socket::connect_attempt_delay(std::chrono::milliseconds delay)
+{
+    connect_attempt_delay_value = delay;
+}
+
+inline std::chrono::milliseconds socket::linger() const
+{
+    return linger_value;
+}
+
+inline void socket::linger(std::chrono::milliseconds duration)
+{
+    linger_value = duration;
+}
+
+inline bool socket::keepalive() const
+{
+    return keepalive_value;
+}
+
+inline void socket::keepalive(bool enabled)
+{
+    keepalive_value = enabled;
+
+    if (state() != connectivity::established || probes_sent != 0 || remote_shutdown) {
+        return;
+    }
+    if (enabled || is_receiving) {
+        start_keepalive();
+    }
+    else {
+        keepalive_timer.stop();
+    }
+}
+
+inline std::chrono::milliseconds socket::keepalive_idle() const
+{
+    return keepalive_idle_value;
+}
+
+inline void socket::keepalive_idle(std::chrono::milliseconds duration)
+{
+    keepalive_idle_value = duration;
+
+    if (state() == connectivity::established && probes_sent == 0 && !remote_shutdown) {
+        start_keepalive();
+    }
+}
+
+inline std::size_t socket::keepalive_probes() const
+{
+    return keepalive_probes_value;
+}
+
+inline void socket::keepalive_probes(std::size_t count)
+{
+    keepalive_probes_value = count;
+}
+
+inline boost::optional<std::uint16_t> socket::receive_window()
+{
+    namespace header = detail::header;
+
+    if (receive_output_size == 0) {
+        advertised_window = max_receive_window();
+    }
+    else if (receive_output_size < receive_budget_value) {
+        advertised_window = receive_budget_value - receive_output_size;
+    }
+    else {
+        advertised_window = 0;
+    }
+
+    return static_cast<std::uint16_t>
+        (std::min<std::size_t>(header::constant::max_window,
+                               advertised_window / header::constant::window_unit));
+}
+
+inline std::uint16_t socket::echo_marks() const
+{
+    // Only the lowest bits make it into the header
+    return static_cast<std::uint16_t>(congestion.marks_received);
+}
+
+inline void socket::apply_congestion_echo(std::uint16_t congestion_echo)
+{
+    namespace constant = detail::header::constant;
+    const std::uint16_t modulo = (constant::mask_congestion_echo >> constant::shift_congestion_echo) + 1;
+
+    // Increments of half the counter or more are taken to come from an
+    // acknowledgement that was overtaken by a later one, and are ignored.
+    const std::uint16_t increment = (congestion_echo - last_congestion_echo) & (modulo - 1);
+    if (increment < modulo / 2) {
+        congestion.marks_echoed += increment;
+        last_congestion_echo = congestion_echo;
+    }
+}
+
+inline void socket::update_receive_window()
+{
+    // Tell the remote endpoint once the window has opened by half the
+    // budget, rather than for every message taken by the application.
+    const auto half = receive_budget_value / 2;
+    const auto available = (receive_output_size < receive_budget_value)
+        ? receive_budget_value - receive_output_size
+        : 0;
+
+    if (advertised_window < half && available >= half
+        && state() == connectivity::established) {
+        send_ack();
+    }
+}
+
+inline boost::optional<socket::sequence_type> socket::expected_sequence()
+{
+    auto last_seen = sequence_history.front();
+    if (!last_seen)
+        return boost::none;
+    return last_seen->next();
+}
+
+inline socket::sequence_type socket::last_sent_sequence() const
+{
+    return sequence_type(next_sequence.value() - 1);
+}
+
+inline bool socket::compact_header(std::size_t payload_size) const
+{
+    return remote_version >= detail::header::constant::version_compact
+        && payload_size <= detail::constant::max_compact_payload;
+}
+
 inline bool socket::is_expected_packet(sequence_type seq) {
     // Currently we only let in packets that have sequence
     // number one after the previous one. This will change
@@ -327,6 +969,50 @@ typename boost::asio::async_result<
                                        void(boost::system::error_code)>::type
     >::type
 socket::async_connect(endpoint_type remote_endpoint, CompletionToken&& token)
+{
+    return async_connect_any(std::array<endpoint_type, 1>{{ remote_endpoint }},
+                             std::forward<CompletionToken>(token));
+}
+
+template <typename ConstBufferSequence,
+          typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code)>::type
+    >::type
+socket::async_connect(endpoint_type remote_endpoint,
+                      const ConstBufferSequence& message,
+                      CompletionToken&& token)
+{
+    return async_connect_any(std::array<endpoint_type, 1>{{ remote_endpoint }},
+                             message,
+                             std::forward<CompletionToken>(token));
+}
+
+template <typename EndpointSequence,
+          typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code)>::type
+    >::type
+socket::async_connect_any(const EndpointSequence& remote_endpoints,
+                          CompletionToken&& token)
+{
+    return async_connect_any(remote_endpoints,
+                             std::array<boost::asio::const_buffer, 0>(),
+                             std::forward<CompletionToken>(token));
+}
+
+template <typename EndpointSequence,
+          typename ConstBufferSequence,
+          typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code)>::type
+    >::type
+socket::async_connect_any(const EndpointSequence& remote_endpoints,
+                          const ConstBufferSequence& message,
+                          CompletionToken&& token)
 {
     using handler_type = typename boost::asio::handler_type<CompletionToken,
                                                             void(boost::system::error_code)>::type;
@@ -344,31 +1030,88 @@ socket::async_connect(endpoint_type remote_endpoint, CompletionToken&& token)
         switch (state())
         {
         case connectivity::closed:
-            if (remote_endpoint.address().is_unspecified()) {
-                if (remote_endpoint.address().is_v4()) {
-                    remote_endpoint.address(boost::asio::ip::address_v4::loopback());
-                }
-                else {
-                    assert(remote_endpoint.address().is_v6());
-                    remote_endpoint.address(boost::asio::ip::address_v6::loopback());
+        {
+            const auto message_size = boost::asio::buffer_size(message);
+            if (message_size > detail::multiplexer::max_handshake_message_size) {
+                invoke_handler(std::forward<handler_type>(handler),
+                               boost::asio::error::message_size);
+                break;
+            }
+
+            connect_candidates.clear();
+            for (const auto& remote_endpoint : remote_endpoints) {
+                auto endpoint = connect_endpoint(remote_endpoint);
+                if (endpoint) {
+                    connect_candidates.push_back(connect_candidate{*endpoint,
+                                                                   boost::none,
+                                                                   boost::none});
                 }
             }
+            if (connect_candidates.empty()) {
+                invoke_handler(std::forward<handler_type>(handler),
+                               boost::asio::error::address_family_not_supported);
+                break;
+            }
+
+            // Copied, because it is retransmitted along with the handshake
+            connect_message.reset();
+            if (message_size > 0) {
+                detail::handler_allocator<char> allocator(memory);
+                connect_message = std::allocate_shared<detail::payload_buffer>(allocator,
+                                                                               message_size,
+                                                                               allocator);
+                boost::asio::buffer_copy(boost::asio::buffer(*connect_message), message);
+            }
+
+            connect_candidates.front().ticket
+                = get_service().take_ticket(connect_candidates.front().endpoint);
+            if (connect_candidates.front().ticket) {
+                // Resume the earlier connection instead of racing
+                connect_candidates.resize(1);
+            }
 
             state(connectivity::connecting);
-            remote = remote_endpoint;
-            multiplexer->add(this);
+            remote = connect_candidates.front().endpoint;
+            started_candidates = 0;
+            handshake_keepalive = boost::none;
+            start_next_candidate();
+
+            if (connect_candidates.front().ticket) {
+                state(connectivity::established);
+                send_connect_handshake
+                    ([this] (boost::system::error_code error)
+                     {
+                         if (error && error != boost::asio::error::operation_aborted) {
+                             // We have reported success already, so the
+                             // error goes to whoever waits on the socket
+                             this->abort_receives(error);
+                             this->transmit_queue.shutdown(error);
+                             this->close();
+                         }
+                     });
+                // FIXME: The transmit queue only sends data once the
+                //        handshake has been acknowledged.
+                get_io_service().post
+                    (boost::asio::detail::bind_handler(std::move(handler),
+                                                       boost::system::error_code()));
+                break;
+            }
 
-            send_handshake
-                (remote_endpoint, boost::none,
-                 [this, remote_endpoint, handler]
-                 (boost::system::error_code error) mutable
-                 {
-                     if (error) {
-                        return handler(error);
-                     }
-                     this->process_connect(std::forward<handler_type>(handler));
-                 });
+            send_connect_handshake
+                (detail::move_capture(std::move(handler),
+                                      [this] (handler_type& handler,
+                                              boost::system::error_code error)
+                                      {
+                                          if (error) {
+                                             if (error != boost::asio::error::operation_aborted) {
+                                                 this->abort_connect();
+                                             }
+                                             return handler(error);
+                                          }
+                                          this->process_connect(std::move(handler));
+                                      }));
             break;
+        }
 
         case connectivity::established:
             invoke_handler(std::forward<handler_type>(handler),
@@ -384,6 +1127,92 @@ socket::async_connect(endpoint_type remote_endpoint, CompletionToken&& token)
     return result.get();
 }
 
+inline boost::optional<socket::endpoint_type>
+socket::connect_endpoint(endpoint_type endpoint) const
+{
+    namespace ip = boost::asio::ip;
+
+    if (endpoint.address().is_unspecified()) {
+        if (endpoint.address().is_v4()) {
+            endpoint.address(ip::address_v4::loopback());
+        }
+        else {
+            assert(endpoint.address().is_v6());
+            endpoint.address(ip::address_v6::loopback());
+        }
+    }
+
+    // Datagrams from IPv4 endpoints are received by a dual-stack socket
+    // with a mapped address, and must be sent to it as well.
+    const bool is_local_v6 = local_endpoint().address().is_v6();
+    if (endpoint.address().is_v4() && is_local_v6) {
+        endpoint.address(ip::address_v6::v4_mapped(endpoint.address().to_v4()));
+    }
+    else if (endpoint.address().is_v6() && !is_local_v6) {
+        return boost::none;
+    }
+    return endpoint;
+}
+
+inline void socket::start_next_candidate()
+{
+    if (state() != connectivity::connecting
+        || started_candidates == connect_candidates.size()) {
+        return;
+    }
+
+    const auto& candidate = connect_candidates[started_candidates++];
+    multiplexer->add(this, candidate.endpoint);
+
+    // The handshake to the first endpoint is sent by the transmit queue
+    if (started_candidates > 1) {
+        send_candidate_handshake(candidate);
+    }
+
+    if (started_candidates < connect_candidates.size()) {
+        connect_timer.set_period(connect_attempt_delay_value);
+        connect_timer.start();
+    }
+}
+
+inline void socket::release_candidates()
+{
+    connect_timer.stop();
+
+    for (std::size_t i = 0; i < started_candidates; ++i) {
+        if (connect_candidates[i].endpoint != remote) {
+            multiplexer->release(this, connect_candidates[i].endpoint);
+        }
+    }
+    connect_candidates.clear();
+    started_candidates = 0;
+    connect_message.reset();
+}
+
+inline void socket::send_candidate_handshake(const connect_candidate& candidate)
+{
+    namespace header = detail::header;
+
+    boost::optional<detail::handshake_token> token;
+    if (candidate.cookie) {
+        token = detail::handshake_token{header::constant::handshake_token_cookie,
+                                        *candidate.cookie};
+    }
+    else if (candidate.ticket) {
+        token = detail::handshake_token{header::constant::handshake_token_ticket,
+                                        *candidate.ticket};
+    }
+
+    multiplexer->send_handshake(candidate.endpoint,
+                                local_connection_id,
+                                connect_sequence,
+                                boost::none,
+                                token,
+                                connect_message,
+                                0, // FIXME
+                                [] (const boost::system::error_code&) {});
+}
+
 template <typename ConnectHandler>
 void socket::process_connect(ConnectHandler&& handler)
 {
@@ -442,67 +1271,39 @@ socket::async_connect(const std::string& host,
         resolver_type::query query(host, service);
         resolver->async_resolve
             (query,
-             [this, handler, resolver]
-             (const boost::system::error_code& error,
-              resolver_type::iterator where) mutable
-             {
-                 // Process resolve
-                 if (error)
-                 {
-                     handler(error);
-                 }
-                 else
-                 {
-                     this->async_next_connect(where, resolver, handler);
-                 }
-             });
+             detail::move_capture(std::move(handler),
+                                  [this, resolver]
+                                  (handler_type& handler,
+                                   const boost::system::error_code& error,
+                                   resolver_type::iterator where)
+                                  {
+                                      // Process resolve
+                                      if (error)
+                                      {
+                                          return handler(error);
+                                      }
+
+                                      // Alternate between address families,
+                                      // starting with IPv6 (RFC 8305)
+                                      std::vector<endpoint_type> v6;
+                                      std::vector<endpoint_type> v4;
+                                      for (; where != resolver_type::iterator(); ++where)
+                                      {
+                                          const endpoint_type endpoint = *where;
+                                          (endpoint.address().is_v6() ? v6 : v4).push_back(endpoint);
+                                      }
+                                      std::vector<endpoint_type> endpoints;
+                                      for (std::size_t i = 0; i < std::max(v6.size(), v4.size()); ++i)
+                                      {
+                                          if (i < v6.size()) endpoints.push_back(v6[i]);
+                                          if (i < v4.size()) endpoints.push_back(v4[i]);
+                                      }
+                                      this->async_connect_any(endpoints, std::move(handler));
+                                  }));
     }
     return result.get();
 }
 
-template <typename ConnectHandler>
-void socket::async_next_connect(resolver_type::iterator where,
-                                std::shared_ptr<resolver_type> resolver,
-                                ConnectHandler&& handler)
-{
-    async_connect
-        (*where,
-         [this, where, resolver, handler]
-         (const boost::system::error_code& error) mutable
-         {
-             this->process_next_connect(error,
-                                        where,
-                                        resolver,
-                                        handler);
-         });
-}
-
-template <typename ConnectHandler>
-void socket::process_next_connect(const boost::system::error_code& error,
-                                  resolver_type::iterator where,
-                                  std::shared_ptr<resolver_type> resolver,
-                                  ConnectHandler&& handler)
-{
-    if (error)
-    {
-        ++where;
-        if (where == resolver_type::iterator())
-        {
-            // No addresses left to connect to
-            handler(error);
-        }
-        else
-        {
-            // Try the next address
-            async_next_connect(where, resolver, handler);
-        }
-    }
-    else
-    {
-        process_connect(std::forward<decltype(handler)>(handler));
-    }
-}
-
 template <typename MutableBufferSequence,
           typename CompletionToken>
 typename boost::asio::async_result<
@@ -523,53 +1324,183 @@ socket::async_receive(const MutableBufferSequence& buffers,
                        boost::asio::error::not_connected,
                        0);
     }
+    else if (receive_output_queue.empty() && remote_shutdown)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::eof,
+                       0);
+    }
     else
     {
         if (receive_output_queue.empty())
         {
-            using detail::receive_input_type;
-
-            std::unique_ptr<receive_input_type> operation
-                (new receive_input_type(buffers, std::move(handler)));
-
-            receive_input_queue.emplace(std::move(operation));
+            receive_input_queue.emplace(buffers,
+                                        std::move(handler),
+                                        detail::handler_allocator<char>(memory));
 
             idempotent_start_receive();
         }
         else
         {
-            // We already have data in the output queue.
+            // We already have data in the output queue. The data is taken
+            // now so that consecutive receives get consecutive messages.
+            // FIXME: Thread-safe
+            auto output = std::move(receive_output_queue.front());
+            receive_output_queue.pop();
+            receive_output_size -= output.data->size();
+
+            if (!output.error)
+            {
+                boost::asio::buffer_copy(buffers, boost::asio::buffer(*output.data));
+                receive_arrival_value = output.data->arrival;
+            }
+
+            update_receive_window();
+
+            // The handler is bound rather than captured so that asio can
+            // allocate the posted operation through the handler's hooks.
             get_io_service().post
-                ([this, buffers, handler] () mutable
-                 {
-                     // FIXME: Thread-safe
-                     auto output = std::move(this->receive_output_queue.front());
-                     this->receive_output_queue.pop();
-                     this->copy_buffers_and_process_receive(output->error,
-                                                            output->data,
-                                                            buffers,
-                                                            handler);
-                 });
+                (boost::asio::detail::bind_handler(std::move(handler),
+                                                   output.error,
+                                                   output.data->size()));
         }
     }
     return result.get();
 }
 
-template <typename MutableBufferSequence>
-void socket::copy_buffers_and_process_receive
-        ( const boost::system::error_code& error
-        , std::shared_ptr<detail::buffer>  payload
-        , const MutableBufferSequence&     user_buffers
-        , read_handler_type&&              handler)
+template <typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code, socket::message_type)>::type
+    >::type
+socket::async_receive(CompletionToken&& token)
 {
-    namespace asio = boost::asio;
+    using handler_type = typename boost::asio::handler_type<CompletionToken,
+                                                            void(boost::system::error_code, message_type)>::type;
+    handler_type handler(std::forward<decltype(token)>(token));
+    boost::asio::async_result<decltype(handler)> result(handler);
 
-    if (!error)
+    if (!multiplexer)
+    {
+        get_io_service().post
+            (boost::asio::detail::bind_handler(std::move(handler),
+                                               boost::asio::error::make_error_code
+                                                   (boost::asio::error::not_connected),
+                                               message_type()));
+    }
+    else if (receive_output_queue.empty() && remote_shutdown)
     {
-        asio::buffer_copy(user_buffers, asio::buffer(*payload));
+        get_io_service().post
+            (boost::asio::detail::bind_handler(std::move(handler),
+                                               boost::asio::error::make_error_code
+                                                   (boost::asio::error::eof),
+                                               message_type()));
     }
+    else if (receive_output_queue.empty())
+    {
+        receive_input_queue.emplace(std::move(handler),
+                                    detail::handler_allocator<char>(memory));
 
-    process_receive(error, payload->size(), std::move(handler));
+        idempotent_start_receive();
+    }
+    else
+    {
+        // FIXME: Thread-safe
+        auto output = std::move(receive_output_queue.front());
+        receive_output_queue.pop();
+        receive_output_size -= output.data->size();
+
+        update_receive_window();
+
+        get_io_service().post
+            (boost::asio::detail::bind_handler(std::move(handler),
+                                               output.error,
+                                               message_type(std::move(output.data))));
+    }
+    return result.get();
+}
+
+template <typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code, std::size_t)>::type
+    >::type
+socket::async_receive_many(std::vector<message_type>& messages,
+                           std::size_t max_count,
+                           CompletionToken&& token)
+{
+    using handler_type = typename boost::asio::handler_type<CompletionToken,
+                                                            void(boost::system::error_code, std::size_t)>::type;
+    handler_type handler(std::forward<decltype(token)>(token));
+    boost::asio::async_result<decltype(handler)> result(handler);
+
+    if (!multiplexer)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::not_connected,
+                       0);
+    }
+    else if (max_count == 0)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::invalid_argument,
+                       0);
+    }
+    else if (receive_output_queue.empty() && remote_shutdown)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::eof,
+                       0);
+    }
+    else if (receive_output_queue.empty())
+    {
+        auto* output = &messages;
+        receive_input_queue.emplace
+            (detail::move_capture(std::move(handler),
+                                  [output] (handler_type& handler,
+                                            const boost::system::error_code& error,
+                                            message_type message)
+                                  {
+                                      if (!error) {
+                                          output->push_back(std::move(message));
+                                      }
+                                      handler(error, error ? 0 : 1);
+                                  }),
+             detail::handler_allocator<char>(memory));
+
+        idempotent_start_receive();
+    }
+    else
+    {
+        // Take as many messages as are available, stopping at the first
+        // failed one so that its error is reported on its own.
+        // FIXME: Thread-safe
+        boost::system::error_code error;
+        std::size_t count = 0;
+        while (!receive_output_queue.empty() && count < max_count)
+        {
+            auto& output = receive_output_queue.front();
+            if (output.error && count > 0)
+                break;
+
+            error = output.error;
+            receive_output_size -= output.data->size();
+            if (!error)
+            {
+                messages.push_back(std::move(output.data));
+                ++count;
+            }
+            receive_output_queue.pop();
+            if (error)
+                break;
+        }
+
+        update_receive_window();
+
+        get_io_service().post
+            (boost::asio::detail::bind_handler(std::move(handler), error, count));
+    }
+    return result.get();
 }
 
 template <typename ConstBufferSequence,
@@ -592,17 +1523,147 @@ socket::async_send(ConstBufferSequence&& buffers,
                        boost::asio::error::not_connected,
                        0);
     }
+    else if (remote_shutdown || shutdown_handler)
+    {
+        // Nothing is sent after a shutdown of either side
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::shut_down,
+                       0);
+    }
     else
     {
         send_data
-            (remote,
-             std::forward<ConstBufferSequence>(buffers),
-             [handler] (const boost::system::error_code& error,
-                        std::size_t bytes_transferred) mutable
-             {
-                 // Process send
-                 handler(error, bytes_transferred);
-             });
+            (std::forward<ConstBufferSequence>(buffers),
+             std::move(handler));
+    }
+    return result.get();
+}
+
+template <typename Message,
+          typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code, std::size_t)>::type
+    >::type
+socket::async_send_shared(std::shared_ptr<Message> message,
+                          CompletionToken&& token)
+{
+    using handler_type = typename boost::asio::handler_type<CompletionToken,
+                                                            void(boost::system::error_code, std::size_t)>::type;
+    handler_type handler(std::forward<decltype(token)>(token));
+    boost::asio::async_result<decltype(handler)> result(handler);
+
+    if (!multiplexer)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::not_connected,
+                       0);
+    }
+    else if (remote_shutdown || shutdown_handler)
+    {
+        // Nothing is sent after a shutdown of either side
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::shut_down,
+                       0);
+    }
+    else if (!message)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::invalid_argument,
+                       0);
+    }
+    else
+    {
+        send_shared(std::move(message), std::move(handler));
+    }
+    return result.get();
+}
+
+template <typename MessageSequence,
+          typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code, std::size_t)>::type
+    >::type
+socket::async_send_many(const MessageSequence& messages,
+                        CompletionToken&& token)
+{
+    using handler_type = typename boost::asio::handler_type<CompletionToken,
+                                                            void(boost::system::error_code, std::size_t)>::type;
+    handler_type handler(std::forward<decltype(token)>(token));
+    boost::asio::async_result<decltype(handler)> result(handler);
+
+    if (!multiplexer)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::not_connected,
+                       0);
+    }
+    else if (remote_shutdown || shutdown_handler)
+    {
+        // Nothing is sent after a shutdown of either side
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::shut_down,
+                       0);
+    }
+    else if (std::begin(messages) == std::end(messages))
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::invalid_argument,
+                       0);
+    }
+    else
+    {
+        send_many(messages, std::move(handler));
+    }
+    return result.get();
+}
+
+template <typename CompletionToken>
+typename boost::asio::async_result<
+    typename boost::asio::handler_type<CompletionToken,
+                                       void(boost::system::error_code)>::type
+    >::type
+socket::async_shutdown(CompletionToken&& token)
+{
+    using handler_type = typename boost::asio::handler_type<CompletionToken,
+                                                            void(boost::system::error_code)>::type;
+    handler_type handler(std::forward<decltype(token)>(token));
+    boost::asio::async_result<decltype(handler)> result(handler);
+
+    if (!multiplexer || state() != connectivity::established)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::not_connected);
+    }
+    else if (shutdown_handler)
+    {
+        invoke_handler(std::forward<decltype(handler)>(handler),
+                       boost::asio::error::already_started);
+    }
+    else if (remote_shutdown)
+    {
+        // The remote endpoint is not listening anymore
+        close();
+        get_io_service().post
+            (boost::asio::detail::bind_handler(std::move(handler),
+                                               boost::system::error_code()));
+    }
+    else
+    {
+        shutdown_handler = shutdown_handler_type(std::allocator_arg,
+                                                 detail::handler_allocator<char>(memory),
+                                                 std::move(handler));
+        linger_timer.set_period(linger_value);
+        linger_timer.start();
+
+        send_shutdown([this] (const boost::system::error_code& error, std::size_t)
+                      {
+                          // Aborted by close, and the socket may be gone
+                          if (error == boost::asio::error::operation_aborted)
+                              return;
+                          this->complete_shutdown(error);
+                      });
     }
     return result.get();
 }
@@ -618,45 +1679,166 @@ void socket::process_receive( const boost::system::error_code& error
 inline
 void socket::process_data(const boost::system::error_code& error,
                           std::size_t payload_size,
-                          std::shared_ptr<detail::buffer> payload,
+                          std::shared_ptr<detail::payload_buffer> payload,
                           sequence_type sequence_number)
 {
     on_any_packet_received();
 
     if (!is_expected_packet(sequence_number)) {
+        auto last_seen = sequence_history.front();
+        if (last_seen && *last_seen == sequence_number) {
+            // Retransmitted because our acknowledgement went to where the
+            // remote endpoint was before it moved
+            challenge_path();
+        }
+        // Held back in case the missing frame can be reconstructed
+        if (last_seen && parity_window.active()) {
+            parity_window.hold(last_seen->next(),
+                               sequence_number,
+                               payload ? payload : copy_received(payload_size));
+        }
         // We were receiving, so we need to continue to do so.
         idempotent_start_receive();
         return;
     }
+    challenge_path();
 
-    sequence_history.insert(sequence_number);
+    if (accept_data(error, payload_size, std::move(payload), sequence_number)) {
+        accept_held_frames();
+    }
+
+    if (!receive_input_queue.empty() || !transmit_queue.empty()) {
+        idempotent_start_receive();
+    }
+}
 
+inline
+bool socket::accept_data(const boost::system::error_code& error,
+                         std::size_t payload_size,
+                         std::shared_ptr<detail::payload_buffer> payload,
+                         sequence_type sequence_number)
+{
     // FIXME: Thread-safe
     if (receive_input_queue.empty())
     {
         assert(payload && payload->size() == payload_size);
 
-        using detail::receive_output_type;
+        // Over budget, the message is not acknowledged and will be
+        // retransmitted. The sender still learns about the window.
+        const bool accepted = receive_output_size == 0
+            || receive_output_size + payload_size <= receive_budget_value;
+        if (accepted) {
+            sequence_history.insert(sequence_number);
+            parity_window.delivered(sequence_number, payload);
 
-        std::unique_ptr<receive_output_type>
-            operation(new receive_output_type({ error, payload }));
+            receive_output_size += payload_size;
+            receive_output_queue.push(detail::receive_output_type{ error, payload });
+        }
 
-        receive_output_queue.emplace(std::move(operation));
+        send_ack();
+        return accepted;
+    }
+    else if (receive_input_queue.front().message_handler)
+    {
+        sequence_history.insert(sequence_number);
+
+        assert(payload && payload->size() == payload_size);
+        parity_window.delivered(sequence_number, payload);
+
+        auto input = std::move(receive_input_queue.front());
+        receive_input_queue.pop();
+
+        send_ack();
+
+        input.message_handler(error, std::move(payload));
     }
     else
     {
-        assert(!payload);
+        sequence_history.insert(sequence_number);
+
+        // Frames that were held back or reconstructed have not been copied
+        // into the buffers yet
+        if (payload) {
+            boost::asio::buffer_copy(receive_input_queue.front().buffers,
+                                     boost::asio::buffer(*payload));
+        }
+        else if (parity_window.active()) {
+            payload = copy_received(payload_size);
+        }
+        parity_window.delivered(sequence_number, payload);
 
         auto input = std::move(receive_input_queue.front());
         receive_input_queue.pop();
 
         // FIXME: Check the transmission queue if it has jobs and
         // only schedule new job to the queue if it's not empty.
-        send_keepalive(remote,
-                       sequence_history.front(),
-                       [] (boost::system::error_code) {});
+        send_ack();
+
+        receive_arrival_value = payload ? payload->arrival : arrival;
+        process_receive(error, payload_size, std::move(input.handler));
+    }
+    return true;
+}
+
+inline void socket::accept_held_frames()
+{
+    while (auto last_seen = sequence_history.front())
+    {
+        const auto expected = last_seen->next();
+        auto payload = parity_window.take(expected);
+        if (!payload)
+            break;
 
-        process_receive(error, payload_size, std::move(input->handler));
+        const auto payload_size = payload->size();
+        if (!accept_data(boost::system::error_code(), payload_size, std::move(payload), expected))
+            break;
+    }
+}
+
+inline std::shared_ptr<detail::payload_buffer> socket::copy_received(std::size_t payload_size)
+{
+    auto* buffers = get_recv_buffers();
+    if (!buffers)
+        return nullptr;
+
+    detail::handler_allocator<char> allocator(memory);
+    auto payload = std::allocate_shared<detail::payload_buffer>(allocator, payload_size, allocator);
+    payload->resize(boost::asio::buffer_copy(boost::asio::buffer(*payload), *buffers));
+    payload->arrival = arrival;
+    return payload;
+}
+
+inline
+void socket::process_parity(sequence_type first,
+                            std::size_t count,
+                            std::uint32_t size_xor,
+                            std::shared_ptr<detail::payload_buffer> parity)
+{
+    on_any_packet_received();
+
+    // Frames are kept for reconstruction from now on
+    parity_window.activate();
+
+    auto last_seen = sequence_history.front();
+    if (last_seen && state() == connectivity::established)
+    {
+        const auto expected = last_seen->next();
+        auto payload = parity_window.recover(expected,
+                                             first,
+                                             count,
+                                             size_xor,
+                                             *parity,
+                                             detail::handler_allocator<char>(memory));
+        if (payload)
+        {
+            ++recovered_frames_value;
+            payload->arrival = arrival;
+
+            const auto payload_size = payload->size();
+            if (accept_data(boost::system::error_code(), payload_size, std::move(payload), expected)) {
+                accept_held_frames();
+            }
+        }
     }
 
     if (!receive_input_queue.empty() || !transmit_queue.empty()) {
@@ -665,17 +1847,190 @@ void socket::process_data(const boost::system::error_code& error,
 }
 
 inline
-void socket::process_keepalive(sequence_type sequence_number) {
+void socket::process_cookie(endpoint_type remote_endpoint,
+                            boost::optional<detail::cookie_generator::value_type> cookie)
+{
     on_any_packet_received();
 
-    if (!is_expected_packet(sequence_number)) {
+    for (std::size_t i = 0; cookie && i < started_candidates; ++i)
+    {
+        auto& candidate = connect_candidates[i];
+        if (candidate.endpoint != remote_endpoint)
+            continue;
+
+        const bool is_first = !candidate.cookie;
+        candidate.cookie = cookie;
+
+        // Echo the first cookie right away. Later ones are only picked up
+        // by retransmissions, so that a cookie that keeps failing cannot
+        // start a ping-pong with the acceptor.
+        if (is_first)
+        {
+            send_candidate_handshake(candidate);
+        }
+    }
+
+    idempotent_start_receive();
+}
+
+inline
+void socket::process_ticket(boost::optional<detail::cookie_generator::value_type> ticket)
+{
+    on_any_packet_received();
+
+    if (ticket) {
+        get_service().store_ticket(remote, *ticket);
+    }
+
+    if (!receive_input_queue.empty() || !transmit_queue.empty()) {
+        idempotent_start_receive();
+    }
+}
+
+inline
+void socket::process_keepalive(boost::optional<sequence_type> sequence_number,
+                               std::uint16_t probe) {
+    namespace constant = detail::header::constant;
+
+    if (probe == constant::probe_reply
+        && path_challenge
+        && sender == path_candidate
+        && sequence_number
+        && sequence_number->value() == *path_challenge) {
+        // The new path has answered
+        path_challenge = boost::none;
+        multiplexer->rebind(*this, sender);
+    }
+    else if (probe == constant::probe_reply && probes_sent == 1) {
+        // Only one probe is outstanding, so the answer is not ambiguous
+        transmit_queue.roundtrip().sample
+            (std::chrono::duration_cast<detail::roundtrip_estimator::duration_type>
+                 (arrival - probe_started));
+    }
+
+    on_any_packet_received();
+
+    if (probe != constant::probe_none || !sequence_number) {
+        if (probe == constant::probe_request
+            && state() == connectivity::established
+            && sequence_number) {
+            send_probe(constant::probe_reply, *sequence_number);
+        }
+        if (!receive_input_queue.empty() || !transmit_queue.empty()) {
+            idempotent_start_receive();
+        }
+        return;
+    }
+
+    if (!is_expected_packet(*sequence_number)) {
         idempotent_start_receive();
         return;
     }
+    challenge_path();
 
     // We need to insert this seq # to the history as well for
     // the cumulative history to cumulate.
-    sequence_history.insert(sequence_number);
+    sequence_history.insert(*sequence_number);
+
+    // A window update may arrive while we wait for data
+    if (!receive_input_queue.empty()) {
+        idempotent_start_receive();
+    }
+}
+
+inline
+void socket::process_shutdown(sequence_type sequence_number)
+{
+    on_any_packet_received();
+
+    if (!remote_shutdown)
+    {
+        if (state() != connectivity::established || !is_expected_packet(sequence_number))
+        {
+            idempotent_start_receive();
+            return;
+        }
+        challenge_path();
+        sequence_history.insert(sequence_number);
+        remote_shutdown = true;
+    }
+
+    // Acknowledged every time, because the remote endpoint retransmits the
+    // shutdown until it hears from us.
+    send_ack();
+
+    if (shutdown_handler)
+    {
+        // Both sides have shut down at the same time
+        complete_shutdown(boost::system::error_code());
+        return;
+    }
+
+    // We stop receiving, and the application is expected to close the
+    // socket once it has taken the messages that are left.
+    keepalive_timer.stop();
+    abort_receives(boost::asio::error::eof);
+    transmit_queue.shutdown(boost::asio::error::shut_down);
+}
+
+inline void socket::complete_shutdown(const boost::system::error_code& error)
+{
+    if (!shutdown_handler)
+        return;
+
+    auto handler = std::move(shutdown_handler);
+    shutdown_handler = nullptr;
+    close();
+    handler(error);
+}
+
+template <typename Handler>
+void socket::send_shutdown(Handler&& handler)
+{
+    assert(multiplexer);
+
+    auto sequence = next_sequence++;
+
+    using iteration_handler = transmit_queue_type::iteration_handler;
+
+    // Queued behind the data that has not been acknowledged yet, so it is
+    // only sent once all of it has been.
+    auto send_step = [this, sequence](std::size_t, std::size_t, iteration_handler handler) {
+        multiplexer->send_shutdown
+            (remote,
+             remote_connection_id,
+             sequence,
+             sequence_history.front(),
+             0, // FIXME
+             detail::move_capture(std::move(handler),
+                                  [] (iteration_handler& handler,
+                                      boost::system::error_code error)
+                                  {
+                                    handler(error, 0);
+                                  }));
+    };
+
+    idempotent_start_receive();
+
+    // Retransmitted as eagerly as a handshake, as the linger time is short
+    transmit_queue.push( sequence.value()
+                       , 0
+                       , retransmission_schedule(detail::constant::connect_initial_timeout,
+                                                 detail::constant::initial_roundtrip_time,
+                                                 std::numeric_limits<std::size_t>::max(),
+                                                 linger_value)
+                       , send_step
+                       , std::forward<Handler>(handler));
+}
+
+inline void socket::abort_connect()
+{
+    // The socket stays bound, so that it can connect again
+    keepalive_timer.stop();
+    idempotent_stop_receive();
+    release_candidates();
+    multiplexer->release(this);
+    state(connectivity::closed);
 }
 
 template <typename Handler>
@@ -687,17 +2042,24 @@ void socket::send_handshake(endpoint_type remote_endpoint,
 
     auto sequence = next_sequence++;
 
-    auto send_step = [=](transmit_queue_type::iteration_handler handler) {
+    using iteration_handler = transmit_queue_type::iteration_handler;
+    using handler_type = typename std::decay<Handler>::type;
+
+    auto send_step = [=](std::size_t, std::size_t, iteration_handler handler) {
         multiplexer->send_handshake
             (remote_endpoint,
+             local_connection_id,
              sequence,
              ack,
+             boost::none,
+             nullptr,
              0, // FIXME
-             [this, handler]
-             (boost::system::error_code error)
-             {
-               handler(error, 0);
-             });
+             detail::move_capture(std::move(handler),
+                                  [] (iteration_handler& handler,
+                                      boost::system::error_code error)
+                                  {
+                                    handler(error, 0);
+                                  }));
     };
 
     idempotent_start_receive();
@@ -705,10 +2067,48 @@ void socket::send_handshake(endpoint_type remote_endpoint,
     transmit_queue.push( sequence.value()
                        , 0
                        , send_step
-                       , [handler]
-                         (boost::system::error_code error, std::size_t) mutable {
-                           handler(error);
-                         });
+                       , detail::move_capture(std::forward<Handler>(handler),
+                                              [] (handler_type& handler,
+                                                  boost::system::error_code error,
+                                                  std::size_t) {
+                                                handler(error);
+                                              }));
+}
+
+template <typename Handler>
+void socket::send_connect_handshake(Handler&& handler)
+{
+    assert(multiplexer);
+
+    connect_sequence = next_sequence++;
+
+    using iteration_handler = transmit_queue_type::iteration_handler;
+    using handler_type = typename std::decay<Handler>::type;
+
+    // Every endpoint that has been started is sent the handshake, with the
+    // cookie it has given us so far. A failure to reach one of them must
+    // not end the race, so the step always succeeds.
+    auto send_step = [this](std::size_t, std::size_t, iteration_handler handler) {
+        for (std::size_t i = 0; i < started_candidates; ++i) {
+            send_candidate_handshake(connect_candidates[i]);
+        }
+        get_io_service().post(boost::asio::detail::bind_handler(std::move(handler),
+                                                                boost::system::error_code(),
+                                                                0));
+    };
+
+    idempotent_start_receive();
+
+    transmit_queue.push( connect_sequence.value()
+                       , 0
+                       , connect_schedule_value
+                       , send_step
+                       , detail::move_capture(std::forward<Handler>(handler),
+                                              [] (handler_type& handler,
+                                                  boost::system::error_code error,
+                                                  std::size_t) {
+                                                handler(error);
+                                              }));
 }
 
 template <typename Handler>
@@ -721,34 +2121,121 @@ void socket::send_keepalive(endpoint_type remote_endpoint,
     auto sequence = next_sequence++;
 
     multiplexer->send_keepalive(remote_endpoint,
+                                remote_connection_id,
                                 sequence,
                                 ack,
+                                ack ? receive_window() : boost::none,
+                                echo_marks(),
+                                detail::header::constant::probe_none,
                                 0, // FIXME
                                 std::forward<decltype(handler)>(handler));
 }
 
+inline void socket::send_ack()
+{
+    assert(multiplexer);
+
+    auto ack = sequence_history.front();
+    if (!ack || remote_version < detail::header::constant::version_compact) {
+        send_keepalive(remote, ack, [] (boost::system::error_code) {});
+        return;
+    }
+
+    multiplexer->send_ack(remote,
+                          remote_connection_id,
+                          *ack,
+                          receive_window(),
+                          echo_marks(),
+                          [] (const boost::system::error_code&) {});
+}
+
+inline void socket::send_probe(std::uint16_t probe, sequence_type sequence)
+{
+    assert(multiplexer);
+
+    auto ack = sequence_history.front();
+
+    multiplexer->send_keepalive(remote,
+                                remote_connection_id,
+                                sequence,
+                                ack,
+                                ack ? receive_window() : boost::none,
+                                echo_marks(),
+                                probe,
+                                0,
+                                [] (const boost::system::error_code&) {});
+}
+
+inline void socket::challenge_path()
+{
+    if (sender == remote || state() != connectivity::established)
+        return;
+
+    if (!path_challenge || sender != path_candidate) {
+        path_candidate = sender;
+        path_challenge = get_service().random();
+        send_path_challenge();
+    }
+}
+
+inline void socket::send_path_challenge()
+{
+    assert(multiplexer);
+
+    // Sent to the candidate only, which is the only one that can echo it
+    multiplexer->send_keepalive(path_candidate,
+                                remote_connection_id,
+                                sequence_type(*path_challenge),
+                                boost::none,
+                                boost::none,
+                                0,
+                                detail::header::constant::probe_request,
+                                0,
+                                [] (const boost::system::error_code&) {});
+}
+
+inline void socket::send_parity(sequence_type first, detail::parity_encoder& encoder)
+{
+    assert(multiplexer);
+
+    const auto count = static_cast<std::uint16_t>(encoder.count());
+    const auto size_xor = encoder.size_xor();
+
+    multiplexer->send_parity(std::make_shared<detail::buffer>(encoder.release()),
+                             remote,
+                             remote_connection_id,
+                             first,
+                             count,
+                             size_xor,
+                             [] (const boost::system::error_code&, std::size_t) {});
+}
+
 template <typename ConstBufferSequence, typename Handler>
-void socket::send_data(endpoint_type remote_endpoint,
-                       ConstBufferSequence&& buffers,
+void socket::send_data(ConstBufferSequence&& buffers,
                        Handler&& handler)
 {
     assert(multiplexer);
 
     auto sequence = next_sequence++;
 
-    auto send_step = [=](transmit_queue_type::iteration_handler handler) {
+    auto send_step = [=](std::size_t, std::size_t, transmit_queue_type::iteration_handler handler) {
         multiplexer->send_data
             (buffers, // FIXME: Can be moved? Not sure as this lambda shall be reused
-             remote_endpoint,
+             remote,
+             remote_connection_id,
              sequence,
              sequence_history.front(),
+             receive_window(),
+             echo_marks(),
              0, // FIMXE
-             [handler] (const boost::system::error_code& error,
-                        std::size_t bytes_transferred) mutable
-             {
-                 // Process send
-                 handler(error, bytes_transferred);
-             });
+             compact_header(boost::asio::buffer_size(buffers)),
+             std::move(handler));
+
+        if (parity_group_value > 0) {
+            detail::parity_encoder parity;
+            parity.add(buffers);
+            send_parity(sequence, parity);
+        }
     };
 
     idempotent_start_receive();
@@ -756,12 +2243,166 @@ void socket::send_data(endpoint_type remote_endpoint,
     transmit_queue.push( sequence.value()
                        , boost::asio::buffer_size(buffers)
                        , send_step
-                       , handler);
+                       , std::forward<Handler>(handler));
+}
+
+template <typename Message, typename Handler>
+void socket::send_shared(std::shared_ptr<Message> message,
+                         Handler&& handler)
+{
+    assert(multiplexer);
+
+    auto sequence = next_sequence++;
+
+    // The payload is gathered once and the same buffer is handed to every
+    // transmission. Each transmission holds on to the message until the
+    // kernel is done with it, as it may outlive the acknowledgement.
+    const std::array<boost::asio::const_buffer, 1> payload
+        = {{ boost::asio::buffer(static_cast<const Message&>(*message)) }};
+
+    auto send_step = [=](std::size_t, std::size_t, transmit_queue_type::iteration_handler handler) {
+        multiplexer->send_data
+            (payload,
+             remote,
+             remote_connection_id,
+             sequence,
+             sequence_history.front(),
+             receive_window(),
+             echo_marks(),
+             0, // FIXME
+             compact_header(boost::asio::buffer_size(payload)),
+             detail::move_capture(std::move(handler),
+                                  [message] (transmit_queue_type::iteration_handler& handler,
+                                             const boost::system::error_code& error,
+                                             std::size_t size)
+                                  {
+                                      handler(error, size);
+                                  }));
+
+        if (parity_group_value > 0) {
+            detail::parity_encoder parity;
+            parity.add(payload);
+            send_parity(sequence, parity);
+        }
+    };
+
+    idempotent_start_receive();
+
+    transmit_queue.push( sequence.value()
+                       , boost::asio::buffer_size(payload)
+                       , std::move(send_step)
+                       , std::forward<Handler>(handler));
+}
+
+template <typename MessageSequence, typename Handler>
+void socket::send_many(const MessageSequence& messages,
+                       Handler&& handler)
+{
+    assert(multiplexer);
+
+    using iteration_handler = transmit_queue_type::iteration_handler;
+    using message_buffers = std::vector<boost::asio::const_buffer,
+                                        detail::handler_allocator<boost::asio::const_buffer>>;
+
+    // Completes the step once every message sent by it has been handed
+    // to the kernel, reporting the first error.
+    struct step_state
+    {
+        std::size_t               remaining;
+        boost::system::error_code error;
+        iteration_handler         handler;
+    };
+
+    auto buffers = std::allocate_shared<message_buffers>
+        (detail::handler_allocator<message_buffers>(memory),
+         detail::handler_allocator<boost::asio::const_buffer>(memory));
+    transmit_queue_type::frame_sizes_type frame_sizes{
+        detail::handler_allocator<std::size_t>(memory) };
+    for (const auto& message : messages)
+    {
+        buffers->push_back(boost::asio::const_buffer(message));
+        frame_sizes.push_back(boost::asio::buffer_size(buffers->back()));
+    }
+
+    // Consecutive sequence numbers are reserved for the whole batch
+    auto first = next_sequence;
+    for (std::size_t i = 0; i < buffers->size(); ++i)
+    {
+        ++next_sequence;
+    }
+
+    auto allocator = detail::handler_allocator<step_state>(memory);
+    // Sends the frames from offset begin to end, as far as the window of
+    // the remote endpoint allows
+    auto send_step = [=](std::size_t begin, std::size_t end, iteration_handler handler) {
+        auto state = std::allocate_shared<step_state>
+            (allocator,
+             step_state{ end - begin,
+                         boost::system::error_code(),
+                         std::move(handler) });
+
+        auto sequence = first;
+        for (std::size_t i = 0; i < begin; ++i)
+        {
+            ++sequence;
+        }
+
+        // Parity frames follow each group of frames, and the rest
+        detail::parity_encoder parity;
+        auto group_first = sequence;
+
+        // Frames sent from the same handler are flushed together
+        for (auto i = begin; i < end; ++i, ++sequence)
+        {
+            std::array<boost::asio::const_buffer, 1> frame = {{ (*buffers)[i] }};
+
+            if (parity_group_value > 0) {
+                if (parity.count() == 0) {
+                    group_first = sequence;
+                }
+                parity.add(frame);
+            }
+
+            multiplexer->send_data
+                (frame,
+                 remote,
+                 remote_connection_id,
+                 sequence,
+                 sequence_history.front(),
+                 receive_window(),
+                 echo_marks(),
+                 0, // FIXME
+                 compact_header(boost::asio::buffer_size(frame)),
+                 [state] (const boost::system::error_code& error, std::size_t)
+                 {
+                     if (error && !state->error) {
+                         state->error = error;
+                     }
+                     if (--state->remaining == 0) {
+                         state->handler(state->error, 0);
+                     }
+                 });
+
+            if (parity.count() > 0
+                && (parity.count() == parity_group_value || i + 1 == end)) {
+                send_parity(group_first, parity);
+            }
+        }
+    };
+
+    idempotent_start_receive();
+
+    transmit_queue.push_batch( first.value()
+                             , std::move(frame_sizes)
+                             , send_step
+                             , std::forward<Handler>(handler));
 }
 
 inline
 void socket::process_handshake(sequence_type initial,
-                               endpoint_type remote_endpoint)
+                               endpoint_type remote_endpoint,
+                               std::uint32_t connection_id,
+                               std::shared_ptr<detail::payload_buffer> message)
 {
     on_any_packet_received();
 
@@ -771,6 +2412,28 @@ void socket::process_handshake(sequence_type initial,
     {
     case connectivity::listening:
         assert(multiplexer);
+        if (remote == remote_endpoint && !transmit_queue.empty())
+        {
+            // The remote endpoint has not heard our answer yet
+            transmit_queue.retransmit();
+            idempotent_start_receive();
+            break;
+        }
+        // Only the endpoint we are handshaking with may complete it
+        remote = remote_endpoint;
+        remote_connection_id = connection_id;
+
+        // The message of the handshake becomes the first received message.
+        // One left by an earlier handshake that failed is dropped.
+        while (!receive_output_queue.empty()) {
+            receive_output_queue.pop();
+        }
+        receive_output_size = 0;
+        if (message) {
+            receive_output_size += message->size();
+            receive_output_queue.push(detail::receive_output_type{ boost::system::error_code(),
+                                                                   message });
+        }
         send_handshake
             (remote_endpoint,
              initial,
@@ -785,6 +2448,7 @@ void socket::process_handshake(sequence_type initial,
                  {
                      state(connectivity::established);
                      remote = remote_endpoint;
+                     start_keepalive();
                      if (connect_handler)
                      {
                          connect_handler(error);
@@ -795,7 +2459,12 @@ void socket::process_handshake(sequence_type initial,
         break;
 
     case connectivity::connecting:
+        // The first endpoint to answer wins the race
+        remote = remote_endpoint;
+        remote_connection_id = connection_id;
+        release_candidates();
         state(connectivity::handshaking);
+        handshake_keepalive = next_sequence;
         send_keepalive
             (remote_endpoint,
              initial,
@@ -803,6 +2472,10 @@ void socket::process_handshake(sequence_type initial,
              (boost::system::error_code error) mutable
              {
                  state(error ? connectivity::closed : connectivity::established);
+                 if (!error)
+                 {
+                     start_keepalive();
+                 }
                  if (connect_handler)
                  {
                      connect_handler(error);
@@ -812,10 +2485,34 @@ void socket::process_handshake(sequence_type initial,
         break;
 
     case connectivity::handshaking:
-        assert(false);
-        break;
     case connectivity::established:
-        assert(false);
+        if (remote_endpoint == remote && !handshake_keepalive && !connect_candidates.empty())
+        {
+            // First answer to a resumed connect. The keepalive repeats the
+            // sequence number of our handshake, so that it acknowledges the
+            // handshake of the acceptor without getting ahead of our data.
+            release_candidates();
+            handshake_keepalive = connect_sequence;
+            remote_connection_id = connection_id;
+        }
+        // The acceptor retransmits its handshake until our keepalive
+        // arrives, so we send the same keepalive again.
+        if (remote_endpoint == remote && handshake_keepalive)
+        {
+            multiplexer->send_keepalive(remote,
+                                        remote_connection_id,
+                                        *handshake_keepalive,
+                                        initial,
+                                        receive_window(),
+                                        echo_marks(),
+                                        detail::header::constant::probe_none,
+                                        0, // FIXME
+                                        [] (const boost::system::error_code&) {});
+        }
+        if (!receive_input_queue.empty() || !transmit_queue.empty())
+        {
+            idempotent_start_receive();
+        }
         break;
     default:
         // FIXME: If state == handshaking with the same remote_endpoint as before then remote probably crashed and attempts a new connection (allow reuse_address?)
@@ -825,7 +2522,9 @@ void socket::process_handshake(sequence_type initial,
 }
 
 inline
-void socket::process_acknowledgement(const ack_sequence_type& ack)
+void socket::process_acknowledgement(const ack_sequence_type& ack,
+                                     boost::optional<std::uint16_t> window,
+                                     std::uint16_t congestion_echo)
 {
     switch (state())
     {
@@ -836,6 +2535,7 @@ void socket::process_acknowledgement(const ack_sequence_type& ack)
     case connectivity::handshaking:
         // FIXME: Check ack and ackfield
         state(connectivity::established);
+        start_keepalive();
         break;
 
     case connectivity::listening:
@@ -854,7 +2554,12 @@ void socket::process_acknowledgement(const ack_sequence_type& ack)
         break;
     }
 
-    transmit_queue.apply_ack(ack.value());
+    if (window) {
+        transmit_queue.set_window(*window * detail::header::constant::window_unit);
+        apply_congestion_echo(congestion_echo);
+    }
+
+    transmit_queue.apply_ack(ack.value(), arrival);
 
     if (!transmit_queue.empty()) {
         idempotent_start_receive();
@@ -870,10 +2575,9 @@ void socket::invoke_handler(Handler&& handler,
     assert(error);
 
     get_io_service().post
-        ([handler, error]() mutable
-         {
-             handler(boost::asio::error::make_error_code(error));
-         });
+        (boost::asio::detail::bind_handler(std::forward<Handler>(handler),
+                                           boost::system::error_code
+                                               (boost::asio::error::make_error_code(error))));
 }
 
 template <typename Handler,
@@ -885,10 +2589,10 @@ void socket::invoke_handler(Handler&& handler,
     assert(error);
 
     get_io_service().post
-        ([handler, error, size]() mutable
-         {
-             handler(boost::asio::error::make_error_code(error), size);
-         });
+        (boost::asio::detail::bind_handler(std::forward<Handler>(handler),
+                                           boost::system::error_code
+                                               (boost::asio::error::make_error_code(error)),
+                                           size));
 }
 
 inline void socket::set_multiplexer(std::shared_ptr<detail::multiplexer> value)
@@ -0,0 +1,130 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <array>
+#include <cstdint>
+#include <boost/test/unit_test.hpp>
+#include <maidsafe/crux/detail/cookie.hpp>
+#include <maidsafe/crux/detail/header.hpp>
+#include <maidsafe/crux/socket.hpp>
+#include <maidsafe/crux/acceptor.hpp>
+
+namespace asio = boost::asio;
+namespace detail = maidsafe::crux::detail;
+using error_code = boost::system::error_code;
+using udp = asio::ip::udp;
+
+BOOST_AUTO_TEST_SUITE(cookie_suite)
+
+BOOST_AUTO_TEST_CASE(siphash_reference)
+{
+    // Reference vectors with key 00 01 .. 0f and message 00 01 .. (size-1)
+    const std::uint64_t key0 = 0x0706050403020100ULL;
+    const std::uint64_t key1 = 0x0f0e0d0c0b0a0908ULL;
+    std::array<std::uint8_t, 15> message;
+    for (std::size_t i = 0; i < message.size(); ++i)
+    {
+        message[i] = static_cast<std::uint8_t>(i);
+    }
+
+    BOOST_REQUIRE_EQUAL(detail::siphash(key0, key1, message.data(), 0),
+                        0x726fdb47dd0e0e31ULL);
+    BOOST_REQUIRE_EQUAL(detail::siphash(key0, key1, message.data(), 15),
+                        0xa129ca6149be45e5ULL);
+}
+
+BOOST_AUTO_TEST_CASE(verify_cookie)
+{
+    detail::cookie_generator cookies(1, 2);
+    const udp::endpoint endpoint(asio::ip::address_v4::loopback(), 1234);
+    const std::uint32_t now = 1000;
+
+    auto cookie = cookies.generate(endpoint, 42, now);
+
+    BOOST_REQUIRE(cookies.verify(cookie, endpoint, 42, now));
+    BOOST_REQUIRE(cookies.verify(cookie, endpoint, 42, now + 1));
+
+    // Different endpoint or handshake
+    BOOST_REQUIRE(!cookies.verify(cookie, udp::endpoint(endpoint.address(), 1235), 42, now));
+    BOOST_REQUIRE(!cookies.verify(cookie, endpoint, 43, now));
+
+    // Expired or from the future
+    const auto lifetime = static_cast<std::uint32_t>(detail::constant::cookie_lifetime.count());
+    BOOST_REQUIRE(!cookies.verify(cookie, endpoint, 42, now + lifetime + 1));
+    BOOST_REQUIRE(!cookies.verify(cookie, endpoint, 42, now - 1));
+
+    // Tampered
+    cookie.back() ^= 1;
+    BOOST_REQUIRE(!cookies.verify(cookie, endpoint, 42, now));
+
+    // Another key
+    detail::cookie_generator other(2, 1);
+    BOOST_REQUIRE(!other.verify(cookies.generate(endpoint, 42, now), endpoint, 42, now));
+}
+
+BOOST_AUTO_TEST_CASE(handshake_flood)
+{
+    using namespace maidsafe;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, udp::endpoint(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, udp::endpoint(udp::v4(), 0));
+
+    // Handshakes that never echo their cookie
+    const std::size_t flood_size = 100;
+    udp::socket flood(ios, udp::endpoint(udp::v4(), 0));
+    for (std::size_t i = 0; i < flood_size; ++i)
+    {
+        detail::header::data_type frame;
+        detail::encoder encoder(frame.data(), frame.size());
+        detail::header::handshake(0, detail::header::sequence_type(i), boost::none).encode(encoder);
+        flood.send_to(asio::buffer(frame), acceptor.local_endpoint());
+    }
+
+    bool accepted = false;
+    bool connected = false;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            accepted = true;
+            });
+
+    client_socket.async_connect(acceptor.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            connected = true;
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE(accepted);
+    BOOST_REQUIRE(connected);
+    BOOST_REQUIRE_EQUAL(server_socket.remote_endpoint().port(), client_socket.local_endpoint().port());
+
+    // Every spoofed handshake got a cookie back, but nothing else
+    std::size_t cookies = 0;
+    flood.non_blocking(true);
+    for (;;)
+    {
+        std::array<std::uint8_t, 64> reply;
+        udp::endpoint sender;
+        error_code error;
+        const auto size = flood.receive_from(asio::buffer(reply), sender, 0, error);
+        if (error)
+            break;
+        BOOST_REQUIRE_EQUAL(size, detail::header::constant::size + detail::cookie_generator::size);
+        BOOST_REQUIRE_EQUAL(reply[0] & 0xF8, detail::header::constant::type_cookie >> 8);
+        ++cookies;
+    }
+    BOOST_REQUIRE_EQUAL(cookies, flood_size);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -89,4 +89,59 @@ BOOST_AUTO_TEST_CASE(out_of_sequence)
     BOOST_REQUIRE_EQUAL(front2, four);
 }
 
+BOOST_AUTO_TEST_CASE(selective_field)
+{
+    cumulative_set history;
+
+    history.insert(sequence_number(41));
+    history.insert(sequence_number(43));
+    history.insert(sequence_number(45));
+    BOOST_REQUIRE_EQUAL(history.front(), sequence_number(41));
+    // Bit 0 is 43, bit 2 is 45
+    BOOST_REQUIRE_EQUAL(history.field(), 0x5);
+
+    history.insert(sequence_number(42));
+    BOOST_REQUIRE_EQUAL(history.front(), sequence_number(43));
+    BOOST_REQUIRE_EQUAL(history.field(), 0x1);
+}
+
+BOOST_AUTO_TEST_CASE(advance_across_words)
+{
+    cumulative_set history;
+
+    history.insert(sequence_number(0));
+    for (std::uint32_t i = 300; i > 1; --i)
+    {
+        BOOST_REQUIRE(history.insert(sequence_number(i)));
+    }
+    BOOST_REQUIRE_EQUAL(history.front(), sequence_number(0));
+
+    history.insert(sequence_number(1));
+    BOOST_REQUIRE_EQUAL(history.front(), sequence_number(300));
+    BOOST_REQUIRE_EQUAL(history.field(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(wrap_around)
+{
+    cumulative_set history;
+    sequence_number number(sequence_number::max_value - 1);
+
+    history.insert(number);
+    for (int i = 0; i < 4; ++i)
+    {
+        history.insert(++number);
+    }
+    BOOST_REQUIRE_EQUAL(history.front(), sequence_number(2));
+}
+
+BOOST_AUTO_TEST_CASE(beyond_window)
+{
+    cumulative_set history;
+
+    history.insert(sequence_number(0));
+    BOOST_REQUIRE(!history.insert(sequence_number(5000)));
+    BOOST_REQUIRE(history.insert(sequence_number(0)));
+    BOOST_REQUIRE_EQUAL(history.front(), sequence_number(0));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
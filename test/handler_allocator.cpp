@@ -0,0 +1,207 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <array>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <maidsafe/crux/detail/function.hpp>
+#include <maidsafe/crux/detail/handler_allocator.hpp>
+#include <maidsafe/crux/socket.hpp>
+#include <maidsafe/crux/acceptor.hpp>
+
+namespace asio = boost::asio;
+namespace detail = maidsafe::crux::detail;
+using error_code = boost::system::error_code;
+using udp = asio::ip::udp;
+
+namespace
+{
+
+bool counting = false;
+std::size_t allocations = 0;
+
+} // anonymous namespace
+
+void* operator new(std::size_t size)
+{
+    if (counting)
+        ++allocations;
+    void* result = std::malloc(size ? size : 1);
+    if (!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+BOOST_AUTO_TEST_SUITE(handler_allocator_suite)
+
+BOOST_AUTO_TEST_CASE(reuse_released_block)
+{
+    detail::handler_memory memory;
+
+    auto first = memory.allocate(100);
+    memory.deallocate(first, 100);
+
+    // Same size class
+    auto second = memory.allocate(120);
+    BOOST_REQUIRE_EQUAL(first, second);
+    memory.deallocate(second, 120);
+}
+
+BOOST_AUTO_TEST_CASE(release_on_other_thread)
+{
+    detail::handler_memory memory;
+
+    auto first = memory.allocate(100);
+    std::thread([&]() { memory.deallocate(first, 100); }).join();
+
+    // Taken over by the allocating thread
+    auto second = memory.allocate(100);
+    BOOST_REQUIRE_EQUAL(first, second);
+    memory.deallocate(second, 100);
+}
+
+BOOST_AUTO_TEST_CASE(function_in_arena)
+{
+    auto memory = std::make_shared<detail::handler_memory>();
+    detail::handler_allocator<char> allocator(memory);
+
+    // Too large to be stored inside the function object
+    std::array<char, 128> payload;
+    payload.fill(42);
+    int result = 0;
+    {
+        // Warm up the size class
+        detail::function<void ()> warm(std::allocator_arg, allocator,
+                                       [&result, payload] { result = 0; });
+    }
+
+    counting = true;
+    allocations = 0;
+    detail::function<void ()> function(std::allocator_arg, allocator,
+                                       [&result, payload] { result = payload[0]; });
+    detail::function<void ()> moved(std::move(function));
+    counting = false;
+
+    BOOST_REQUIRE(!function);
+    BOOST_REQUIRE(moved);
+    moved();
+    BOOST_REQUIRE_EQUAL(result, 42);
+    BOOST_REQUIRE_EQUAL(allocations, 0);
+}
+
+BOOST_AUTO_TEST_CASE(function_local_target)
+{
+    std::unique_ptr<int> owned(new int(42));
+    int result = 0;
+
+    counting = true;
+    allocations = 0;
+    detail::function<void (int)> function
+        (std::bind([&result] (std::unique_ptr<int>& owned, int value) {
+                       result = *owned + value;
+                   },
+                   std::move(owned),
+                   std::placeholders::_1));
+    detail::function<void (int)> moved(std::move(function));
+    counting = false;
+
+    BOOST_REQUIRE(!function);
+    BOOST_REQUIRE(moved);
+    moved(1);
+    BOOST_REQUIRE_EQUAL(result, 43);
+    BOOST_REQUIRE_EQUAL(allocations, 0);
+}
+
+#if !defined(MAIDSAFE_CRUX_WITH_IO_URING)
+// FIXME: The io_uring transport still allocates per operation.
+
+BOOST_AUTO_TEST_CASE(steady_state_echo)
+{
+    using namespace maidsafe;
+
+    const int warmup_rounds = 50;
+    const int measured_rounds = 10;
+
+    asio::io_service ios;
+    crux::socket client(ios, udp::endpoint(udp::v4(), 0));
+    crux::socket server(ios);
+    crux::acceptor acceptor(ios, udp::endpoint(udp::v4(), 0));
+
+    char server_buffer[64];
+    char client_buffer[64];
+    const char message[] = "hello";
+    int rounds = 0;
+
+    std::function<void ()> server_loop;
+    std::function<void ()> client_loop;
+
+    server_loop = [&] {
+        server.async_receive(asio::buffer(server_buffer),
+                             [&](const error_code& error, std::size_t size) {
+            if (error) return;
+            server.async_send(asio::buffer(server_buffer, size),
+                              [&](const error_code& error, std::size_t) {
+                if (!error) server_loop();
+            });
+        });
+    };
+
+    client_loop = [&] {
+        ++rounds;
+        if (rounds == warmup_rounds) {
+            allocations = 0;
+            counting = true;
+        }
+        if (rounds == warmup_rounds + measured_rounds) {
+            counting = false;
+            client.close();
+            server.close();
+            return;
+        }
+        client.async_send(asio::buffer(message, sizeof(message)),
+                          [&](const error_code& error, std::size_t) {
+            if (error) return;
+            client.async_receive(asio::buffer(client_buffer),
+                                 [&](const error_code& error, std::size_t) {
+                if (!error) client_loop();
+            });
+        });
+    };
+
+    acceptor.async_accept(server, [&](error_code error) {
+        if (!error) server_loop();
+    });
+    client.async_connect(acceptor.local_endpoint(), [&](error_code error) {
+        if (!error) client_loop();
+    });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(rounds, warmup_rounds + measured_rounds);
+    BOOST_REQUIRE_EQUAL(allocations, 0);
+}
+
+#endif // !defined(MAIDSAFE_CRUX_WITH_IO_URING)
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdint>
+#include <boost/test/unit_test.hpp>
+#include <maidsafe/crux/detail/header.hpp>
+
+namespace detail = maidsafe::crux::detail;
+namespace header = detail::header;
+using sequence_type = header::sequence_type;
+
+BOOST_AUTO_TEST_SUITE(header_suite)
+
+BOOST_AUTO_TEST_CASE(compact_data_roundtrip)
+{
+    alignas(std::uint32_t) header::data_type frame;
+    detail::encoder encoder(frame.data(), frame.size());
+    header::compact_data(1,
+                         sequence_type(0x12345678),
+                         sequence_type(0x9ABCDEF0),
+                         std::uint16_t(42),
+                         0xCAFEBABE,
+                         5)
+        .encode(encoder);
+
+    const auto length = frame.size() - encoder.size();
+    BOOST_REQUIRE_EQUAL(length, 12);
+    BOOST_REQUIRE_EQUAL(header::size(frame.data()), length);
+    BOOST_REQUIRE_EQUAL(header::connection_id(frame.data()), 0xCAFEBABE);
+
+    detail::decoder decoder(frame.data(), frame.data() + length);
+    const auto type = decoder.get<std::uint16_t>();
+    BOOST_REQUIRE(header::is_compact(type));
+    header::compact_data msg(type, decoder);
+    BOOST_REQUIRE_EQUAL(msg.retransmission_count, 1);
+    BOOST_REQUIRE_EQUAL(msg.sequence_number, 0x5678);
+    BOOST_REQUIRE(msg.ack);
+    BOOST_REQUIRE_EQUAL(*msg.ack, 0xDEF0);
+    BOOST_REQUIRE(msg.window);
+    BOOST_REQUIRE_EQUAL(*msg.window, 42);
+    BOOST_REQUIRE_EQUAL(msg.connection_id, 0xCAFEBABE);
+    BOOST_REQUIRE_EQUAL(msg.congestion_echo, 5);
+}
+
+BOOST_AUTO_TEST_CASE(compact_data_without_ack)
+{
+    alignas(std::uint32_t) header::data_type frame;
+    detail::encoder encoder(frame.data(), frame.size());
+    // The window only goes along with an acknowledgement
+    header::compact_data(0, sequence_type(7), boost::none, std::uint16_t(42), 1).encode(encoder);
+
+    const auto length = frame.size() - encoder.size();
+    BOOST_REQUIRE_EQUAL(length, header::constant::compact_size);
+    BOOST_REQUIRE_EQUAL(header::size(frame.data()), length);
+
+    detail::decoder decoder(frame.data(), frame.data() + length);
+    const auto type = decoder.get<std::uint16_t>();
+    header::compact_data msg(type, decoder);
+    BOOST_REQUIRE_EQUAL(msg.sequence_number, 7);
+    BOOST_REQUIRE(!msg.ack);
+    BOOST_REQUIRE(!msg.window);
+    BOOST_REQUIRE_EQUAL(msg.connection_id, 1);
+}
+
+BOOST_AUTO_TEST_CASE(compact_ack_roundtrip)
+{
+    alignas(std::uint32_t) header::data_type frame;
+    detail::encoder encoder(frame.data(), frame.size());
+    header::compact_ack(sequence_type(0x10001), std::uint16_t(3), 0x00020001, 9).encode(encoder);
+
+    const auto length = frame.size() - encoder.size();
+    BOOST_REQUIRE_EQUAL(length, 10);
+    BOOST_REQUIRE_EQUAL(header::size(frame.data()), length);
+    BOOST_REQUIRE_EQUAL(header::connection_id(frame.data()), 0x00020001);
+
+    detail::decoder decoder(frame.data(), frame.data() + length);
+    const auto type = decoder.get<std::uint16_t>();
+    BOOST_REQUIRE_EQUAL(type & header::constant::mask_type, header::constant::type_compact_ack);
+    header::compact_ack msg(type, decoder);
+    BOOST_REQUIRE(msg.ack);
+    BOOST_REQUIRE_EQUAL(*msg.ack, 0x0001);
+    BOOST_REQUIRE(msg.window);
+    BOOST_REQUIRE_EQUAL(*msg.window, 3);
+    BOOST_REQUIRE_EQUAL(msg.congestion_echo, 9);
+}
+
+BOOST_AUTO_TEST_CASE(full_frames_keep_their_size)
+{
+    alignas(std::uint32_t) header::data_type frame;
+    detail::encoder encoder(frame.data(), frame.size());
+    header::data(0, sequence_type(1), boost::none, boost::none, 0x01020304).encode(encoder);
+
+    BOOST_REQUIRE(!header::is_compact(header::type(frame.data())));
+    BOOST_REQUIRE_EQUAL(header::size(frame.data()), header::constant::size);
+    BOOST_REQUIRE_EQUAL(header::connection_id(frame.data()), 0x01020304);
+}
+
+BOOST_AUTO_TEST_CASE(unknown_compact_frame)
+{
+    alignas(std::uint32_t) header::data_type frame = {{ 0x90, 0x00 }};
+    BOOST_REQUIRE(header::is_compact(header::type(frame.data())));
+    BOOST_REQUIRE_EQUAL(header::size(frame.data()), 0);
+}
+
+BOOST_AUTO_TEST_CASE(expand_sequence_number)
+{
+    // Either side of the expected one, across the wrap of the lower half
+    // and of the whole sequence number
+    BOOST_REQUIRE(header::expand(0x0005, sequence_type(0x0001FFFE)) == sequence_type(0x00020005));
+    BOOST_REQUIRE(header::expand(0xFFFE, sequence_type(0x00020005)) == sequence_type(0x0001FFFE));
+    BOOST_REQUIRE(header::expand(0x0001, sequence_type(0xFFFFFFF0)) == sequence_type(0x00000001));
+    BOOST_REQUIRE(header::expand(0xFFF0, sequence_type(0x00000001)) == sequence_type(0xFFFFFFF0));
+    BOOST_REQUIRE(header::expand(0x1234, sequence_type(0x00051234)) == sequence_type(0x00051234));
+}
+
+BOOST_AUTO_TEST_CASE(expand_ack_sequence_number)
+{
+    // Never after the last one sent
+    BOOST_REQUIRE(header::expand_ack(0x0005, sequence_type(0x00020005)) == sequence_type(0x00020005));
+    BOOST_REQUIRE(header::expand_ack(0x0006, sequence_type(0x00020005)) == sequence_type(0x00010006));
+    BOOST_REQUIRE(header::expand_ack(0xFFFF, sequence_type(0x00000002)) == sequence_type(0xFFFFFFFF));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
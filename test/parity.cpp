@@ -0,0 +1,138 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <maidsafe/crux/detail/parity.hpp>
+
+namespace asio = boost::asio;
+namespace detail = maidsafe::crux::detail;
+using sequence_type = detail::parity_window::sequence_type;
+
+namespace
+{
+
+std::shared_ptr<detail::payload_buffer> make_payload(const std::string& text,
+                                                     const detail::handler_allocator<char>& allocator)
+{
+    return std::allocate_shared<detail::payload_buffer>(allocator,
+                                                        text.begin(),
+                                                        text.end(),
+                                                        allocator);
+}
+
+std::string to_string(const detail::payload_buffer& payload)
+{
+    return std::string(payload.begin(), payload.end());
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(parity_suite)
+
+BOOST_AUTO_TEST_CASE(xor_into_any_size)
+{
+    // Sizes around the vector and word widths
+    for (std::size_t size = 0; size < 80; ++size)
+    {
+        std::vector<char> output(size);
+        std::vector<char> input(size);
+        std::vector<char> expected(size);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            output[i] = static_cast<char>(i * 7);
+            input[i] = static_cast<char>(i * 13 + 1);
+            expected[i] = output[i] ^ input[i];
+        }
+
+        detail::parity::xor_into(output.data(), input.data(), size);
+        BOOST_REQUIRE(output == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(recover_missing_frame)
+{
+    detail::handler_allocator<char> allocator(std::make_shared<detail::handler_memory>());
+    const std::array<std::string, 3> frames = {{ "alpha", "bravo!", "charlie" }};
+
+    detail::parity_encoder encoder;
+    for (const auto& frame : frames)
+    {
+        encoder.add(std::array<asio::const_buffer, 1>{{ asio::buffer(frame) }});
+    }
+    BOOST_REQUIRE_EQUAL(encoder.count(), frames.size());
+    const auto size_xor = encoder.size_xor();
+    const auto parity_data = encoder.release();
+    BOOST_REQUIRE_EQUAL(parity_data.size(), 7);
+    BOOST_REQUIRE_EQUAL(encoder.count(), 0);
+
+    const auto parity = make_payload(std::string(parity_data.begin(), parity_data.end()),
+                                     allocator);
+
+    // The second frame is missing and the third arrived ahead of it
+    const sequence_type first(100);
+    detail::parity_window window;
+    window.activate();
+    window.delivered(first, make_payload(frames[0], allocator));
+    BOOST_REQUIRE(window.hold(sequence_type(101), sequence_type(102), make_payload(frames[2], allocator)));
+
+    auto recovered = window.recover(sequence_type(101), first, 3, size_xor, *parity, allocator);
+    BOOST_REQUIRE(recovered);
+    BOOST_REQUIRE_EQUAL(to_string(*recovered), frames[1]);
+
+    // The held frame is handed on next
+    BOOST_REQUIRE(!window.take(sequence_type(101)));
+    auto held = window.take(sequence_type(102));
+    BOOST_REQUIRE(held);
+    BOOST_REQUIRE_EQUAL(to_string(*held), frames[2]);
+}
+
+BOOST_AUTO_TEST_CASE(recover_needs_rest_of_group)
+{
+    detail::handler_allocator<char> allocator(std::make_shared<detail::handler_memory>());
+
+    detail::parity_encoder encoder;
+    encoder.add(std::array<asio::const_buffer, 1>{{ asio::buffer(std::string("alpha")) }});
+    encoder.add(std::array<asio::const_buffer, 1>{{ asio::buffer(std::string("bravo")) }});
+    const auto size_xor = encoder.size_xor();
+    const auto parity_data = encoder.release();
+    const auto parity = make_payload(std::string(parity_data.begin(), parity_data.end()),
+                                     allocator);
+
+    detail::parity_window window;
+    window.activate();
+
+    // Both frames are missing
+    BOOST_REQUIRE(!window.recover(sequence_type(7), sequence_type(7), 2, size_xor, *parity, allocator));
+    // The expected frame is not in the group
+    window.delivered(sequence_type(7), make_payload("alpha", allocator));
+    window.delivered(sequence_type(8), make_payload("bravo", allocator));
+    BOOST_REQUIRE(!window.recover(sequence_type(9), sequence_type(7), 2, size_xor, *parity, allocator));
+}
+
+BOOST_AUTO_TEST_CASE(inactive_window_keeps_nothing)
+{
+    detail::handler_allocator<char> allocator(std::make_shared<detail::handler_memory>());
+
+    detail::parity_window window;
+    BOOST_REQUIRE(!window.hold(sequence_type(1), sequence_type(2), make_payload("x", allocator)));
+
+    window.activate();
+    // Too far ahead
+    BOOST_REQUIRE(!window.hold(sequence_type(1),
+                               sequence_type(1 + detail::constant::max_parity_group),
+                               make_payload("x", allocator)));
+    BOOST_REQUIRE(window.hold(sequence_type(1), sequence_type(2), make_payload("x", allocator)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <boost/test/unit_test.hpp>
+#include <maidsafe/crux/detail/roundtrip_estimator.hpp>
+
+using estimator_type = maidsafe::crux::detail::roundtrip_estimator;
+using milliseconds = std::chrono::milliseconds;
+
+BOOST_AUTO_TEST_SUITE(roundtrip_estimator_suite)
+
+BOOST_AUTO_TEST_CASE(initial_timeout)
+{
+    estimator_type estimator;
+
+    BOOST_REQUIRE(estimator.empty());
+    BOOST_REQUIRE(estimator.timeout() == maidsafe::crux::detail::constant::initial_roundtrip_time);
+}
+
+BOOST_AUTO_TEST_CASE(first_sample)
+{
+    estimator_type estimator;
+    estimator.sample(milliseconds(100));
+
+    BOOST_REQUIRE(!estimator.empty());
+    BOOST_REQUIRE(estimator.smoothed() == milliseconds(100));
+    BOOST_REQUIRE(estimator.variation() == milliseconds(50));
+    BOOST_REQUIRE(estimator.timeout() == milliseconds(300));
+}
+
+BOOST_AUTO_TEST_CASE(smoothing)
+{
+    estimator_type estimator;
+    estimator.sample(milliseconds(100));
+    estimator.sample(milliseconds(180));
+
+    // rttvar = 3/4 * 50 + 1/4 * 80, srtt = 7/8 * 100 + 1/8 * 180
+    BOOST_REQUIRE(estimator.variation() == milliseconds(57) + std::chrono::microseconds(500));
+    BOOST_REQUIRE(estimator.smoothed() == milliseconds(110));
+    BOOST_REQUIRE(estimator.timeout() == milliseconds(340));
+}
+
+BOOST_AUTO_TEST_CASE(stable_roundtrip)
+{
+    estimator_type estimator;
+    for (int i = 0; i != 100; ++i) {
+        estimator.sample(milliseconds(10));
+    }
+
+    BOOST_REQUIRE(estimator.smoothed() == milliseconds(10));
+    // The variation is bounded below by the clock granularity
+    BOOST_REQUIRE(estimator.timeout() == milliseconds(11));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,126 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <maidsafe/crux/detail/segmentation.hpp>
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
+#include <string>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+namespace asio = boost::asio;
+namespace segmentation = maidsafe::crux::detail::segmentation;
+using error_code = boost::system::error_code;
+using udp = asio::ip::udp;
+
+namespace
+{
+
+std::vector<asio::const_buffer> make_segments(const std::vector<std::string>& frames)
+{
+    std::vector<asio::const_buffer> result;
+    for (const auto& frame : frames)
+    {
+        result.push_back(asio::buffer(frame));
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+BOOST_AUTO_TEST_SUITE(segmentation_suite)
+
+BOOST_AUTO_TEST_CASE(coalesced_receive)
+{
+    asio::io_service ios;
+    udp::socket sender(ios, udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    udp::socket receiver(ios, udp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    if (!segmentation::enable_receive_offload(receiver.native_handle()))
+        return; // Kernel without UDP_GRO
+
+    const std::vector<std::string> frames = { "alpha", "bravo", "char" };
+    error_code error;
+    auto size = segmentation::send(sender.native_handle(),
+                                   make_segments(frames),
+                                   5,
+                                   receiver.local_endpoint(),
+                                   error);
+    if (error)
+        return; // Kernel without UDP_SEGMENT
+    BOOST_REQUIRE_EQUAL(size, 14);
+
+    std::string received(64, 'X');
+    udp::endpoint remote_endpoint;
+    std::size_t segment_size = 0;
+    std::uint32_t kernel_drops = 0;
+    std::chrono::steady_clock::time_point arrival;
+    std::uint8_t ecn = 0;
+    auto datagram_size = segmentation::receive(receiver.native_handle(),
+                                               { asio::buffer(&received[0], received.size()) },
+                                               remote_endpoint,
+                                               segment_size,
+                                               kernel_drops,
+                                               arrival,
+                                               ecn,
+                                               error);
+    BOOST_REQUIRE(!error);
+    BOOST_REQUIRE_EQUAL(datagram_size, 14);
+    BOOST_REQUIRE_EQUAL(segment_size, 5);
+    BOOST_REQUIRE_EQUAL(received.substr(0, datagram_size), "alphabravochar");
+    BOOST_REQUIRE_EQUAL(remote_endpoint, sender.local_endpoint());
+}
+
+BOOST_AUTO_TEST_CASE(segmented_without_receive_offload)
+{
+    asio::io_service ios;
+    udp::socket sender(ios, udp::endpoint(asio::ip::address_v4::loopback(), 0));
+    udp::socket receiver(ios, udp::endpoint(asio::ip::address_v4::loopback(), 0));
+
+    const std::vector<std::string> frames = { "alpha", "bravo", "char" };
+    error_code error;
+    segmentation::send(sender.native_handle(),
+                       make_segments(frames),
+                       5,
+                       receiver.local_endpoint(),
+                       error);
+    if (error)
+        return; // Kernel without UDP_SEGMENT
+
+    for (const auto& frame : frames)
+    {
+        std::string received(64, 'X');
+        udp::endpoint remote_endpoint;
+        std::size_t segment_size = 0;
+        std::uint32_t kernel_drops = 0;
+        std::chrono::steady_clock::time_point arrival;
+        std::uint8_t ecn = 0;
+        auto datagram_size = segmentation::receive(receiver.native_handle(),
+                                                   { asio::buffer(&received[0], received.size()) },
+                                                   remote_endpoint,
+                                                   segment_size,
+                                                   kernel_drops,
+                                                   arrival,
+                                                   ecn,
+                                                   error);
+        BOOST_REQUIRE(!error);
+        BOOST_REQUIRE_EQUAL(datagram_size, frame.size());
+        BOOST_REQUIRE_EQUAL(segment_size, 0);
+        BOOST_REQUIRE_EQUAL(received.substr(0, datagram_size), frame);
+        BOOST_REQUIRE_EQUAL(remote_endpoint, sender.local_endpoint());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
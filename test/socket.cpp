@@ -8,10 +8,20 @@
 //
 ///////////////////////////////////////////////////////////////////////////////
 
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
 #include <boost/test/unit_test.hpp>
 #include <boost/system/error_code.hpp>
 #include <maidsafe/crux/socket.hpp>
 #include <maidsafe/crux/acceptor.hpp>
+#include <maidsafe/crux/detail/ecn.hpp>
+#include <maidsafe/crux/detail/segmentation.hpp>
 
 namespace asio = boost::asio;
 using error_code    = boost::system::error_code;
@@ -21,6 +31,25 @@ static std::string to_string(const std::vector<char>& v) {
     return std::string(v.begin(), v.end());
 }
 
+// Handler that can be moved but not copied
+struct move_only_handler {
+    // Outlives the handler, which is destroyed once it has been called
+    std::shared_ptr<bool> called;
+    std::unique_ptr<int> move_only;
+
+    move_only_handler() : called(std::make_shared<bool>(false)) {}
+
+    void operator()(const error_code& error) {
+        BOOST_REQUIRE(!error);
+        *called = true;
+    }
+
+    void operator()(const error_code& error, std::size_t) {
+        BOOST_REQUIRE(!error);
+        *called = true;
+    }
+};
+
 BOOST_AUTO_TEST_SUITE(socket_suite)
 
 BOOST_AUTO_TEST_CASE(accept___connect)
@@ -504,11 +533,118 @@ BOOST_AUTO_TEST_CASE(accept_accept_close___connect)
     BOOST_REQUIRE(tested_client && tested_server);
 }
 
-// FIXME: At time of writing this comment we don't yet support
-// 'close' packets, so the only way to detect disconnection is
-// through keepalive timeouts. When 'close' packets are added
-// this test should be renamed.
-BOOST_AUTO_TEST_CASE(keepalive_timeout)
+BOOST_AUTO_TEST_CASE(accept_backlog)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    const std::size_t client_count = 3;
+    std::vector<std::unique_ptr<crux::socket>> client_sockets;
+    std::vector<std::unique_ptr<crux::socket>> server_sockets;
+    for (std::size_t i = 0; i < client_count; ++i) {
+        client_sockets.emplace_back(new crux::socket(ios, endpoint_type(udp::v4(), 0)));
+        server_sockets.emplace_back(new crux::socket(ios));
+    }
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    std::size_t accepted = 0;
+    std::size_t connected = 0;
+
+    // One accept request at a time, so the other handshakes must wait in
+    // the backlog rather than for their retransmission.
+    std::function<void()> accept_next = [&]() {
+        acceptor.async_accept(*server_sockets[accepted], [&](error_code error) {
+                BOOST_REQUIRE(!error);
+                if (++accepted < client_count) {
+                    accept_next();
+                }
+                });
+    };
+    accept_next();
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (auto& client_socket : client_sockets) {
+        client_socket->async_connect(acceptor.local_endpoint(), [&](error_code error) {
+                BOOST_REQUIRE(!error);
+                ++connected;
+                });
+    }
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(accepted, client_count);
+    BOOST_REQUIRE_EQUAL(connected, client_count);
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start
+                  < crux::detail::constant::initial_roundtrip_time);
+
+    // Every client got its own server socket
+    std::set<unsigned short> client_ports;
+    std::set<unsigned short> server_ports;
+    for (std::size_t i = 0; i < client_count; ++i) {
+        client_ports.insert(client_sockets[i]->local_endpoint().port());
+        server_ports.insert(server_sockets[i]->remote_endpoint().port());
+    }
+    BOOST_REQUIRE(client_ports == server_ports);
+}
+
+BOOST_AUTO_TEST_CASE(accept_backlog_full)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    const std::size_t client_count = 3;
+    std::vector<std::unique_ptr<crux::socket>> client_sockets;
+    std::vector<std::unique_ptr<crux::socket>> server_sockets;
+    for (std::size_t i = 0; i < client_count; ++i) {
+        client_sockets.emplace_back(new crux::socket(ios, endpoint_type(udp::v4(), 0)));
+        server_sockets.emplace_back(new crux::socket(ios));
+    }
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0), 1);
+
+    std::vector<std::chrono::steady_clock::time_point> accepted;
+    std::size_t connected = 0;
+
+    // One accept request at a time, and room for a single handshake to wait
+    // for the next one.
+    std::function<void()> accept_next = [&]() {
+        acceptor.async_accept(*server_sockets[accepted.size()], [&](error_code error) {
+                BOOST_REQUIRE(!error);
+                accepted.push_back(std::chrono::steady_clock::now());
+                if (accepted.size() < client_count) {
+                    accept_next();
+                }
+                });
+    };
+    accept_next();
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (auto& client_socket : client_sockets) {
+        client_socket->async_connect(acceptor.local_endpoint(), [&](error_code error) {
+                BOOST_REQUIRE(!error);
+                ++connected;
+                });
+    }
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(accepted.size(), client_count);
+    BOOST_REQUIRE_EQUAL(connected, client_count);
+
+    // One handshake waited in the backlog, and the last one was dropped
+    // and only accepted once the client had retransmitted it.
+    BOOST_REQUIRE(accepted[1] - start < crux::detail::constant::connect_initial_timeout);
+    BOOST_REQUIRE(accepted[2] - start >= crux::detail::constant::connect_initial_timeout);
+}
+
+BOOST_AUTO_TEST_CASE(move_only_handlers)
 {
     using namespace maidsafe;
     using udp = asio::ip::udp;
@@ -520,35 +656,1810 @@ BOOST_AUTO_TEST_CASE(keepalive_timeout)
 
     crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
 
-    bool tested_client = false;
-    bool tested_server = false;
+    const std::string message_text = "TEST_MESSAGE";
+    std::vector<char>  rx_data(message_text.size());
+    std::vector<char>  tx_data(message_text.begin(), message_text.end());
 
-    acceptor.async_accept
-        ( server_socket
-        , [&](error_code error) {
+    move_only_handler accept_handler;
+    move_only_handler connect_handler;
+    move_only_handler receive_handler;
+    move_only_handler send_handler;
+
+    auto accepted = accept_handler.called;
+    auto connected = connect_handler.called;
+    auto received = receive_handler.called;
+    auto sent = send_handler.called;
+
+    acceptor.async_accept(server_socket, std::move(accept_handler));
+    client_socket.async_connect(acceptor.local_endpoint(), std::move(connect_handler));
+
+    ios.run();
+    ios.reset();
+
+    BOOST_REQUIRE(*accepted && *connected);
+
+    server_socket.async_receive(asio::buffer(rx_data), std::move(receive_handler));
+    client_socket.async_send(asio::buffer(tx_data), std::move(send_handler));
+
+    ios.run();
+
+    BOOST_REQUIRE(*received && *sent);
+    BOOST_REQUIRE_EQUAL(to_string(rx_data), to_string(tx_data));
+}
+
+BOOST_AUTO_TEST_CASE(receive_budget)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::socket other_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    // Room for one message but not for two
+    server_socket.receive_budget(150);
+
+    const std::size_t message_count = 3;
+    std::vector<std::vector<char>> tx_data;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(100, char('a' + i)));
+    }
+    std::vector<char> rx_data(100);
+
+    std::size_t sent = 0;
+    std::size_t received = 0;
+    std::size_t sent_before_receive = 0;
+
+    std::function<void ()> receive_next = [&]() {
+        server_socket.async_receive(asio::buffer(rx_data),
+            [&](const error_code& error, std::size_t size) {
+              BOOST_REQUIRE(!error);
+              BOOST_REQUIRE_EQUAL(size, rx_data.size());
+              BOOST_REQUIRE_EQUAL(to_string(rx_data), to_string(tx_data[received]));
+              if (++received < message_count) {
+                  receive_next();
+              }
+              else {
+                  acceptor.close();
+              }
+            });
+    };
+
+    asio::steady_timer timer(ios);
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+
+            // A pending accept keeps the multiplexer receiving, so data
+            // for the server socket arrives before it asks for any.
+            acceptor.async_accept(other_socket, [](error_code) {});
+
+            // Let the client fill the budget before consuming anything
+            timer.expires_from_now(std::chrono::milliseconds(100));
+            timer.async_wait([&](error_code) {
+                    sent_before_receive = sent;
+                    receive_next();
+                    });
+            });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
               BOOST_VERIFY(!error);
 
-              server_socket.async_receive(
-                  asio::null_buffers(),
-                  [&](const error_code& error, size_t size) {
-                    BOOST_VERIFY(error);
-                    static_cast<void>(size);
-                    tested_server = true;
+              for (const auto& data : tx_data) {
+                  client_socket.async_send(asio::buffer(data),
+                      [&](error_code error, std::size_t size) {
+                        BOOST_REQUIRE(!error);
+                        BOOST_REQUIRE_EQUAL(size, 100);
+                        ++sent;
+                      });
+              }
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(sent_before_receive, 1);
+    BOOST_REQUIRE_EQUAL(sent, message_count);
+    BOOST_REQUIRE_EQUAL(received, message_count);
+}
+
+BOOST_AUTO_TEST_CASE(receive_message)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::socket other_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    const std::string message1_text = "message1";
+    const std::string message2_text = "message2";
+    std::vector<char> tx_data1(message1_text.begin(), message1_text.end());
+    std::vector<char> tx_data2(message2_text.begin(), message2_text.end());
+
+    std::vector<crux::socket::message_type> messages;
+
+    asio::steady_timer timer(ios);
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+
+            // A pending accept keeps the multiplexer receiving
+            acceptor.async_accept(other_socket, [](error_code) {});
+
+            // Posted before the first message arrives
+            server_socket.async_receive(
+                [&](const error_code& error, crux::socket::message_type message) {
+                  BOOST_REQUIRE(!error);
+                  messages.push_back(message);
+
+                  // Posted after the second message has arrived
+                  timer.expires_from_now(std::chrono::milliseconds(100));
+                  timer.async_wait([&](error_code) {
+                      server_socket.async_receive(
+                          [&](const error_code& error, crux::socket::message_type message) {
+                            BOOST_REQUIRE(!error);
+                            messages.push_back(message);
+                            acceptor.close();
+                          });
+                      });
+                });
+            });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              client_socket.async_send(asio::buffer(tx_data1),
+                  [&](error_code error, std::size_t) {
+                    BOOST_REQUIRE(!error);
                   });
-          });
+              client_socket.async_send(asio::buffer(tx_data2),
+                  [&](error_code error, std::size_t) {
+                    BOOST_REQUIRE(!error);
+                  });
+            });
 
-    client_socket.async_connect
-        ( acceptor.local_endpoint()
-        , [&](error_code error) {
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(messages.size(), 2);
+    BOOST_REQUIRE_EQUAL(std::string(messages[0]->begin(), messages[0]->end()), message1_text);
+    BOOST_REQUIRE_EQUAL(std::string(messages[1]->begin(), messages[1]->end()), message2_text);
+}
+
+BOOST_AUTO_TEST_CASE(receive_many)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::socket other_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    const std::size_t message_count = 5;
+    std::vector<std::vector<char>> tx_data;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(10, char('a' + i)));
+    }
+
+    std::vector<crux::socket::message_type> messages;
+    std::vector<std::size_t> batches;
+
+    asio::steady_timer timer(ios);
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
             BOOST_VERIFY(!error);
-            tested_client = true;
-            client_socket.close();
-          });
+
+            // A pending accept keeps the multiplexer receiving
+            acceptor.async_accept(other_socket, [](error_code) {});
+
+            // Nothing is queued yet, so this waits for the first message
+            server_socket.async_receive_many(messages, message_count,
+                [&](const error_code& error, std::size_t count) {
+                  BOOST_REQUIRE(!error);
+                  batches.push_back(count);
+
+                  // Let the remaining messages queue up
+                  timer.expires_from_now(std::chrono::milliseconds(100));
+                  timer.async_wait([&](error_code) {
+                      server_socket.async_receive_many(messages, message_count,
+                          [&](const error_code& error, std::size_t count) {
+                            BOOST_REQUIRE(!error);
+                            batches.push_back(count);
+                            acceptor.close();
+                          });
+                      });
+                });
+            });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              for (const auto& data : tx_data) {
+                  client_socket.async_send(asio::buffer(data),
+                      [&](error_code error, std::size_t) {
+                        BOOST_REQUIRE(!error);
+                      });
+              }
+            });
 
     ios.run();
 
-    BOOST_REQUIRE(tested_client);
-    BOOST_REQUIRE(tested_server);
+    BOOST_REQUIRE_EQUAL(batches.size(), 2);
+    BOOST_REQUIRE_EQUAL(batches[0], 1);
+    BOOST_REQUIRE_EQUAL(batches[1], message_count - 1);
+    BOOST_REQUIRE_EQUAL(messages.size(), message_count);
+    for (std::size_t i = 0; i < message_count; ++i) {
+        BOOST_REQUIRE_EQUAL(std::string(messages[i]->begin(), messages[i]->end()),
+                            to_string(tx_data[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(receive_arrival)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+    using clock_type = std::chrono::steady_clock;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::socket other_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    const std::string message_text = "message";
+    std::vector<char> tx_data(message_text.begin(), message_text.end());
+    std::vector<char> rx_data(tx_data.size());
+
+    clock_type::time_point started;
+    clock_type::time_point dispatched;
+    crux::socket::message_type message;
+    std::size_t acknowledged = 0;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+
+            // A pending accept keeps the multiplexer receiving
+            acceptor.async_accept(other_socket, [](error_code) {});
+        });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              started = clock_type::now();
+
+              auto on_send = [&](error_code error, std::size_t) {
+                  BOOST_REQUIRE(!error);
+                  if (++acknowledged < 2)
+                      return;
+
+                  // Both messages have arrived and wait for the application,
+                  // so they arrived before it posts its receives
+                  dispatched = clock_type::now();
+
+                  server_socket.async_receive(asio::buffer(rx_data),
+                      [&](error_code error, std::size_t) {
+                        BOOST_REQUIRE(!error);
+                      });
+                  server_socket.async_receive(
+                      [&](error_code error, crux::socket::message_type received) {
+                        BOOST_REQUIRE(!error);
+                        message = received;
+                        acceptor.close();
+                      });
+                };
+              client_socket.async_send(asio::buffer(tx_data), on_send);
+              client_socket.async_send(asio::buffer(tx_data), on_send);
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE(message);
+    BOOST_REQUIRE(server_socket.receive_arrival() >= started);
+    BOOST_REQUIRE(server_socket.receive_arrival() <= dispatched);
+    BOOST_REQUIRE(message->arrival >= started);
+    BOOST_REQUIRE(message->arrival <= dispatched);
+}
+
+BOOST_AUTO_TEST_CASE(send_shared)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    auto tx_data = std::make_shared<const std::vector<char>>(8000, 'x');
+    std::vector<char> rx_data(tx_data->size());
+    bool sent = false;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+
+            server_socket.async_receive(asio::buffer(rx_data),
+                [&](const error_code& error, std::size_t size) {
+                  BOOST_REQUIRE(!error);
+                  BOOST_REQUIRE_EQUAL(size, tx_data->size());
+                });
+            });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              client_socket.async_send_shared(tx_data,
+                  [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    BOOST_REQUIRE_EQUAL(size, tx_data->size());
+                    sent = true;
+                  });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE(sent);
+    BOOST_REQUIRE_EQUAL(to_string(rx_data), to_string(*tx_data));
+    // The socket no longer holds on to the message
+    BOOST_REQUIRE_EQUAL(tx_data.use_count(), 1);
 }
 
+BOOST_AUTO_TEST_CASE(send_many)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    const std::size_t message_count = 50;
+    std::vector<std::vector<char>> tx_data;
+    std::vector<asio::const_buffer> tx_buffers;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(100, char('a' + i % 26)));
+    }
+    for (const auto& data : tx_data) {
+        tx_buffers.push_back(asio::buffer(data));
+    }
+
+    std::vector<crux::socket::message_type> messages;
+    std::size_t completions = 0;
+    std::size_t acknowledged = 0;
+
+    std::function<void ()> receive_next = [&]() {
+        server_socket.async_receive_many(messages, message_count,
+            [&](const error_code& error, std::size_t) {
+              BOOST_REQUIRE(!error);
+              if (messages.size() < message_count) {
+                  receive_next();
+              }
+            });
+    };
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+            receive_next();
+            });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              client_socket.async_send_many(tx_buffers,
+                  [&](error_code error, std::size_t count) {
+                    BOOST_REQUIRE(!error);
+                    ++completions;
+                    acknowledged = count;
+                  });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(completions, 1);
+    BOOST_REQUIRE_EQUAL(acknowledged, message_count);
+    BOOST_REQUIRE_EQUAL(messages.size(), message_count);
+    for (std::size_t i = 0; i < message_count; ++i) {
+        BOOST_REQUIRE_EQUAL(std::string(messages[i]->begin(), messages[i]->end()),
+                            to_string(tx_data[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(send_many_beyond_window)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    // Twice the receive budget, so that the batch only fits the window of
+    // the server piece by piece
+    const std::size_t message_size = 1000;
+    const std::size_t message_count = 2 * server_socket.receive_budget() / message_size;
+    std::vector<std::vector<char>> tx_data;
+    std::vector<asio::const_buffer> tx_buffers;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(message_size, char('a' + i % 26)));
+    }
+    for (const auto& data : tx_data) {
+        tx_buffers.push_back(asio::buffer(data));
+    }
+
+    std::vector<crux::socket::message_type> messages;
+    std::size_t acknowledged = 0;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration elapsed;
+
+    std::function<void ()> receive_next = [&]() {
+        server_socket.async_receive_many(messages, message_count,
+            [&](const error_code& error, std::size_t) {
+              BOOST_REQUIRE(!error);
+              if (messages.size() < message_count) {
+                  receive_next();
+              }
+            });
+    };
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+            receive_next();
+            });
+
+    client_socket.async_connect(
+            acceptor.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              start = std::chrono::steady_clock::now();
+              client_socket.async_send_many(tx_buffers,
+                  [&](error_code error, std::size_t count) {
+                    BOOST_REQUIRE(!error);
+                    elapsed = std::chrono::steady_clock::now() - start;
+                    acknowledged = count;
+                  });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(acknowledged, message_count);
+    BOOST_REQUIRE_EQUAL(messages.size(), message_count);
+    for (std::size_t i = 0; i < message_count; ++i) {
+        BOOST_REQUIRE_EQUAL(std::string(messages[i]->begin(), messages[i]->end()),
+                            to_string(tx_data[i]));
+    }
+
+    // Sent as the window opened rather than when the retransmission timer
+    // expired
+    BOOST_REQUIRE(elapsed < crux::detail::constant::initial_roundtrip_time);
+}
+
+BOOST_AUTO_TEST_CASE(connect_timeout)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+    using std::chrono::milliseconds;
+
+    asio::io_service ios;
+
+    // Never answers
+    udp::socket silent(ios, endpoint_type(udp::v4(), 0));
+    const endpoint_type silent_endpoint(asio::ip::address_v4::loopback(),
+                                        silent.local_endpoint().port());
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+
+    // Limited by attempts: 20 + 40 + 80 + 80 ms
+    client_socket.connect_schedule(crux::socket::retransmission_schedule
+                                   (milliseconds(20), milliseconds(80), 4, milliseconds(10000)));
+
+    error_code connect_error;
+    auto start = std::chrono::steady_clock::now();
+    client_socket.async_connect(silent_endpoint, [&](error_code error) {
+            connect_error = error;
+            });
+    ios.run();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    BOOST_REQUIRE_EQUAL(connect_error, asio::error::timed_out);
+    BOOST_REQUIRE(elapsed >= milliseconds(220));
+    BOOST_REQUIRE(elapsed < crux::detail::constant::initial_roundtrip_time);
+
+    std::size_t handshakes = 0;
+    silent.non_blocking(true);
+    for (;;) {
+        std::array<char, 64> datagram;
+        endpoint_type sender;
+        error_code error;
+        silent.receive_from(asio::buffer(datagram), sender, 0, error);
+        if (error) break;
+        ++handshakes;
+    }
+    BOOST_REQUIRE_EQUAL(handshakes, 4);
+
+    // Limited by the deadline, and the socket may connect again
+    client_socket.connect_schedule(crux::socket::retransmission_schedule
+                                   (milliseconds(20), milliseconds(20), 1000, milliseconds(150)));
+
+    connect_error = error_code();
+    start = std::chrono::steady_clock::now();
+    client_socket.async_connect(silent_endpoint, [&](error_code error) {
+            connect_error = error;
+            });
+    ios.reset();
+    ios.run();
+    elapsed = std::chrono::steady_clock::now() - start;
+
+    BOOST_REQUIRE_EQUAL(connect_error, asio::error::timed_out);
+    BOOST_REQUIRE(elapsed >= milliseconds(150));
+    BOOST_REQUIRE(elapsed < crux::detail::constant::initial_roundtrip_time);
+}
+
+BOOST_AUTO_TEST_CASE(connect_any)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    // An endpoint that never answers comes first
+    udp::socket silent(ios, endpoint_type(udp::v4(), 0));
+    const endpoint_type silent_endpoint(asio::ip::address_v4::loopback(),
+                                        silent.local_endpoint().port());
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    const endpoint_type acceptor_endpoint(asio::ip::address_v4::loopback(),
+                                          acceptor.local_endpoint().port());
+
+    client_socket.connect_attempt_delay(std::chrono::milliseconds(50));
+
+    bool accepted = false;
+    bool connected = false;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            accepted = true;
+            });
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<endpoint_type> endpoints{ silent_endpoint, acceptor_endpoint };
+    client_socket.async_connect_any(endpoints, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            connected = true;
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE(accepted);
+    BOOST_REQUIRE(connected);
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start
+                  < crux::detail::constant::initial_roundtrip_time);
+    BOOST_REQUIRE_EQUAL(client_socket.remote_endpoint(), acceptor_endpoint);
+    BOOST_REQUIRE_EQUAL(server_socket.remote_endpoint().port(),
+                        client_socket.local_endpoint().port());
+
+    // The silent endpoint was tried first
+    std::array<char, 64> datagram;
+    endpoint_type sender;
+    silent.non_blocking(true);
+    error_code error;
+    silent.receive_from(asio::buffer(datagram), sender, 0, error);
+    BOOST_REQUIRE(!error);
+}
+
+
+BOOST_AUTO_TEST_CASE(resume_connect)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    // Separate io_services, so that either side can be run on its own
+    asio::io_service client_ios;
+    asio::io_service server_ios;
+
+    crux::acceptor acceptor(server_ios, endpoint_type(udp::v4(), 0));
+    const endpoint_type acceptor_endpoint(asio::ip::address_v4::loopback(),
+                                          acceptor.local_endpoint().port());
+
+    auto run_until = [&](const std::function<bool ()>& done) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done() && std::chrono::steady_clock::now() < deadline) {
+            client_ios.poll();
+            server_ios.poll();
+            client_ios.reset();
+            server_ios.reset();
+        }
+        return done();
+    };
+
+    const std::string message = "resumed";
+    std::array<char, 64> buffer;
+    std::size_t received = 0;
+
+    // The first connection completes the full handshake, and the ticket
+    // arrives before any data. The server side stays open, because the
+    // acceptor closes along with its last socket.
+    crux::socket first_server_socket(server_ios);
+    {
+        crux::socket client_socket(client_ios, endpoint_type(udp::v4(), 0));
+        bool connected = false;
+
+        acceptor.async_accept(first_server_socket, [&](error_code error) {
+                BOOST_REQUIRE(!error);
+                first_server_socket.async_send(asio::buffer(message),
+                                         [](error_code, std::size_t) {});
+                });
+        client_socket.async_connect(acceptor_endpoint, [&](error_code error) {
+                BOOST_REQUIRE(!error);
+                connected = true;
+                client_socket.async_receive(asio::buffer(buffer),
+                                            [&](error_code error, std::size_t size) {
+                        BOOST_REQUIRE(!error);
+                        received = size;
+                        });
+                });
+
+        BOOST_REQUIRE(run_until([&] { return received > 0; }));
+        BOOST_REQUIRE(connected);
+    }
+
+    // The second connection is established without hearing from the
+    // acceptor, and data sent right away is delivered.
+    crux::socket client_socket(client_ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(server_ios);
+    bool accepted = false;
+    bool connected = false;
+    received = 0;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            accepted = true;
+            server_socket.async_receive(asio::buffer(buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    received = size;
+                    });
+            });
+    client_socket.async_connect(acceptor_endpoint, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            connected = true;
+            client_socket.async_send(asio::buffer(message),
+                                     [](error_code, std::size_t) {});
+            });
+
+    client_ios.poll();
+    BOOST_REQUIRE(connected);
+    BOOST_REQUIRE(!accepted);
+
+    BOOST_REQUIRE(run_until([&] { return received > 0; }));
+    BOOST_REQUIRE_EQUAL(std::string(buffer.data(), received), message);
+    BOOST_REQUIRE_EQUAL(server_socket.remote_endpoint().port(),
+                        client_socket.local_endpoint().port());
+}
+
+
+BOOST_AUTO_TEST_CASE(connect_with_message)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    const std::string request = "request";
+    const std::string response = "response";
+    std::array<char, 64> server_buffer;
+    std::array<char, 64> client_buffer;
+    std::size_t requested = 0;
+    std::size_t responded = 0;
+
+    // Too large to fit into the handshake datagram
+    std::vector<char> oversized(crux::detail::constant::max_datagram_size);
+    client_socket.async_connect(acceptor.local_endpoint(),
+                                asio::buffer(oversized),
+                                [&](error_code error) {
+            BOOST_REQUIRE_EQUAL(error, asio::error::message_size);
+            });
+    ios.run();
+    ios.reset();
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            server_socket.async_receive(asio::buffer(server_buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    requested = size;
+                    server_socket.async_send(asio::buffer(response),
+                                             [](error_code, std::size_t) {});
+                    });
+            });
+
+    client_socket.async_connect(acceptor.local_endpoint(),
+                                asio::buffer(request),
+                                [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            client_socket.async_receive(asio::buffer(client_buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    responded = size;
+                    client_socket.close();
+                    server_socket.close();
+                    });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(std::string(server_buffer.data(), requested), request);
+    BOOST_REQUIRE_EQUAL(std::string(client_buffer.data(), responded), response);
+}
+
+
+BOOST_AUTO_TEST_CASE(rebind_connection)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    const auto loopback = asio::ip::address_v4::loopback();
+    const endpoint_type acceptor_endpoint(loopback, acceptor.local_endpoint().port());
+
+    // Stands in for a NAT between the client and the acceptor, which moves
+    // the client to another port while the connection is established.
+    udp::socket outside(ios, endpoint_type(loopback, 0));
+    udp::socket first_port(ios, endpoint_type(loopback, 0));
+    udp::socket second_port(ios, endpoint_type(loopback, 0));
+    udp::socket *inside = &first_port;
+
+    std::array<char, 2048> outside_buffer;
+    std::array<char, 2048> first_buffer;
+    std::array<char, 2048> second_buffer;
+    endpoint_type client_endpoint;
+    endpoint_type first_sender;
+    endpoint_type second_sender;
+
+    std::function<void ()> forward_out;
+    std::function<void (udp::socket&, std::array<char, 2048>&, endpoint_type&)> forward_in;
+
+    forward_out = [&] {
+        outside.async_receive_from(asio::buffer(outside_buffer),
+                                   client_endpoint,
+                                   [&](error_code error, std::size_t size) {
+                if (error) return;
+                inside->send_to(asio::buffer(outside_buffer, size), acceptor_endpoint);
+                forward_out();
+                });
+    };
+    forward_in = [&](udp::socket& port, std::array<char, 2048>& buffer, endpoint_type& sender) {
+        port.async_receive_from(asio::buffer(buffer),
+                                sender,
+                                [&](error_code error, std::size_t size) {
+                if (error) return;
+                outside.send_to(asio::buffer(buffer, size), client_endpoint);
+                forward_in(port, buffer, sender);
+                });
+    };
+    forward_out();
+    forward_in(first_port, first_buffer, first_sender);
+    forward_in(second_port, second_buffer, second_sender);
+
+    const std::string first = "first";
+    const std::string second = "second";
+    const std::string reply = "reply";
+    std::array<char, 64> server_buffer;
+    std::array<char, 64> client_buffer;
+    std::size_t replied = 0;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            BOOST_REQUIRE_EQUAL(server_socket.remote_endpoint().port(),
+                                first_port.local_endpoint().port());
+            server_socket.async_receive(asio::buffer(server_buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    BOOST_REQUIRE_EQUAL(std::string(server_buffer.data(), size), first);
+                    // The old mapping is gone
+                    inside = &second_port;
+                    first_port.close();
+
+                    server_socket.async_receive(asio::buffer(server_buffer),
+                                                [&](error_code error, std::size_t size) {
+                            BOOST_REQUIRE(!error);
+                            BOOST_REQUIRE_EQUAL(std::string(server_buffer.data(), size), second);
+                            server_socket.async_send(asio::buffer(reply),
+                                                     [](error_code, std::size_t) {});
+                            });
+                    });
+            });
+
+    client_socket.async_connect(outside.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            client_socket.async_send(asio::buffer(first), [&](error_code error, std::size_t) {
+                    BOOST_REQUIRE(!error);
+                    client_socket.async_send(asio::buffer(second),
+                                             [](error_code, std::size_t) {});
+                    });
+            client_socket.async_receive(asio::buffer(client_buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    replied = size;
+                    // Replies follow the client to its new port once it has
+                    // answered from there
+                    BOOST_REQUIRE_EQUAL(server_socket.remote_endpoint().port(),
+                                        second_port.local_endpoint().port());
+                    client_socket.close();
+                    server_socket.close();
+                    outside.close();
+                    second_port.close();
+                    });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(std::string(client_buffer.data(), replied), reply);
+}
+
+
+BOOST_AUTO_TEST_CASE(rebind_unanswered_challenge)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    const auto loopback = asio::ip::address_v4::loopback();
+    const endpoint_type acceptor_endpoint(loopback, acceptor.local_endpoint().port());
+
+    // Frames from the client also arrive from a second port, which cannot
+    // receive, like frames whose sender has been spoofed.
+    udp::socket outside(ios, endpoint_type(loopback, 0));
+    udp::socket first_port(ios, endpoint_type(loopback, 0));
+    udp::socket second_port(ios, endpoint_type(loopback, 0));
+    udp::socket *inside = &first_port;
+
+    std::array<char, 2048> outside_buffer;
+    std::array<char, 2048> first_buffer;
+    endpoint_type client_endpoint;
+    endpoint_type first_sender;
+
+    std::function<void ()> forward_out;
+    std::function<void ()> forward_in;
+
+    forward_out = [&] {
+        outside.async_receive_from(asio::buffer(outside_buffer),
+                                   client_endpoint,
+                                   [&](error_code error, std::size_t size) {
+                if (error) return;
+                inside->send_to(asio::buffer(outside_buffer, size), acceptor_endpoint);
+                forward_out();
+                });
+    };
+    forward_in = [&] {
+        first_port.async_receive_from(asio::buffer(first_buffer),
+                                      first_sender,
+                                      [&](error_code error, std::size_t size) {
+                if (error) return;
+                outside.send_to(asio::buffer(first_buffer, size), client_endpoint);
+                forward_in();
+                });
+    };
+    forward_out();
+    forward_in();
+
+    const std::string first = "first";
+    const std::string second = "second";
+    const std::string reply = "reply";
+    std::array<char, 64> server_buffer;
+    std::array<char, 64> client_buffer;
+    std::size_t replied = 0;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            server_socket.async_receive(asio::buffer(server_buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    BOOST_REQUIRE_EQUAL(std::string(server_buffer.data(), size), first);
+                    inside = &second_port;
+
+                    server_socket.async_receive(asio::buffer(server_buffer),
+                                                [&](error_code error, std::size_t size) {
+                            BOOST_REQUIRE(!error);
+                            BOOST_REQUIRE_EQUAL(std::string(server_buffer.data(), size), second);
+                            server_socket.async_send(asio::buffer(reply),
+                                                     [](error_code, std::size_t) {});
+                            });
+                    });
+            });
+
+    client_socket.async_connect(outside.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            client_socket.async_send(asio::buffer(first), [&](error_code error, std::size_t) {
+                    BOOST_REQUIRE(!error);
+                    client_socket.async_send(asio::buffer(second),
+                                             [](error_code, std::size_t) {});
+                    });
+            client_socket.async_receive(asio::buffer(client_buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    replied = size;
+                    // The second port never answered the challenge
+                    BOOST_REQUIRE_EQUAL(server_socket.remote_endpoint().port(),
+                                        first_port.local_endpoint().port());
+                    client_socket.close();
+                    server_socket.close();
+                    outside.close();
+                    first_port.close();
+                    second_port.close();
+                    });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(std::string(client_buffer.data(), replied), reply);
+}
+
+
+BOOST_AUTO_TEST_CASE(shutdown___receive_eof)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    const std::string message = "goodbye";
+    std::array<char, 64> buffer;
+    std::size_t received = 0;
+    bool shut_down = false;
+    bool end_of_file = false;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            server_socket.async_receive(asio::buffer(buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    received = size;
+                    server_socket.async_receive(asio::buffer(buffer),
+                                                [&](error_code error, std::size_t) {
+                            BOOST_REQUIRE_EQUAL(error, asio::error::eof);
+                            end_of_file = true;
+                            server_socket.async_send(asio::buffer(message),
+                                                     [&](error_code error, std::size_t) {
+                                    BOOST_REQUIRE_EQUAL(error, asio::error::shut_down);
+                                    server_socket.close();
+                                    });
+                            });
+                    });
+            });
+
+    client_socket.async_connect(acceptor.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            client_socket.async_send(asio::buffer(message), [](error_code, std::size_t) {});
+            // The message is delivered before the shutdown
+            client_socket.async_shutdown([&](error_code error) {
+                    BOOST_REQUIRE(!error);
+                    shut_down = true;
+                    });
+            client_socket.async_send(asio::buffer(message), [&](error_code error, std::size_t) {
+                    BOOST_REQUIRE_EQUAL(error, asio::error::shut_down);
+                    });
+            });
+
+    const auto start = std::chrono::steady_clock::now();
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(std::string(buffer.data(), received), message);
+    BOOST_REQUIRE(shut_down);
+    BOOST_REQUIRE(end_of_file);
+    // Without waiting for the keepalive to time out
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - start
+                  < maidsafe::crux::detail::constant::keepalive_timeout);
+}
+
+BOOST_AUTO_TEST_CASE(shutdown_linger)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    bool timed_out = false;
+    int connected = 0;
+
+    auto shutdown = [&] {
+        if (++connected < 2) return;
+        // Nobody acknowledges the shutdown
+        server_socket.close();
+        client_socket.linger(std::chrono::milliseconds(100));
+        client_socket.async_shutdown([&](error_code error) {
+                BOOST_REQUIRE_EQUAL(error, asio::error::timed_out);
+                timed_out = true;
+                });
+    };
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            shutdown();
+            });
+
+    client_socket.async_connect(acceptor.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            shutdown();
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE(timed_out);
+}
+
+BOOST_AUTO_TEST_CASE(keepalive_probes)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+    using std::chrono::milliseconds;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    // Idle for many times the idle time while both sides answer probes
+    asio::steady_timer idle_timer(ios);
+
+    const std::string message = "still there";
+    std::array<char, 64> buffer;
+    std::size_t received = 0;
+    std::chrono::steady_clock::time_point closed;
+    error_code dead_peer_error;
+    int connected = 0;
+
+    auto idle = [&] {
+        if (++connected < 2) return;
+        idle_timer.expires_from_now(milliseconds(1000));
+        idle_timer.async_wait([&](error_code) {
+                server_socket.async_receive(asio::buffer(buffer),
+                                            [&](error_code error, std::size_t size) {
+                        BOOST_REQUIRE(!error);
+                        received = size;
+                        // The client goes away without a word
+                        closed = std::chrono::steady_clock::now();
+                        client_socket.close();
+                        server_socket.async_receive(asio::buffer(buffer),
+                                                    [&](error_code error, std::size_t) {
+                                dead_peer_error = error;
+                                });
+                        });
+                client_socket.async_send(asio::buffer(message), [](error_code, std::size_t) {});
+                });
+    };
+
+    for (auto socket : { &client_socket, &server_socket }) {
+        socket->keepalive(true);
+        socket->keepalive_idle(milliseconds(100));
+        socket->keepalive_probes(3);
+    }
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            idle();
+            });
+
+    client_socket.async_connect(acceptor.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            idle();
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(std::string(buffer.data(), received), message);
+    BOOST_REQUIRE_EQUAL(dead_peer_error, asio::error::timed_out);
+    // Idle time plus three probes at the minimum interval
+    BOOST_REQUIRE(std::chrono::steady_clock::now() - closed < milliseconds(2000));
+}
+
+// Unlike async_shutdown, closing a socket sends nothing, so the remote
+// endpoint only finds out through keepalive timeouts.
+BOOST_AUTO_TEST_CASE(close___keepalive_timeout)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    bool tested_client = false;
+    bool tested_server = false;
+
+    acceptor.async_accept
+        ( server_socket
+        , [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              server_socket.async_receive(
+                  asio::null_buffers(),
+                  [&](const error_code& error, size_t size) {
+                    BOOST_REQUIRE_EQUAL(error, asio::error::timed_out);
+                    static_cast<void>(size);
+                    tested_server = true;
+                  });
+          });
+
+    client_socket.async_connect
+        ( acceptor.local_endpoint()
+        , [&](error_code error) {
+            BOOST_VERIFY(!error);
+            tested_client = true;
+            client_socket.close();
+          });
+
+    ios.run();
+
+    BOOST_REQUIRE(tested_client);
+    BOOST_REQUIRE(tested_server);
+}
+
+#if defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+
+BOOST_AUTO_TEST_CASE(udp_statistics___kernel_drops)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket server_socket(ios);
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+
+    acceptor.async_accept(server_socket, [](error_code) {});
+
+    auto statistics = server_socket.udp_statistics();
+    BOOST_REQUIRE_EQUAL(statistics.kernel_drops, 0u);
+    BOOST_REQUIRE(statistics.receive_buffer_size > 0);
+    BOOST_REQUIRE(statistics.send_buffer_size > 0);
+
+    // More than the receive buffer holds arrives while nobody receives
+    udp::socket flood(ios, endpoint_type(udp::v4(), 0));
+    const endpoint_type target(asio::ip::address_v4::loopback(),
+                               acceptor.local_endpoint().port());
+    std::vector<char> junk(1024);
+    for (std::size_t sent = 0; sent < 4 * statistics.receive_buffer_size; sent += junk.size()) {
+        flood.send_to(asio::buffer(junk), target);
+    }
+
+    // The first datagram after the drops tells how many there were
+    while (ios.poll() > 0) {}
+    flood.send_to(asio::buffer(junk), target);
+    while (ios.poll() > 0) {}
+
+    BOOST_REQUIRE(server_socket.udp_statistics().kernel_drops > 0);
+
+    acceptor.close();
+}
+
+#endif // defined(MAIDSAFE_CRUX_HAS_DROP_COUNT)
+
+// Forwards datagrams between a client and a server as a router would, and
+// drops those towards the server that the test picks.
+struct relay {
+    using drop_predicate = std::function<bool (const char*, std::size_t)>;
+
+    relay(asio::io_service& ios, const endpoint_type& server)
+        : client_side(ios, endpoint_type(asio::ip::address_v4::loopback(), 0))
+        , server_side(ios, endpoint_type(asio::ip::address_v4::loopback(), 0))
+        , server(server)
+        , from_client(65536)
+        , from_server(65536)
+        , dropped(0)
+    {
+        forward_from_client();
+        forward_from_server();
+    }
+
+    void forward_from_client() {
+        client_side.async_receive_from(asio::buffer(from_client), client,
+            [this](error_code error, std::size_t size) {
+                if (error)
+                    return;
+                if (drop && drop(from_client.data(), size)) {
+                    ++dropped;
+                }
+                else {
+                    server_side.send_to(asio::buffer(from_client.data(), size), server, 0, error);
+                }
+                forward_from_client();
+            });
+    }
+
+    void forward_from_server() {
+        server_side.async_receive_from(asio::buffer(from_server), sender,
+            [this](error_code error, std::size_t size) {
+                if (error)
+                    return;
+                client_side.send_to(asio::buffer(from_server.data(), size), client, 0, error);
+                forward_from_server();
+            });
+    }
+
+    void close() {
+        client_side.close();
+        server_side.close();
+    }
+
+    asio::ip::udp::socket client_side;
+    asio::ip::udp::socket server_side;
+    endpoint_type server;
+    endpoint_type client;
+    endpoint_type sender;
+    std::vector<char> from_client;
+    std::vector<char> from_server;
+    drop_predicate drop;
+    std::size_t dropped;
+};
+
+BOOST_AUTO_TEST_CASE(resume_connect_replay)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    relay relay(ios, endpoint_type(asio::ip::address_v4::loopback(),
+                                   acceptor.local_endpoint().port()));
+
+    crux::socket first_client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+
+    // The relay records what the second client sends without dropping
+    // anything
+    std::vector<std::vector<char>> recorded;
+    const auto client_port = client_socket.local_endpoint().port();
+    relay.drop = [&](const char* data, std::size_t size) {
+        if (relay.client.port() == client_port)
+            recorded.emplace_back(data, data + size);
+        return false;
+    };
+
+    auto run_until = [&](const std::function<bool ()>& done) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done() && std::chrono::steady_clock::now() < deadline) {
+            ios.poll();
+            ios.reset();
+        }
+        return done();
+    };
+
+    const std::string message = "resumed";
+    std::array<char, 64> buffer;
+    std::size_t received = 0;
+
+    // The full handshake, and the ticket arrives before any data
+    crux::socket first_server_socket(ios);
+
+    acceptor.async_accept(first_server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            first_server_socket.async_send(asio::buffer(message),
+                                           [](error_code, std::size_t) {});
+            });
+    first_client_socket.async_connect(relay.client_side.local_endpoint(),
+                                      [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            first_client_socket.async_receive(asio::buffer(buffer),
+                                              [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    received = size;
+                    });
+            });
+    BOOST_REQUIRE(run_until([&] { return received > 0; }));
+
+    // The resumed handshake. The first connection stays open, so the relay
+    // forwards from another port.
+    relay.server_side.close();
+    relay.server_side = udp::socket(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+    relay.forward_from_server();
+
+    crux::socket server_socket(ios);
+    received = 0;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            server_socket.async_receive(asio::buffer(buffer),
+                                        [&](error_code error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    received = size;
+                    });
+            });
+    client_socket.async_connect(relay.client_side.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            client_socket.async_send(asio::buffer(message),
+                                     [](error_code, std::size_t) {});
+            });
+    BOOST_REQUIRE(run_until([&] { return received > 0; }));
+    BOOST_REQUIRE(!recorded.empty());
+
+    // Replayed from another port of the same address, the handshake is
+    // answered with a cookie instead of being accepted again.
+    crux::socket replay_socket(ios);
+    bool replay_accepted = false;
+    acceptor.async_accept(replay_socket, [&](error_code error) {
+            if (!error)
+                replay_accepted = true;
+            });
+
+    udp::socket attacker(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+    attacker.send_to(asio::buffer(recorded.front()), relay.server);
+
+    std::array<char, 256> reply;
+    endpoint_type sender;
+    std::size_t reply_size = 0;
+    attacker.async_receive_from(asio::buffer(reply), sender,
+                                [&](error_code error, std::size_t size) {
+            BOOST_REQUIRE(!error);
+            reply_size = size;
+            });
+    BOOST_REQUIRE(run_until([&] { return reply_size > 0; }));
+    BOOST_REQUIRE(!replay_accepted);
+    BOOST_REQUIRE_EQUAL(replay_socket.remote_endpoint(), endpoint_type());
+
+    // Abort the accept request while the sockets are still around
+    acceptor.close();
+}
+
+#if defined(MAIDSAFE_CRUX_HAS_ECN)
+
+BOOST_AUTO_TEST_CASE(congestion_marks)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+    crux::socket other_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    relay relay(ios, endpoint_type(asio::ip::address_v4::loopback(),
+                                   acceptor.local_endpoint().port()));
+
+    // Towards the server the relay marks datagrams congestion experienced
+    int tos = maidsafe::crux::detail::ecn::congestion_experienced;
+    ::setsockopt(relay.server_side.native_handle(), IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+    const std::size_t message_count = 10;
+    std::vector<char> tx_data(100);
+    std::size_t sent = 0;
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+
+            // A pending accept keeps the multiplexer receiving
+            acceptor.async_accept(other_socket, [](error_code) {});
+        });
+
+    // One message at a time, so that every acknowledgement echoes a mark
+    std::function<void()> send = [&]() {
+        client_socket.async_send(asio::buffer(tx_data),
+            [&](error_code error, std::size_t) {
+              BOOST_REQUIRE(!error);
+              if (++sent < message_count) {
+                  send();
+                  return;
+              }
+              acceptor.close();
+              relay.close();
+            });
+    };
+
+    client_socket.async_connect(relay.client_side.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+              send();
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(sent, message_count);
+    BOOST_REQUIRE(server_socket.congestion_statistics().marks_received >= message_count);
+    BOOST_REQUIRE(client_socket.congestion_statistics().marks_echoed >= message_count);
+    BOOST_REQUIRE(client_socket.congestion_statistics().marks_echoed
+                  <= server_socket.congestion_statistics().marks_received);
+    // The way back is not congested
+    BOOST_REQUIRE_EQUAL(client_socket.congestion_statistics().marks_received, 0u);
+    BOOST_REQUIRE_EQUAL(server_socket.congestion_statistics().marks_echoed, 0u);
+}
+
+#endif // defined(MAIDSAFE_CRUX_HAS_ECN)
+
+BOOST_AUTO_TEST_CASE(forward_error_correction)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    relay relay(ios, endpoint_type(asio::ip::address_v4::loopback(),
+                                   acceptor.local_endpoint().port()));
+
+    // The second data frame of the batch goes missing
+    std::size_t data_frames = 0;
+    relay.drop = [&](const char* data, std::size_t size) {
+        if (size < 2)
+            return false;
+        namespace constant = crux::detail::header::constant;
+        const auto type = (std::uint16_t(std::uint8_t(data[0])) << 8) | std::uint8_t(data[1]);
+        if ((type & constant::mask_type) != constant::type_data
+            && (type & constant::mask_type) != constant::type_compact_data)
+            return false;
+        return ++data_frames == 3;
+    };
+
+    client_socket.forward_error_correction(4);
+
+    const std::size_t message_count = 4;
+    std::vector<std::vector<char>> tx_data;
+    std::vector<asio::const_buffer> tx_buffers;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(100 + i, char('a' + i)));
+    }
+    for (const auto& data : tx_data) {
+        tx_buffers.push_back(asio::buffer(data));
+    }
+    std::vector<char> first_data(10, 'z');
+
+    std::vector<crux::socket::message_type> messages;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration elapsed;
+
+    std::function<void ()> receive_next = [&]() {
+        server_socket.async_receive_many(messages, message_count + 1,
+            [&](const error_code& error, std::size_t) {
+              BOOST_REQUIRE(!error);
+              if (messages.size() < message_count + 1) {
+                  receive_next();
+                  return;
+              }
+              elapsed = std::chrono::steady_clock::now() - start;
+              acceptor.close();
+              relay.close();
+              client_socket.close();
+              server_socket.close();
+            });
+    };
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+            receive_next();
+            });
+
+    client_socket.async_connect(relay.client_side.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+
+              // The parity of the first message tells the server to keep
+              // frames for reconstruction
+              client_socket.async_send(asio::buffer(first_data),
+                  [&](error_code error, std::size_t) {
+                    BOOST_REQUIRE(!error);
+                    start = std::chrono::steady_clock::now();
+                    client_socket.async_send_many(tx_buffers,
+                        [](error_code, std::size_t) {});
+                  });
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(relay.dropped, 1);
+    BOOST_REQUIRE_EQUAL(messages.size(), message_count + 1);
+    BOOST_REQUIRE_EQUAL(std::string(messages[0]->begin(), messages[0]->end()),
+                        to_string(first_data));
+    for (std::size_t i = 0; i < message_count; ++i) {
+        BOOST_REQUIRE_EQUAL(std::string(messages[i + 1]->begin(), messages[i + 1]->end()),
+                            to_string(tx_data[i]));
+    }
+    BOOST_REQUIRE_EQUAL(server_socket.recovered_frames(), 1);
+    // Well before the retransmission timeout
+    BOOST_REQUIRE(elapsed < std::chrono::milliseconds(500));
+}
+
+
+BOOST_AUTO_TEST_CASE(compact_frames)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+    namespace constant = crux::detail::header::constant;
+
+    asio::io_service ios;
+
+    crux::socket client_socket(ios, endpoint_type(udp::v4(), 0));
+    crux::socket server_socket(ios);
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    relay relay(ios, endpoint_type(asio::ip::address_v4::loopback(),
+                                   acceptor.local_endpoint().port()));
+
+    // Frames from the client as they pass by
+    std::vector<std::pair<std::uint16_t, std::size_t>> frames;
+    relay.drop = [&](const char* data, std::size_t size) {
+        const auto type = (std::uint16_t(std::uint8_t(data[0])) << 8) | std::uint8_t(data[1]);
+        frames.emplace_back(type & constant::mask_type, size);
+        return false;
+    };
+
+    // Small messages go with a compact header, large ones with the full one
+    const std::size_t small_size = 80;
+    const std::size_t large_size = crux::detail::constant::max_compact_payload + 1;
+    const std::size_t message_count = 6;
+    std::vector<std::vector<char>> tx_data;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(i % 2 ? large_size : small_size, char('a' + i)));
+    }
+
+    std::vector<char> server_buffer(large_size);
+    std::vector<char> client_buffer(large_size);
+    std::size_t echoed = 0;
+
+    // The server receives directly into its buffer, as no accept is pending
+    std::function<void ()> server_loop = [&]() {
+        server_socket.async_receive(asio::buffer(server_buffer),
+            [&](const error_code& error, std::size_t size) {
+              if (error)
+                  return;
+              server_socket.async_send(asio::buffer(server_buffer, size),
+                  [&](const error_code& error, std::size_t) {
+                    if (!error) server_loop();
+                  });
+            });
+    };
+
+    std::function<void ()> client_loop = [&]() {
+        const auto& message = tx_data[echoed];
+        client_socket.async_send(asio::buffer(message),
+            [&](const error_code& error, std::size_t) {
+              BOOST_REQUIRE(!error);
+              client_socket.async_receive(asio::buffer(client_buffer),
+                  [&](const error_code& error, std::size_t size) {
+                    BOOST_REQUIRE(!error);
+                    BOOST_REQUIRE_EQUAL(to_string(std::vector<char>(client_buffer.begin(),
+                                                                    client_buffer.begin() + size)),
+                                        to_string(tx_data[echoed]));
+                    if (++echoed < message_count) {
+                        client_loop();
+                        return;
+                    }
+                    acceptor.close();
+                    relay.close();
+                    client_socket.close();
+                    server_socket.close();
+                  });
+            });
+    };
+
+    acceptor.async_accept(server_socket, [&](error_code error) {
+            BOOST_VERIFY(!error);
+            server_loop();
+            });
+
+    client_socket.async_connect(relay.client_side.local_endpoint(),
+            [&](error_code error) {
+              BOOST_VERIFY(!error);
+              client_loop();
+            });
+
+    ios.run();
+
+    BOOST_REQUIRE_EQUAL(echoed, message_count);
+
+    std::size_t compact_data = 0;
+    std::size_t full_data = 0;
+    std::size_t compact_acks = 0;
+    for (const auto& frame : frames) {
+        switch (frame.first) {
+        case constant::type_compact_data:
+            // With the acknowledgement and the window
+            BOOST_REQUIRE_EQUAL(frame.second, constant::compact_size + 4 + small_size);
+            ++compact_data;
+            break;
+        case constant::type_data:
+            BOOST_REQUIRE_EQUAL(frame.second, constant::size + large_size);
+            ++full_data;
+            break;
+        case constant::type_compact_ack:
+            BOOST_REQUIRE_EQUAL(frame.second, constant::compact_size + 2);
+            ++compact_acks;
+            break;
+        default:
+            break;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(compact_data, message_count / 2);
+    BOOST_REQUIRE_EQUAL(full_data, message_count / 2);
+    // The last echo is acknowledged after the relay has gone
+    BOOST_REQUIRE(compact_acks >= message_count - 1);
+}
+
+#if defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
+BOOST_AUTO_TEST_CASE(coalesced_receive___other_socket_receiving)
+{
+    using namespace maidsafe;
+    using udp = asio::ip::udp;
+    namespace constant = crux::detail::header::constant;
+    namespace segmentation = crux::detail::segmentation;
+
+    asio::io_service ios;
+
+    crux::acceptor acceptor(ios, endpoint_type(udp::v4(), 0));
+    relay relay(ios, endpoint_type(asio::ip::address_v4::loopback(),
+                                   acceptor.local_endpoint().port()));
+
+    crux::socket idle_client(ios, endpoint_type(udp::v4(), 0));
+    crux::socket receiving_client(ios, endpoint_type(udp::v4(), 0));
+    crux::socket idle_server(ios);
+    crux::socket receiving_server(ios);
+
+    auto run_until = [&](const std::function<bool ()>& done) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!done() && std::chrono::steady_clock::now() < deadline) {
+            ios.poll();
+            ios.reset();
+        }
+        return done();
+    };
+
+    // Full frames of equal size, as many as go out back to back, which the
+    // relay holds back and then sends in one go for the kernel to coalesce
+    // them again on the way in
+    const std::size_t message_size = crux::detail::constant::max_compact_payload + 1;
+    const std::size_t message_count = 2;
+    std::vector<std::vector<char>> tx_data;
+    for (std::size_t i = 0; i < message_count; ++i) {
+        tx_data.push_back(std::vector<char>(message_size, char('a' + i)));
+    }
+    const std::string message = "behind";
+
+    std::vector<std::vector<char>> held;
+    bool flushed = false;
+    relay.drop = [&](const char* data, std::size_t size) {
+        const auto type = (std::uint16_t(std::uint8_t(data[0])) << 8) | std::uint8_t(data[1]);
+        if (flushed || (type & constant::mask_type) != constant::type_data)
+            return false;
+        held.emplace_back(data, data + size);
+        if (held.size() < message_count)
+            return true;
+
+        std::vector<asio::const_buffer> segments;
+        for (const auto& frame : held) {
+            segments.push_back(asio::buffer(frame));
+        }
+        error_code error;
+        segmentation::send(relay.server_side.native_handle(), segments, size, relay.server, error);
+        if (error) {
+            // Kernel without UDP_SEGMENT
+            for (const auto& frame : held) {
+                relay.server_side.send_to(asio::buffer(frame), relay.server, 0, error);
+            }
+        }
+        flushed = true;
+
+        // Arrives behind the coalesced frames
+        receiving_client.async_send(asio::buffer(message), [](error_code, std::size_t) {});
+        return true;
+    };
+
+    std::size_t accepted = 0;
+    std::size_t connected = 0;
+    acceptor.async_accept(idle_server, [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            ++accepted;
+            acceptor.async_accept(receiving_server, [&](error_code error) {
+                    BOOST_REQUIRE(!error);
+                    ++accepted;
+                    });
+            });
+    idle_client.async_connect(relay.client_side.local_endpoint(), [&](error_code error) {
+            BOOST_REQUIRE(!error);
+            ++connected;
+            receiving_client.async_connect(relay.server, [&](error_code error) {
+                    BOOST_REQUIRE(!error);
+                    ++connected;
+                    });
+            });
+    BOOST_REQUIRE(run_until([&] { return accepted == 2 && connected == 2; }));
+
+    // Only one of the connections is receiving when the frames for the
+    // other arrive
+    std::array<char, 64> buffer;
+    std::size_t received = 0;
+    receiving_server.async_receive(asio::buffer(buffer), [&](error_code error, std::size_t size) {
+            BOOST_REQUIRE(!error);
+            received = size;
+            });
+    for (const auto& data : tx_data) {
+        idle_client.async_send(asio::buffer(data), [](error_code, std::size_t) {});
+    }
+    BOOST_REQUIRE(run_until([&] { return received > 0; }));
+    BOOST_REQUIRE(flushed);
+    BOOST_REQUIRE_EQUAL(std::string(buffer.data(), received), message);
+
+    // The coalesced frames have waited for the idle connection
+    std::vector<char> rx_buffer(message_size);
+    std::size_t idle_received = 0;
+    std::function<void ()> receive_loop = [&]() {
+        idle_server.async_receive(asio::buffer(rx_buffer), [&](error_code error, std::size_t size) {
+                BOOST_REQUIRE(!error);
+                BOOST_REQUIRE_EQUAL(to_string(std::vector<char>(rx_buffer.begin(),
+                                                                rx_buffer.begin() + size)),
+                                    to_string(tx_data[idle_received]));
+                if (++idle_received < message_count)
+                    receive_loop();
+                });
+    };
+    receive_loop();
+    BOOST_REQUIRE(run_until([&] { return idle_received == message_count; }));
+
+    acceptor.close();
+}
+
+#endif // defined(MAIDSAFE_CRUX_HAS_SEGMENTATION_OFFLOAD)
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/test/unit_test.hpp>
+#include <maidsafe/crux/detail/transmit_queue.hpp>
+
+namespace asio = boost::asio;
+using error_code = boost::system::error_code;
+using transmit_queue_type = maidsafe::crux::detail::transmit_queue<std::uint32_t>;
+using handler_memory = maidsafe::crux::detail::handler_memory;
+using clock_type = std::chrono::steady_clock;
+
+BOOST_AUTO_TEST_SUITE(transmit_queue_suite)
+
+BOOST_AUTO_TEST_CASE(batch_across_wrap)
+{
+    asio::io_service ios;
+    auto memory = std::make_shared<handler_memory>();
+    transmit_queue_type queue(ios, memory);
+
+    std::vector<std::pair<std::size_t, std::size_t>> sent;
+    std::size_t completions = 0;
+    std::size_t acknowledged = 0;
+
+    transmit_queue_type::frame_sizes_type
+        sizes(4, 100, maidsafe::crux::detail::handler_allocator<std::size_t>(memory));
+
+    // Sequence numbers 0xFFFFFFFE, 0xFFFFFFFF, 0 and 1
+    queue.push_batch(0xFFFFFFFE,
+                     std::move(sizes),
+                     [&](std::size_t first,
+                         std::size_t last,
+                         transmit_queue_type::iteration_handler handler)
+                     {
+                         // Handed to the kernel right away
+                         sent.emplace_back(first, last);
+                         handler(error_code(), 0);
+                     },
+                     [&](const error_code& error, std::size_t count)
+                     {
+                         BOOST_REQUIRE(!error);
+                         ++completions;
+                         acknowledged = count;
+                     });
+
+    BOOST_REQUIRE_EQUAL(sent.size(), 1);
+    BOOST_REQUIRE_EQUAL(sent[0].first, 0);
+    BOOST_REQUIRE_EQUAL(sent[0].second, 4);
+
+    queue.apply_ack(0xFFFFFFFF, clock_type::now());
+    BOOST_REQUIRE_EQUAL(completions, 0);
+
+    // Found after the wrap, too
+    queue.apply_ack(1, clock_type::now());
+    BOOST_REQUIRE_EQUAL(completions, 1);
+    BOOST_REQUIRE_EQUAL(acknowledged, 4);
+    BOOST_REQUIRE(queue.empty());
+
+    ios.run();
+}
+
+BOOST_AUTO_TEST_CASE(oldest_entry_is_active_across_wrap)
+{
+    asio::io_service ios;
+    transmit_queue_type queue(ios, std::make_shared<handler_memory>());
+
+    std::vector<std::uint32_t> sent;
+    std::vector<std::uint32_t> completed;
+
+    auto push = [&](std::uint32_t index) {
+        queue.push(index,
+                   100,
+                   [&sent, index](std::size_t,
+                                  std::size_t,
+                                  transmit_queue_type::iteration_handler handler)
+                   {
+                       sent.push_back(index);
+                       handler(error_code(), 100);
+                   },
+                   [&completed, index](const error_code& error, std::size_t)
+                   {
+                       BOOST_REQUIRE(!error);
+                       completed.push_back(index);
+                   });
+    };
+
+    // Queued before and after the wrap
+    push(0xFFFFFFFF);
+    push(0);
+
+    // Only the oldest is in flight
+    BOOST_REQUIRE_EQUAL(sent.size(), 1);
+    BOOST_REQUIRE_EQUAL(sent[0], 0xFFFFFFFF);
+
+    queue.apply_ack(0xFFFFFFFF, clock_type::now());
+    BOOST_REQUIRE_EQUAL(sent.size(), 2);
+    BOOST_REQUIRE_EQUAL(sent[1], 0);
+
+    queue.apply_ack(0, clock_type::now());
+    BOOST_REQUIRE_EQUAL(completed.size(), 2);
+    BOOST_REQUIRE_EQUAL(completed[0], 0xFFFFFFFF);
+    BOOST_REQUIRE_EQUAL(completed[1], 0);
+
+    ios.run();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
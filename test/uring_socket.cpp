@@ -0,0 +1,151 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Copyright (C) 2015 MaidSafe.net Limited
+//
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#if defined(MAIDSAFE_CRUX_WITH_IO_URING)
+
+#include <string>
+#include <boost/test/unit_test.hpp>
+#include <boost/asio/io_service.hpp>
+#include <maidsafe/crux/detail/uring_socket.hpp>
+
+namespace asio = boost::asio;
+using error_code = boost::system::error_code;
+using uring_socket = maidsafe::crux::detail::uring_socket;
+using endpoint_type = uring_socket::endpoint_type;
+
+BOOST_AUTO_TEST_SUITE(uring_socket_suite)
+
+BOOST_AUTO_TEST_CASE(send_receive)
+{
+    asio::io_service ios;
+
+    uring_socket sender(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+    uring_socket receiver(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+
+    const std::string message = "TEST_MESSAGE";
+    std::string received(message.size(), 'X');
+    endpoint_type remote_endpoint;
+    bool tested_send = false;
+    bool tested_receive = false;
+
+    receiver.async_receive_from(asio::buffer(&received[0], received.size()),
+                                remote_endpoint,
+                                [&](const error_code& error, std::size_t size) {
+                                    BOOST_REQUIRE(!error);
+                                    BOOST_REQUIRE_EQUAL(size, message.size());
+                                    tested_receive = true;
+                                });
+
+    sender.async_send_to(asio::buffer(message),
+                         receiver.local_endpoint(),
+                         [&](const error_code& error, std::size_t size) {
+                             BOOST_REQUIRE(!error);
+                             BOOST_REQUIRE_EQUAL(size, message.size());
+                             tested_send = true;
+                         });
+
+    ios.run();
+
+    BOOST_REQUIRE(tested_send && tested_receive);
+    BOOST_REQUIRE_EQUAL(received, message);
+    BOOST_REQUIRE_EQUAL(remote_endpoint, sender.local_endpoint());
+}
+
+BOOST_AUTO_TEST_CASE(peek_readable_receive)
+{
+    asio::io_service ios;
+
+    uring_socket sender(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+    uring_socket receiver(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+
+    const std::string message = "TEST_MESSAGE";
+    std::string received(message.size(), 'X');
+    bool tested = false;
+    endpoint_type peek_endpoint;
+
+    receiver.async_receive_from
+        (asio::buffer(static_cast<char*>(nullptr), 0),
+         peek_endpoint,
+         uring_socket::message_peek,
+         [&](const error_code& error, std::size_t) {
+             BOOST_REQUIRE(!error);
+             BOOST_REQUIRE_EQUAL(peek_endpoint, sender.local_endpoint());
+
+             uring_socket::bytes_readable command(true);
+             receiver.io_control(command);
+             BOOST_REQUIRE_EQUAL(command.get(), message.size());
+
+             endpoint_type remote_endpoint;
+             error_code receive_error;
+             auto size = receiver.receive_from(asio::buffer(&received[0], received.size()),
+                                               remote_endpoint,
+                                               uring_socket::message_flags(),
+                                               receive_error);
+             BOOST_REQUIRE(!receive_error);
+             BOOST_REQUIRE_EQUAL(size, message.size());
+
+             // The datagram has been consumed
+             receiver.io_control(command);
+             BOOST_REQUIRE_EQUAL(command.get(), 0);
+             tested = true;
+         });
+
+    sender.async_send_to(asio::buffer(message),
+                         receiver.local_endpoint(),
+                         [](const error_code&, std::size_t) {});
+
+    ios.run();
+
+    BOOST_REQUIRE(tested);
+    BOOST_REQUIRE_EQUAL(received, message);
+}
+
+BOOST_AUTO_TEST_CASE(close_aborts_receive)
+{
+    asio::io_service ios;
+
+    uring_socket receiver(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+
+    char data[4];
+    endpoint_type remote_endpoint;
+    bool tested = false;
+
+    receiver.async_receive_from(asio::buffer(data),
+                                remote_endpoint,
+                                [&](const error_code& error, std::size_t) {
+                                    BOOST_REQUIRE(error);
+                                    tested = true;
+                                });
+
+    ios.post([&]() { receiver.close(); });
+
+    ios.run();
+
+    BOOST_REQUIRE(tested);
+    BOOST_REQUIRE(!receiver.is_open());
+}
+
+BOOST_AUTO_TEST_CASE(close_releases_port)
+{
+    asio::io_service ios;
+
+    uring_socket first(ios, endpoint_type(asio::ip::address_v4::loopback(), 0));
+    const auto local_endpoint = first.local_endpoint();
+    first.close();
+
+    // Still alive, so only close() can have released the port
+    uring_socket second(ios, local_endpoint);
+    BOOST_REQUIRE(second.is_open());
+    BOOST_REQUIRE_EQUAL(second.local_endpoint(), local_endpoint);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif // defined(MAIDSAFE_CRUX_WITH_IO_URING)